@@ -0,0 +1,556 @@
+#include <quicsend_client.hpp>
+#include <quicsend_server.hpp>
+#include <quicsend_tools.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+
+
+//------------------------------------------------------------------------------
+// Options
+
+static const char* kUsage =
+    "Usage: quicsend_bench --cert=server.pem --key=server.key [options]\n"
+    "\n"
+    "Runs a QuicSendServer and QuicSendClients in this process over loopback\n"
+    "and prints one JSON result per configuration in the sweep.  The server and\n"
+    "clients can also run as separate processes, e.g. across an emulated WAN.\n"
+    "\n"
+    "  --role=both               both, server (serve until SIGINT/SIGTERM) or client\n"
+    "  --host=127.0.0.1          Server address for the client role\n"
+    "  --port=4433               Server port\n"
+    "  --direction=download      download: server sends the body, upload: client does\n"
+    "  --body=64K,1M,16M         Body sizes to sweep.  A server role answers up to the largest\n"
+    "  --concurrency=1,8         Requests in flight per connection to sweep\n"
+    "  --connections=1,4         Client connections to sweep\n"
+    "  --duration=3              Measured seconds per configuration\n"
+    "  --warmup=0.5              Unmeasured seconds before each measurement\n"
+    "  --output=FILE             Write JSON to FILE instead of stdout\n"
+    "  --verbose                 Keep library INFO logs\n";
+
+enum class BenchRole {
+    Both,
+    Server,
+    Client,
+};
+
+struct BenchOptions {
+    std::string CertPath;
+    std::string KeyPath;
+    BenchRole Role = BenchRole::Both;
+    std::string Host = "127.0.0.1";
+    uint16_t Port = 4433;
+    bool Upload = false;
+    std::vector<int64_t> BodySizes = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+    std::vector<int64_t> Concurrency = { 1, 8 };
+    std::vector<int64_t> Connections = { 1, 4 };
+    double DurationSec = 3.0;
+    double WarmupSec = 0.5;
+    std::string OutputPath;
+    bool Verbose = false;
+};
+
+// Accepts K, M and G suffixes (powers of 1024)
+static bool parse_size(const std::string& text, int64_t& value)
+{
+    char* end = nullptr;
+    value = std::strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        default: break;
+    }
+    return *end == '\0' && value > 0;
+}
+
+static bool parse_list(const std::string& text, std::vector<int64_t>& values)
+{
+    values.clear();
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos) {
+            comma = text.size();
+        }
+        int64_t value = 0;
+        if (!parse_size(text.substr(start, comma - start), value)) {
+            return false;
+        }
+        values.push_back(value);
+        start = comma + 1;
+    }
+    return !values.empty();
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        size_t eq = arg.find('=');
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg.resize(eq);
+        }
+
+        bool ok = true;
+        if (arg == "--cert") {
+            options.CertPath = value;
+        } else if (arg == "--key") {
+            options.KeyPath = value;
+        } else if (arg == "--role") {
+            if (value == "both") {
+                options.Role = BenchRole::Both;
+            } else if (value == "server") {
+                options.Role = BenchRole::Server;
+            } else if (value == "client") {
+                options.Role = BenchRole::Client;
+            } else {
+                ok = false;
+            }
+        } else if (arg == "--host") {
+            options.Host = value;
+        } else if (arg == "--port") {
+            options.Port = static_cast<uint16_t>(std::atoi(value.c_str()));
+        } else if (arg == "--direction") {
+            ok = (value == "download" || value == "upload");
+            options.Upload = (value == "upload");
+        } else if (arg == "--body") {
+            ok = parse_list(value, options.BodySizes);
+        } else if (arg == "--concurrency") {
+            ok = parse_list(value, options.Concurrency);
+        } else if (arg == "--connections") {
+            ok = parse_list(value, options.Connections);
+        } else if (arg == "--duration") {
+            options.DurationSec = std::atof(value.c_str());
+        } else if (arg == "--warmup") {
+            options.WarmupSec = std::atof(value.c_str());
+        } else if (arg == "--output") {
+            options.OutputPath = value;
+        } else if (arg == "--verbose") {
+            options.Verbose = true;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n\n%s", argv[i], kUsage);
+            return false;
+        }
+    }
+
+    for (int64_t size : options.BodySizes) {
+        if (size > INT32_MAX) {
+            std::fprintf(stderr, "Body sizes are limited to 2 GB\n");
+            return false;
+        }
+    }
+
+    // The client only needs the certificate to pin it
+    const bool needs_key = options.Role != BenchRole::Client;
+    if (options.CertPath.empty() || (needs_key && options.KeyPath.empty()) || options.Port == 0) {
+        std::fprintf(stderr, "%s", kUsage);
+        return false;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+#define BENCH_AUTHORIZATION "Bearer quicsend_bench"
+#define BENCH_CONTENT_TYPE "application/octet-stream"
+#define BENCH_CONNECT_TIMEOUT_MSEC 10000
+#define BENCH_POLL_MSEC 10
+
+// User plus system CPU time of the whole process
+static double process_cpu_sec()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+// Shared by every body sent: contents do not matter
+static std::vector<uint8_t> g_payload;
+
+// Lives as long as the process, so queued bodies reference it without a copy
+static const std::shared_ptr<void> g_payload_owner(&g_payload, [](void*) {});
+
+
+//------------------------------------------------------------------------------
+// BenchServer
+
+// Answers each request on its own poll thread.  For downloads the client
+// puts the response size in the info header
+class BenchServer {
+public:
+    explicit BenchServer(const BenchOptions& options) {
+        QuicSendServerSettings settings;
+        settings.Authorization = BENCH_AUTHORIZATION;
+        settings.Port = options.Port;
+        settings.CertPath = options.CertPath;
+        settings.KeyPath = options.KeyPath;
+        server_ = std::make_unique<QuicSendServer>(settings);
+
+        poll_thread_ = std::thread([this]() {
+            while (!stop_ && server_->IsRunning()) {
+                server_->Poll([this](const QuicheMailbox::Event& event) {
+                    OnEvent(event);
+                }, BENCH_POLL_MSEC);
+            }
+        });
+    }
+
+    ~BenchServer() {
+        stop_ = true;
+        if (poll_thread_.joinable()) {
+            poll_thread_.join();
+        }
+        server_.reset();
+    }
+
+protected:
+    std::unique_ptr<QuicSendServer> server_;
+    std::thread poll_thread_;
+    std::atomic<bool> stop_ = ATOMIC_VAR_INIT(false);
+
+    void OnEvent(const QuicheMailbox::Event& event) {
+        if (event.Type != QuicheMailbox::EventType::Data) {
+            return;
+        }
+
+        BodyData body;
+        const int64_t bytes = std::min<int64_t>(
+            std::atoll(event.Stream->HeaderInfo.c_str()), g_payload.size());
+        if (bytes > 0) {
+            body.ContentType = BENCH_CONTENT_TYPE;
+            body.Data = g_payload.data();
+            body.Owner = g_payload_owner;
+            body.Length = static_cast<int32_t>(bytes);
+        }
+        server_->Respond(event.ConnectionAssignedId, event.Stream->Id, 200, "", body);
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// BenchRun
+
+struct BenchConfig {
+    int64_t BodyBytes = 0;
+    int64_t Concurrency = 0;
+    int64_t Connections = 0;
+};
+
+// Counters shared by the client poll threads of one configuration
+struct BenchCounters {
+    std::atomic<bool> Measuring = ATOMIC_VAR_INIT(false);
+    std::atomic<bool> Stopping = ATOMIC_VAR_INIT(false);
+    std::atomic<int> Connected = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> Requests = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> Bytes = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> Errors = ATOMIC_VAR_INIT(0);
+    LatencyHistogram Latency;
+};
+
+// One client connection keeping Concurrency requests in flight.
+// Everything but the counters is only touched by its poll thread
+class BenchConnection {
+public:
+    BenchConnection(const BenchOptions& options, const BenchConfig& config, BenchCounters& counters)
+        : options_(options)
+        , config_(config)
+        , counters_(counters)
+    {
+        QuicSendClientSettings settings;
+        settings.Authorization = BENCH_AUTHORIZATION;
+        settings.Host = options.Host;
+        settings.Port = options.Port;
+        settings.CertPath = options.CertPath;
+        client_ = std::make_unique<QuicSendClient>(settings);
+
+        poll_thread_ = std::thread([this]() {
+            while (!counters_.Stopping && client_->IsRunning()) {
+                client_->mailbox_.Poll([this](const QuicheMailbox::Event& event) {
+                    OnEvent(event);
+                }, BENCH_POLL_MSEC);
+            }
+        });
+    }
+
+    ~BenchConnection() {
+        if (poll_thread_.joinable()) {
+            poll_thread_.join();
+        }
+        client_.reset();
+    }
+
+protected:
+    const BenchOptions& options_;
+    const BenchConfig config_;
+    BenchCounters& counters_;
+
+    std::unique_ptr<QuicSendClient> client_;
+    std::thread poll_thread_;
+
+    // Request id to GetNsec() at submit
+    std::unordered_map<int64_t, int64_t> submit_nsec_;
+
+    void SendRequest() {
+        BodyData body;
+        std::string info;
+        if (options_.Upload) {
+            body.ContentType = BENCH_CONTENT_TYPE;
+            body.Data = g_payload.data();
+            body.Owner = g_payload_owner;
+            body.Length = static_cast<int32_t>(config_.BodyBytes);
+        } else {
+            info = std::to_string(config_.BodyBytes);
+        }
+
+        const int64_t submit_nsec = GetNsec();
+        const int64_t id = client_->Request("/bench", info, body);
+        if (id < 0) {
+            counters_.Errors++;
+            return;
+        }
+        submit_nsec_[id] = submit_nsec;
+    }
+
+    void OnEvent(const QuicheMailbox::Event& event) {
+        switch (event.Type) {
+            case QuicheMailbox::EventType::Connect:
+                counters_.Connected++;
+                for (int64_t i = 0; i < config_.Concurrency; ++i) {
+                    SendRequest();
+                }
+                break;
+
+            case QuicheMailbox::EventType::Timeout:
+                counters_.Errors++;
+                break;
+
+            case QuicheMailbox::EventType::Data: {
+                const int64_t now_nsec = GetNsec();
+                auto it = submit_nsec_.find(event.Stream->Id);
+                if (it == submit_nsec_.end()) {
+                    break;
+                }
+                const int64_t submit_nsec = it->second;
+                submit_nsec_.erase(it);
+
+                if (event.Stream->Status != "200") {
+                    counters_.Errors++;
+                } else if (counters_.Measuring) {
+                    counters_.Requests++;
+                    counters_.Bytes += config_.BodyBytes;
+                    counters_.Latency.Record((now_nsec - submit_nsec) / 1000);
+                }
+
+                if (!counters_.Stopping) {
+                    SendRequest();
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+};
+
+struct BenchResult {
+    BenchConfig Config;
+    double Seconds = 0.0;
+    double CpuSec = 0.0;
+    uint64_t Requests = 0;
+    uint64_t Bytes = 0;
+    uint64_t Errors = 0;
+    LatencyStats Latency;
+    bool Connected = false;
+};
+
+static void sleep_sec(double seconds)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(seconds * 1e6)));
+}
+
+static BenchResult run_config(const BenchOptions& options, const BenchConfig& config)
+{
+    BenchResult result;
+    result.Config = config;
+
+    BenchCounters counters;
+    std::vector<std::unique_ptr<BenchConnection>> connections;
+    for (int64_t i = 0; i < config.Connections; ++i) {
+        connections.push_back(std::make_unique<BenchConnection>(options, config, counters));
+    }
+
+    const int64_t deadline_nsec = GetNsec() + BENCH_CONNECT_TIMEOUT_MSEC * 1000000LL;
+    while (counters.Connected < config.Connections && GetNsec() < deadline_nsec) {
+        sleep_sec(0.01);
+    }
+    result.Connected = (counters.Connected == config.Connections);
+
+    if (result.Connected) {
+        sleep_sec(options.WarmupSec);
+
+        const double cpu0 = process_cpu_sec();
+        const int64_t t0 = GetNsec();
+        counters.Measuring = true;
+
+        sleep_sec(options.DurationSec);
+
+        counters.Measuring = false;
+        const int64_t t1 = GetNsec();
+        result.CpuSec = process_cpu_sec() - cpu0;
+        result.Seconds = (t1 - t0) * 1e-9;
+    }
+
+    counters.Stopping = true;
+    connections.clear();
+
+    result.Requests = counters.Requests;
+    result.Bytes = counters.Bytes;
+    result.Errors = counters.Errors;
+    counters.Latency.GetStats(result.Latency);
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+// Output
+
+static void write_result(FILE* out, const BenchOptions& options, const BenchResult& result, bool last)
+{
+    const double seconds = result.Seconds > 0.0 ? result.Seconds : 1.0;
+    const double gigabytes = result.Bytes * 1e-9;
+
+    std::fprintf(out,
+        "  {\"direction\": \"%s\", \"body_bytes\": %lld, \"concurrency\": %lld, \"connections\": %lld, "
+        "\"connected\": %s, \"seconds\": %.3f, \"requests\": %llu, \"errors\": %llu, "
+        "\"gbps\": %.3f, \"requests_per_sec\": %.1f, \"cpu_sec\": %.3f, \"cpu_sec_per_gb\": %.3f, "
+        "\"latency_usec\": {\"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}%s\n",
+        options.Upload ? "upload" : "download",
+        static_cast<long long>(result.Config.BodyBytes),
+        static_cast<long long>(result.Config.Concurrency),
+        static_cast<long long>(result.Config.Connections),
+        result.Connected ? "true" : "false",
+        result.Seconds,
+        static_cast<unsigned long long>(result.Requests),
+        static_cast<unsigned long long>(result.Errors),
+        result.Bytes * 8e-9 / seconds,
+        result.Requests / seconds,
+        result.CpuSec,
+        gigabytes > 0.0 ? result.CpuSec / gigabytes : 0.0,
+        static_cast<unsigned long long>(result.Latency.MeanUsec),
+        static_cast<unsigned long long>(result.Latency.P50Usec),
+        static_cast<unsigned long long>(result.Latency.P90Usec),
+        static_cast<unsigned long long>(result.Latency.P99Usec),
+        static_cast<unsigned long long>(result.Latency.P999Usec),
+        static_cast<unsigned long long>(result.Latency.MaxUsec),
+        last ? "" : ",");
+    std::fflush(out);
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        return 1;
+    }
+
+    // Blocked before any thread starts so every thread inherits the mask,
+    // and the server role can wait for them with sigwait()
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    if (options.Role == BenchRole::Server) {
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+    }
+
+    // Keep stdout for the JSON results
+    Logger& logger = Logger::getInstance();
+    logger.SetLogLevel(options.Verbose ? Logger::INFO : Logger::WARN);
+    logger.SetCallback([](Logger::LogLevel, const std::string& message) {
+        std::cerr << message << std::endl;
+    });
+
+    int64_t max_body = 0;
+    for (int64_t size : options.BodySizes) {
+        max_body = std::max(max_body, size);
+    }
+    g_payload.assign(static_cast<size_t>(max_body), 'A');
+
+    if (options.Role == BenchRole::Server) {
+        BenchServer server(options);
+        int signal_number = 0;
+        sigwait(&stop_signals, &signal_number);
+        return 0;
+    }
+
+    FILE* out = stdout;
+    if (!options.OutputPath.empty()) {
+        out = std::fopen(options.OutputPath.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "Failed to open %s\n", options.OutputPath.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<BenchConfig> configs;
+    for (int64_t connections : options.Connections) {
+        for (int64_t concurrency : options.Concurrency) {
+            for (int64_t body_bytes : options.BodySizes) {
+                BenchConfig config;
+                config.BodyBytes = body_bytes;
+                config.Concurrency = concurrency;
+                config.Connections = connections;
+                configs.push_back(config);
+            }
+        }
+    }
+
+    int failures = 0;
+    {
+        std::unique_ptr<BenchServer> server;
+        if (options.Role == BenchRole::Both) {
+            server = std::make_unique<BenchServer>(options);
+        }
+
+        std::fprintf(out, "[\n");
+        for (size_t i = 0; i < configs.size(); ++i) {
+            BenchResult result = run_config(options, configs[i]);
+            if (!result.Connected) {
+                ++failures;
+            }
+            write_result(out, options, result, i + 1 == configs.size());
+        }
+        std::fprintf(out, "]\n");
+    }
+
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,867 @@
+#include <quicsend_server.hpp>
+#include <quicsend_tools.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+//------------------------------------------------------------------------------
+// Options
+
+static const char* kUsage =
+    "Usage: quicsend_loadgen --cert=server.pem --key=server.key [options]\n"
+    "\n"
+    "Opens thousands of client connections from a few threads against one\n"
+    "QuicSendServer and prints one JSON result per connection count: handshake\n"
+    "rate, server and client memory per connection, server CPU and request\n"
+    "latency percentiles.  The server runs in a child process so its CPU and\n"
+    "memory are measured on their own.\n"
+    "\n"
+    "  --port=4433               Server port\n"
+    "  --host=IP                 Load an external server instead of a local one\n"
+    "  --server-pid=PID          Sample CPU and memory of an external server\n"
+    "  --connections=100,1000    Connection counts to step through, ascending\n"
+    "  --threads=4               Client sockets, each with its own IO thread\n"
+    "  --rate=1                  Requests per second per connection\n"
+    "  --body=1K                 Response body size\n"
+    "  --duration=5              Measured seconds per step\n"
+    "  --warmup=1                Unmeasured seconds of requests before each measurement\n"
+    "  --connect-timeout=30      Seconds to wait for the handshakes of a step\n"
+    "  --settle=2                Seconds between steps for the server to drop connections\n"
+    "  --output=FILE             Write JSON to FILE instead of stdout\n"
+    "  --verbose                 Keep library INFO logs\n";
+
+struct LoadOptions {
+    std::string CertPath;
+    std::string KeyPath;
+    uint16_t Port = 4433;
+    std::string Host;
+    pid_t ServerPid = 0;
+    std::vector<int64_t> Connections = { 100, 1000 };
+    int Threads = 4;
+    double Rate = 1.0;
+    int64_t BodyBytes = 1024;
+    double DurationSec = 5.0;
+    double WarmupSec = 1.0;
+    double ConnectTimeoutSec = 30.0;
+    double SettleSec = 2.0;
+    std::string OutputPath;
+    bool Verbose = false;
+};
+
+// Accepts K, M and G suffixes (powers of 1024)
+static bool parse_size(const std::string& text, int64_t& value)
+{
+    char* end = nullptr;
+    value = std::strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        default: break;
+    }
+    return *end == '\0' && value > 0;
+}
+
+static bool parse_list(const std::string& text, std::vector<int64_t>& values)
+{
+    values.clear();
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos) {
+            comma = text.size();
+        }
+        int64_t value = 0;
+        if (!parse_size(text.substr(start, comma - start), value)) {
+            return false;
+        }
+        values.push_back(value);
+        start = comma + 1;
+    }
+    return !values.empty();
+}
+
+static bool parse_options(int argc, char** argv, LoadOptions& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        size_t eq = arg.find('=');
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg.resize(eq);
+        }
+
+        bool ok = true;
+        if (arg == "--cert") {
+            options.CertPath = value;
+        } else if (arg == "--key") {
+            options.KeyPath = value;
+        } else if (arg == "--port") {
+            options.Port = static_cast<uint16_t>(std::atoi(value.c_str()));
+        } else if (arg == "--host") {
+            options.Host = value;
+        } else if (arg == "--server-pid") {
+            options.ServerPid = static_cast<pid_t>(std::atoi(value.c_str()));
+        } else if (arg == "--connections") {
+            ok = parse_list(value, options.Connections);
+        } else if (arg == "--threads") {
+            options.Threads = std::atoi(value.c_str());
+            ok = options.Threads > 0;
+        } else if (arg == "--rate") {
+            options.Rate = std::atof(value.c_str());
+            ok = options.Rate > 0.0;
+        } else if (arg == "--body") {
+            ok = parse_size(value, options.BodyBytes) && options.BodyBytes <= INT32_MAX;
+        } else if (arg == "--duration") {
+            options.DurationSec = std::atof(value.c_str());
+        } else if (arg == "--warmup") {
+            options.WarmupSec = std::atof(value.c_str());
+        } else if (arg == "--connect-timeout") {
+            options.ConnectTimeoutSec = std::atof(value.c_str());
+        } else if (arg == "--settle") {
+            options.SettleSec = std::atof(value.c_str());
+        } else if (arg == "--output") {
+            options.OutputPath = value;
+        } else if (arg == "--verbose") {
+            options.Verbose = true;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n\n%s", argv[i], kUsage);
+            return false;
+        }
+    }
+
+    // The client only needs the certificate to pin it
+    const bool local_server = options.Host.empty();
+    if (options.CertPath.empty() || (local_server && options.KeyPath.empty()) || options.Port == 0) {
+        std::fprintf(stderr, "%s", kUsage);
+        return false;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+#define LOADGEN_AUTHORIZATION "Bearer quicsend_bench"
+#define LOADGEN_CONTENT_TYPE "application/octet-stream"
+#define LOADGEN_PATH "/load"
+#define LOADGEN_POLL_MSEC 10
+
+static void sleep_sec(double seconds)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(seconds * 1e6)));
+}
+
+// User plus system CPU time of a process from /proc/<pid>/stat.
+// Returns -1 if the process cannot be read
+static double process_cpu_sec(pid_t pid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(file, line)) {
+        return -1.0;
+    }
+
+    // The command name may contain spaces, so start after its closing paren
+    const size_t paren = line.rfind(')');
+    if (paren == std::string::npos) {
+        return -1.0;
+    }
+    std::istringstream fields(line.substr(paren + 2));
+
+    // Fields 3 to 13 precede utime and stime
+    std::string skip;
+    for (int i = 3; i <= 13; ++i) {
+        fields >> skip;
+    }
+    unsigned long long utime = 0, stime = 0;
+    if (!(fields >> utime >> stime)) {
+        return -1.0;
+    }
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// Resident set size in bytes from /proc/<pid>/statm.  Returns -1 on failure
+static int64_t process_rss_bytes(pid_t pid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/statm");
+    int64_t size_pages = 0, resident_pages = 0;
+    if (!(file >> size_pages >> resident_pages)) {
+        return -1;
+    }
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+
+//------------------------------------------------------------------------------
+// Server Process
+
+// Shared by every response body: contents do not matter
+static std::vector<uint8_t> g_payload;
+
+// Lives as long as the process, so queued bodies reference it without a copy
+static const std::shared_ptr<void> g_payload_owner(&g_payload, [](void*) {});
+
+// Runs a QuicSendServer that answers each request with a body of the size in
+// its info header.  Writes one byte to ready_fd once listening, then serves
+// until control_fd is closed by the parent
+static int run_server_process(const LoadOptions& options, int ready_fd, int control_fd)
+{
+    Logger& logger = Logger::getInstance();
+    logger.SetLogLevel(options.Verbose ? Logger::INFO : Logger::WARN);
+    logger.SetCallback([](Logger::LogLevel, const std::string& message) {
+        std::cerr << message << std::endl;
+    });
+
+    g_payload.assign(static_cast<size_t>(options.BodyBytes), 'A');
+
+    QuicSendServerSettings settings;
+    settings.Authorization = LOADGEN_AUTHORIZATION;
+    settings.Port = options.Port;
+    settings.CertPath = options.CertPath;
+    settings.KeyPath = options.KeyPath;
+    QuicSendServer server(settings);
+
+    std::atomic<bool> stop = ATOMIC_VAR_INIT(false);
+    std::thread poll_thread([&]() {
+        while (!stop && server.IsRunning()) {
+            server.Poll([&](const QuicheMailbox::Event& event) {
+                if (event.Type != QuicheMailbox::EventType::Data) {
+                    return;
+                }
+
+                BodyData body;
+                const int64_t bytes = std::min<int64_t>(
+                    std::atoll(event.Stream->HeaderInfo.c_str()), g_payload.size());
+                if (bytes > 0) {
+                    body.ContentType = LOADGEN_CONTENT_TYPE;
+                    body.Data = g_payload.data();
+                    body.Owner = g_payload_owner;
+                    body.Length = static_cast<int32_t>(bytes);
+                }
+                server.Respond(event.ConnectionAssignedId, event.Stream->Id, 200, "", body);
+            }, LOADGEN_POLL_MSEC);
+        }
+    });
+
+    const char ready = 1;
+    if (write(ready_fd, &ready, 1) != 1) {
+        stop = true;
+    }
+    close(ready_fd);
+
+    // Blocks until the parent closes its end or exits
+    char unused;
+    while (!stop && read(control_fd, &unused, 1) > 0) {
+    }
+
+    stop = true;
+    poll_thread.join();
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// LoadGroup
+
+// Counters shared by the groups of one step
+struct LoadCounters {
+    std::atomic<bool> Measuring = ATOMIC_VAR_INIT(false);
+    std::atomic<bool> Stopping = ATOMIC_VAR_INIT(false);
+
+    std::atomic<int64_t> Connected = ATOMIC_VAR_INIT(0);
+    std::atomic<int64_t> Failed = ATOMIC_VAR_INIT(0);
+    std::atomic<int64_t> LastConnectNsec = ATOMIC_VAR_INIT(0);
+    LatencyHistogram Handshake;
+
+    std::atomic<uint64_t> Requests = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> Errors = ATOMIC_VAR_INIT(0);
+
+    // Sends that were due while the previous request was still in flight
+    std::atomic<uint64_t> Skipped = ATOMIC_VAR_INIT(0);
+    LatencyHistogram Latency;
+};
+
+// Client connections multiplexed onto one UDP socket.  The IO thread
+// routes datagrams to connections by destination connection id, like the
+// server does, and a driver thread paces requests on every connection.
+class LoadGroup {
+public:
+    static constexpr bool IsServer = false;
+
+    LoadGroup(
+        const LoadOptions& options,
+        LoadCounters& counters,
+        const std::vector<uint8_t>& cert_der,
+        const boost::asio::ip::udp::endpoint& server_endpoint,
+        int64_t connection_count)
+        : options_(options)
+        , counters_(counters)
+        , cert_der_(cert_der)
+        , server_endpoint_(server_endpoint)
+    {
+        // Each response arrives well within the send interval, so every
+        // request carries the same headers
+        request_headers_.Add(":method", "GET");
+        request_headers_.Add(":scheme", "https");
+        request_headers_.Add(":authority", server_endpoint.address().to_string());
+        request_headers_.Add(":path", LOADGEN_PATH);
+        request_headers_.Add("user-agent", QUICSEND_CLIENT_AGENT);
+        request_headers_.Add("Authorization", LOADGEN_AUTHORIZATION);
+        request_headers_.Add(QUICSEND_HEADER_INFO, std::to_string(options.BodyBytes));
+
+        interval_nsec_ = static_cast<int64_t>(1e9 / options.Rate);
+
+        qs_ = std::make_shared<QuicheSocket>(io_context_);
+        sender_ = std::make_shared<QuicheSender>(qs_);
+
+        connections_.resize(static_cast<size_t>(connection_count));
+        for (size_t i = 0; i < connections_.size(); ++i) {
+            QCSettings qcs;
+            qcs.AssignedId = i;
+            qcs.qs = qs_;
+            qcs.dcid.Randomize();
+
+            auto connection = std::make_shared<QuicheRoleConnection<LoadGroup>>(this);
+            connection->Initialize(qcs);
+            connections_[i].Connection = connection;
+        }
+
+        qs_->StartReceive(this);
+
+        // One handler per connection so datagrams are received in between
+        for (size_t i = 0; i < connections_.size(); ++i) {
+            boost::asio::post(io_context_, [this, i]() {
+                OpenConnection(i);
+            });
+        }
+
+        io_thread_ = std::thread([this]() {
+            io_context_.run();
+        });
+        driver_thread_ = std::thread([this]() {
+            DriverLoop();
+        });
+    }
+
+    ~LoadGroup() {
+        mailbox_.Shutdown();
+        if (driver_thread_.joinable()) {
+            driver_thread_.join();
+        }
+        io_context_.stop();
+        if (io_thread_.joinable()) {
+            io_thread_.join();
+        }
+        sender_.reset();
+        connections_.clear();
+        qs_.reset();
+    }
+
+    // Sends CONNECTION_CLOSE on every connection so the server frees them
+    // without waiting for the idle timeout
+    void CloseAll() {
+        boost::asio::post(io_context_, [this]() {
+            for (auto& entry : connections_) {
+                entry.Connection->Close("done");
+                entry.Connection->FlushEgress();
+            }
+        });
+    }
+
+    void OnDatagram(
+        uint8_t* data,
+        std::size_t bytes,
+        const boost::asio::ip::udp::endpoint& peer_endpoint)
+    {
+        uint8_t type = 0;
+        uint32_t version = 0;
+        ConnectionId scid, dcid;
+        uint8_t token[MAX_TOKEN_LEN];
+        size_t token_len = sizeof(token);
+
+        int rc = quiche_header_info(data, bytes,
+                                    LOCAL_CONN_ID_LEN,
+                                    &version, &type,
+                                    scid.data(), &scid.Length,
+                                    dcid.data(), &dcid.Length,
+                                    token, &token_len);
+        if (rc < 0) {
+            return;
+        }
+
+        std::shared_ptr<QuicheConnection> connection = sender_->Find(dcid);
+        if (connection) {
+            connection->OnDatagram(data, bytes, peer_endpoint);
+        }
+    }
+
+    void OnConnect(
+        QuicheConnection& connection,
+        const boost::asio::ip::udp::endpoint& peer_endpoint)
+    {
+        // On a mismatch the connection is closed and OnTimeout() counts it
+        if (!connection.ComparePeerCertificate(cert_der_.data(), cert_der_.size())) {
+            return;
+        }
+
+        const int64_t now_nsec = GetNsec();
+        const LoadConnection& entry = connections_[connection.settings_.AssignedId];
+        counters_.Handshake.Record((now_nsec - entry.ConnectNsec) / 1000);
+        counters_.LastConnectNsec = now_nsec;
+        counters_.Connected++;
+
+        QuicheMailbox::Event event;
+        event.Type = QuicheMailbox::EventType::Connect;
+        event.ConnectionAssignedId = connection.settings_.AssignedId;
+        event.PeerEndpoint = peer_endpoint;
+        mailbox_.Post(event);
+    }
+
+    void OnTimeout(QuicheConnection& connection) {
+        if (!counters_.Stopping) {
+            if (connection.IsConnected()) {
+                counters_.Errors++;
+            } else {
+                counters_.Failed++;
+            }
+        }
+    }
+
+    void OnData(
+        QuicheConnection& connection,
+        const QuicheMailbox::Event& event)
+    {
+        if (connection.IsConnected()) {
+            mailbox_.Post(event);
+        }
+    }
+
+protected:
+    const LoadOptions& options_;
+    LoadCounters& counters_;
+    const std::vector<uint8_t>& cert_der_;
+    const boost::asio::ip::udp::endpoint server_endpoint_;
+
+    HeaderTemplate request_headers_;
+    int64_t interval_nsec_ = 0;
+
+    boost::asio::io_context io_context_;
+    std::shared_ptr<QuicheSocket> qs_;
+    std::shared_ptr<QuicheSender> sender_;
+
+    struct LoadConnection {
+        std::shared_ptr<QuicheRoleConnection<LoadGroup>> Connection;
+
+        // Written by the IO thread before Connect()
+        int64_t ConnectNsec = 0;
+
+        // Driver thread only
+        int64_t InFlightStream = -1;
+        int64_t SubmitNsec = 0;
+    };
+
+    // Indexed by AssignedId.  Sized before any thread starts
+    std::vector<LoadConnection> connections_;
+
+    QuicheMailbox mailbox_;
+    std::thread io_thread_;
+    std::thread driver_thread_;
+
+    // Driver thread only: (due nsec, connection index), soonest first
+    using DueSend = std::pair<int64_t, size_t>;
+    std::priority_queue<DueSend, std::vector<DueSend>, std::greater<DueSend>> due_sends_;
+
+    void OpenConnection(size_t index) {
+        auto& entry = connections_[index];
+        sender_->Add(entry.Connection);
+        entry.ConnectNsec = GetNsec();
+        if (!entry.Connection->Connect(server_endpoint_)) {
+            counters_.Failed++;
+            return;
+        }
+        entry.Connection->FlushEgress();
+    }
+
+    void DriverLoop() {
+        // Spreads the first request of each connection over one interval so
+        // the connections do not send in lockstep
+        std::mt19937_64 rng(reinterpret_cast<uintptr_t>(this));
+        std::uniform_int_distribution<int64_t> jitter(0, interval_nsec_ - 1);
+
+        while (!counters_.Stopping) {
+            int timeout_msec = LOADGEN_POLL_MSEC;
+            if (!due_sends_.empty()) {
+                const int64_t wait_nsec = due_sends_.top().first - GetNsec();
+                timeout_msec = static_cast<int>(std::clamp<int64_t>(
+                    wait_nsec / 1000000, 0, LOADGEN_POLL_MSEC));
+            }
+
+            mailbox_.Poll([&](const QuicheMailbox::Event& event) {
+                if (event.ConnectionAssignedId >= connections_.size()) {
+                    return;
+                }
+                if (event.Type == QuicheMailbox::EventType::Connect) {
+                    due_sends_.emplace(GetNsec() + jitter(rng), event.ConnectionAssignedId);
+                } else if (event.Type == QuicheMailbox::EventType::Data) {
+                    OnResponse(connections_[event.ConnectionAssignedId], event);
+                }
+            }, timeout_msec);
+
+            const int64_t now_nsec = GetNsec();
+            while (!due_sends_.empty() && due_sends_.top().first <= now_nsec) {
+                const DueSend due = due_sends_.top();
+                due_sends_.pop();
+
+                SendRequest(connections_[due.second], now_nsec);
+
+                // Fixed schedule, so a slow response does not lower the offered load
+                due_sends_.emplace(due.first + interval_nsec_, due.second);
+            }
+        }
+    }
+
+    void SendRequest(LoadConnection& entry, int64_t now_nsec) {
+        if (entry.InFlightStream >= 0) {
+            if (counters_.Measuring) {
+                counters_.Skipped++;
+            }
+            return;
+        }
+
+        const int64_t id = entry.Connection->SendRequest(
+            request_headers_.data(), request_headers_.size());
+        if (id < 0) {
+            if (counters_.Measuring) {
+                counters_.Errors++;
+            }
+            return;
+        }
+        entry.InFlightStream = id;
+        entry.SubmitNsec = now_nsec;
+    }
+
+    void OnResponse(LoadConnection& entry, const QuicheMailbox::Event& event) {
+        if (event.Stream->Id != static_cast<uint64_t>(entry.InFlightStream)) {
+            return;
+        }
+        entry.InFlightStream = -1;
+
+        if (!counters_.Measuring) {
+            return;
+        }
+        if (event.Stream->Status != "200") {
+            counters_.Errors++;
+            return;
+        }
+        counters_.Requests++;
+        counters_.Latency.Record((GetNsec() - entry.SubmitNsec) / 1000);
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Steps
+
+struct StepResult {
+    int64_t Connections = 0;
+    int64_t Connected = 0;
+    int64_t Failed = 0;
+
+    double HandshakeSec = 0.0;
+    LatencyStats Handshake;
+
+    // Change across the handshakes.  Negative if the process could not be read
+    double ServerHandshakeCpuSec = -1.0;
+    int64_t ServerRssDelta = -1;
+    int64_t ClientRssDelta = -1;
+
+    double Seconds = 0.0;
+    double ServerCpuSec = -1.0;
+    uint64_t Requests = 0;
+    uint64_t Errors = 0;
+    uint64_t Skipped = 0;
+    LatencyStats Latency;
+};
+
+static StepResult run_step(
+    const LoadOptions& options,
+    const std::vector<uint8_t>& cert_der,
+    const boost::asio::ip::udp::endpoint& server_endpoint,
+    pid_t server_pid,
+    int64_t connection_count)
+{
+    StepResult result;
+    result.Connections = connection_count;
+
+    LoadCounters counters;
+    const pid_t self_pid = getpid();
+
+    const double server_cpu0 = server_pid > 0 ? process_cpu_sec(server_pid) : -1.0;
+    const int64_t server_rss0 = server_pid > 0 ? process_rss_bytes(server_pid) : -1;
+    const int64_t client_rss0 = process_rss_bytes(self_pid);
+    const int64_t open_nsec = GetNsec();
+
+    std::vector<std::unique_ptr<LoadGroup>> groups;
+    for (int i = 0; i < options.Threads; ++i) {
+        // Spread the remainder over the first groups
+        const int64_t count = connection_count / options.Threads +
+            (i < connection_count % options.Threads ? 1 : 0);
+        groups.push_back(std::make_unique<LoadGroup>(
+            options, counters, cert_der, server_endpoint, count));
+    }
+
+    const int64_t deadline_nsec = open_nsec + static_cast<int64_t>(options.ConnectTimeoutSec * 1e9);
+    while (counters.Connected + counters.Failed < connection_count && GetNsec() < deadline_nsec) {
+        sleep_sec(0.01);
+    }
+
+    result.Connected = counters.Connected;
+    result.Failed = connection_count - result.Connected;
+    if (result.Connected > 0) {
+        result.HandshakeSec = (counters.LastConnectNsec - open_nsec) * 1e-9;
+    }
+    counters.Handshake.GetStats(result.Handshake);
+
+    if (server_cpu0 >= 0.0) {
+        const double server_cpu1 = process_cpu_sec(server_pid);
+        if (server_cpu1 >= 0.0) {
+            result.ServerHandshakeCpuSec = server_cpu1 - server_cpu0;
+        }
+    }
+    if (server_rss0 >= 0) {
+        const int64_t server_rss1 = process_rss_bytes(server_pid);
+        if (server_rss1 >= 0) {
+            result.ServerRssDelta = server_rss1 - server_rss0;
+        }
+    }
+    if (client_rss0 >= 0) {
+        const int64_t client_rss1 = process_rss_bytes(self_pid);
+        if (client_rss1 >= 0) {
+            result.ClientRssDelta = client_rss1 - client_rss0;
+        }
+    }
+
+    if (result.Connected > 0) {
+        sleep_sec(options.WarmupSec);
+
+        const double cpu0 = server_pid > 0 ? process_cpu_sec(server_pid) : -1.0;
+        const int64_t t0 = GetNsec();
+        counters.Measuring = true;
+
+        sleep_sec(options.DurationSec);
+
+        counters.Measuring = false;
+        const int64_t t1 = GetNsec();
+        const double cpu1 = server_pid > 0 ? process_cpu_sec(server_pid) : -1.0;
+        if (cpu0 >= 0.0 && cpu1 >= 0.0) {
+            result.ServerCpuSec = cpu1 - cpu0;
+        }
+        result.Seconds = (t1 - t0) * 1e-9;
+    }
+
+    counters.Stopping = true;
+    for (auto& group : groups) {
+        group->CloseAll();
+    }
+    // Gives the close frames time to go out before the sockets are destroyed
+    sleep_sec(0.2);
+    groups.clear();
+
+    result.Requests = counters.Requests;
+    result.Errors = counters.Errors;
+    result.Skipped = counters.Skipped;
+    counters.Latency.GetStats(result.Latency);
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+// Output
+
+// Prints value / divisor, or null if the value was not measured
+static void write_ratio(FILE* out, const char* name, double value, double divisor)
+{
+    if (value < 0.0 || divisor <= 0.0) {
+        std::fprintf(out, "\"%s\": null", name);
+    } else {
+        std::fprintf(out, "\"%s\": %.3f", name, value / divisor);
+    }
+}
+
+static void write_latency(FILE* out, const char* name, const LatencyStats& stats)
+{
+    std::fprintf(out,
+        "\"%s\": {\"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+        name,
+        static_cast<unsigned long long>(stats.MeanUsec),
+        static_cast<unsigned long long>(stats.P50Usec),
+        static_cast<unsigned long long>(stats.P90Usec),
+        static_cast<unsigned long long>(stats.P99Usec),
+        static_cast<unsigned long long>(stats.P999Usec),
+        static_cast<unsigned long long>(stats.MaxUsec));
+}
+
+static void write_result(FILE* out, const LoadOptions& options, const StepResult& result, bool last)
+{
+    const double connected = static_cast<double>(result.Connected);
+    const double seconds = result.Seconds;
+
+    std::fprintf(out,
+        "  {\"connections\": %lld, \"connected\": %lld, \"failed\": %lld, "
+        "\"rate_per_connection\": %.3f, \"body_bytes\": %lld, ",
+        static_cast<long long>(result.Connections),
+        static_cast<long long>(result.Connected),
+        static_cast<long long>(result.Failed),
+        options.Rate,
+        static_cast<long long>(options.BodyBytes));
+
+    std::fprintf(out, "\"handshake_sec\": %.3f, ", result.HandshakeSec);
+    write_ratio(out, "handshakes_per_sec", connected, result.HandshakeSec);
+    std::fprintf(out, ", ");
+    write_latency(out, "handshake_usec", result.Handshake);
+    std::fprintf(out, ", ");
+    write_ratio(out, "server_cpu_ms_per_handshake", result.ServerHandshakeCpuSec * 1e3, connected);
+    std::fprintf(out, ", ");
+    write_ratio(out, "server_bytes_per_connection", static_cast<double>(result.ServerRssDelta), connected);
+    std::fprintf(out, ", ");
+    write_ratio(out, "client_bytes_per_connection", static_cast<double>(result.ClientRssDelta), connected);
+
+    std::fprintf(out,
+        ", \"seconds\": %.3f, \"requests\": %llu, \"errors\": %llu, \"skipped\": %llu, ",
+        seconds,
+        static_cast<unsigned long long>(result.Requests),
+        static_cast<unsigned long long>(result.Errors),
+        static_cast<unsigned long long>(result.Skipped));
+    write_ratio(out, "requests_per_sec", static_cast<double>(result.Requests), seconds);
+    std::fprintf(out, ", ");
+    write_ratio(out, "server_cpu_util", result.ServerCpuSec, seconds);
+    std::fprintf(out, ", ");
+    write_latency(out, "latency_usec", result.Latency);
+    std::fprintf(out, "}%s\n", last ? "" : ",");
+    std::fflush(out);
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main(int argc, char** argv)
+{
+    LoadOptions options;
+    if (!parse_options(argc, argv, options)) {
+        return 1;
+    }
+
+    // Fork before any thread exists, including the logger's
+    pid_t server_pid = options.ServerPid;
+    int control_fd = -1;
+    if (options.Host.empty()) {
+        int ready_pipe[2], control_pipe[2];
+        if (pipe(ready_pipe) != 0 || pipe(control_pipe) != 0) {
+            std::perror("pipe");
+            return 1;
+        }
+
+        server_pid = fork();
+        if (server_pid < 0) {
+            std::perror("fork");
+            return 1;
+        }
+        if (server_pid == 0) {
+            close(ready_pipe[0]);
+            close(control_pipe[1]);
+            _exit(run_server_process(options, ready_pipe[1], control_pipe[0]));
+        }
+
+        close(ready_pipe[1]);
+        close(control_pipe[0]);
+        control_fd = control_pipe[1];
+
+        char ready = 0;
+        const bool started = read(ready_pipe[0], &ready, 1) == 1;
+        close(ready_pipe[0]);
+        if (!started) {
+            std::fprintf(stderr, "Server process failed to start\n");
+            close(control_fd);
+            waitpid(server_pid, nullptr, 0);
+            return 1;
+        }
+    }
+
+    // Keep stdout for the JSON results
+    Logger& logger = Logger::getInstance();
+    logger.SetLogLevel(options.Verbose ? Logger::INFO : Logger::WARN);
+    logger.SetCallback([](Logger::LogLevel, const std::string& message) {
+        std::cerr << message << std::endl;
+    });
+
+    const std::vector<uint8_t> cert_der = LoadPEMCertAsDER(options.CertPath);
+
+    boost::system::error_code ec;
+    const auto address = boost::asio::ip::make_address(
+        options.Host.empty() ? "127.0.0.1" : options.Host, ec);
+    if (ec) {
+        std::fprintf(stderr, "Invalid host: %s\n", options.Host.c_str());
+        return 1;
+    }
+    const boost::asio::ip::udp::endpoint server_endpoint(address, options.Port);
+
+    FILE* out = stdout;
+    if (!options.OutputPath.empty()) {
+        out = std::fopen(options.OutputPath.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "Failed to open %s\n", options.OutputPath.c_str());
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    std::fprintf(out, "[\n");
+    for (size_t i = 0; i < options.Connections.size(); ++i) {
+        if (i > 0) {
+            sleep_sec(options.SettleSec);
+        }
+
+        StepResult result = run_step(options, cert_der, server_endpoint, server_pid, options.Connections[i]);
+        if (result.Failed > 0) {
+            ++failures;
+        }
+        write_result(out, options, result, i + 1 == options.Connections.size());
+    }
+    std::fprintf(out, "]\n");
+
+    if (out != stdout) {
+        std::fclose(out);
+    }
+
+    if (control_fd >= 0) {
+        close(control_fd);
+        waitpid(server_pid, nullptr, 0);
+    }
+    return failures > 0 ? 1 : 0;
+}
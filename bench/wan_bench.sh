@@ -0,0 +1,198 @@
+#!/bin/bash
+# Runs quicsend_bench across an emulated WAN link on this machine.
+#
+# Two network namespaces are joined by a veth pair.  tc netem on each end
+# adds half the RTT, loss and a rate limit, so the link looks like
+# PROFILES below.  The server and client run in separate namespaces, and
+# each result is printed with the link's bandwidth-delay product and the
+# share of the link rate that was achieved.
+#
+# Requires root, iproute2 and python3.  No external network is used.
+#
+# Usage: sudo bench/wan_bench.sh --cert=server.pem --key=server.key
+#
+# Environment:
+#   BENCH=./build/quicsend_bench   Benchmark binary
+#   PROFILES="metro:20:0:1000 ..."  name:rtt_ms:loss_pct:rate_mbit list
+#   BODY=1M,64M CONCURRENCY=1,8 CONNECTIONS=1,4 DURATION=10 WARMUP=3
+#   OUTPUT=FILE                     Write JSON to FILE instead of stdout
+
+set -euo pipefail
+
+BENCH=${BENCH:-./build/quicsend_bench}
+PROFILES=${PROFILES:-"metro:20:0:1000 continental:60:0.01:1000 transatlantic:100:0.05:500 intercontinental:150:0.1:200"}
+BODY=${BODY:-1M,64M}
+CONCURRENCY=${CONCURRENCY:-1,8}
+CONNECTIONS=${CONNECTIONS:-1,4}
+DURATION=${DURATION:-10}
+WARMUP=${WARMUP:-3}
+OUTPUT=${OUTPUT:-}
+PORT=4433
+
+CERT=""
+KEY=""
+for arg in "$@"; do
+    case "$arg" in
+        --cert=*) CERT="${arg#*=}" ;;
+        --key=*) KEY="${arg#*=}" ;;
+        *) echo "Unknown argument: $arg" >&2; exit 1 ;;
+    esac
+done
+if [[ -z "$CERT" || -z "$KEY" ]]; then
+    sed -n '2,19p' "$0" | sed 's/^# \{0,1\}//' >&2
+    exit 1
+fi
+if [[ $EUID -ne 0 ]]; then
+    echo "Must run as root to create network namespaces" >&2
+    exit 1
+fi
+if [[ ! -x "$BENCH" ]]; then
+    echo "Benchmark binary not found: $BENCH (set BENCH=...)" >&2
+    exit 1
+fi
+
+SERVER_NS=qs-wan-server
+CLIENT_NS=qs-wan-client
+SERVER_DEV=qs-veth-s
+CLIENT_DEV=qs-veth-c
+SERVER_ADDR=10.77.0.1
+CLIENT_ADDR=10.77.0.2
+
+RESULTS_DIR=$(mktemp -d)
+SERVER_PID=""
+
+delete_namespaces() {
+    ip netns del "$SERVER_NS" 2>/dev/null || true
+    ip netns del "$CLIENT_NS" 2>/dev/null || true
+}
+
+cleanup() {
+    if [[ -n "$SERVER_PID" ]]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    delete_namespaces
+    rm -rf "$RESULTS_DIR"
+}
+trap cleanup EXIT
+
+#------------------------------------------------------------------------------
+# Topology
+
+# Left over from an interrupted run
+delete_namespaces
+
+ip netns add "$SERVER_NS"
+ip netns add "$CLIENT_NS"
+ip link add "$SERVER_DEV" type veth peer name "$CLIENT_DEV"
+ip link set "$SERVER_DEV" netns "$SERVER_NS"
+ip link set "$CLIENT_DEV" netns "$CLIENT_NS"
+
+ip -n "$SERVER_NS" addr add "$SERVER_ADDR/24" dev "$SERVER_DEV"
+ip -n "$CLIENT_NS" addr add "$CLIENT_ADDR/24" dev "$CLIENT_DEV"
+for ns in "$SERVER_NS" "$CLIENT_NS"; do
+    ip -n "$ns" link set lo up
+done
+ip -n "$SERVER_NS" link set "$SERVER_DEV" up
+ip -n "$CLIENT_NS" link set "$CLIENT_DEV" up
+
+# Large socket buffers so the kernel is not the bottleneck at high BDP
+for ns in "$SERVER_NS" "$CLIENT_NS"; do
+    ip netns exec "$ns" sysctl -q -w net.core.rmem_max=67108864 net.core.wmem_max=67108864
+done
+
+# Applies one direction of a profile to the egress of a device
+set_netem() {
+    local ns=$1 dev=$2 delay_ms=$3 loss_pct=$4 rate_mbit=$5 limit=$6
+    ip netns exec "$ns" tc qdisc replace dev "$dev" root netem \
+        delay "${delay_ms}ms" loss "${loss_pct}%" rate "${rate_mbit}mbit" limit "$limit"
+}
+
+#------------------------------------------------------------------------------
+# Server
+
+# The server answers up to the largest body in the sweep
+ip netns exec "$SERVER_NS" "$BENCH" --role=server --port="$PORT" \
+    --cert="$CERT" --key="$KEY" --body="$BODY" &
+SERVER_PID=$!
+sleep 1
+if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+    echo "Server failed to start" >&2
+    exit 1
+fi
+
+#------------------------------------------------------------------------------
+# Profiles
+
+index=0
+for profile in $PROFILES; do
+    IFS=: read -r name rtt_ms loss_pct rate_mbit <<< "$profile"
+
+    # Half the RTT each way.  The netem queue holds two BDPs of full-size
+    # packets so the emulated link adds no drops beyond the loss setting
+    delay_ms=$(python3 -c "print($rtt_ms / 2)")
+    limit=$(python3 -c "print(max(1000, int(2 * $rate_mbit * 1e6 / 8 * $rtt_ms / 1e3 / 1350)))")
+    set_netem "$SERVER_NS" "$SERVER_DEV" "$delay_ms" "$loss_pct" "$rate_mbit" "$limit"
+    set_netem "$CLIENT_NS" "$CLIENT_DEV" "$delay_ms" "$loss_pct" "$rate_mbit" "$limit"
+
+    echo "Profile $name: RTT ${rtt_ms} ms, loss ${loss_pct}%, ${rate_mbit} Mbit/s" >&2
+
+    status=0
+    ip netns exec "$CLIENT_NS" "$BENCH" --role=client --host="$SERVER_ADDR" --port="$PORT" \
+        --cert="$CERT" --body="$BODY" --concurrency="$CONCURRENCY" --connections="$CONNECTIONS" \
+        --duration="$DURATION" --warmup="$WARMUP" \
+        --output="$RESULTS_DIR/$index.json" || status=$?
+    if [[ $status -ne 0 ]]; then
+        echo "Profile $name: some configurations did not connect" >&2
+    fi
+
+    echo "$name $rtt_ms $loss_pct $rate_mbit" > "$RESULTS_DIR/$index.profile"
+    index=$((index + 1))
+done
+
+#------------------------------------------------------------------------------
+# Report
+
+python3 - "$RESULTS_DIR" "$index" <<'EOF' > "${OUTPUT:-/dev/stdout}"
+import json
+import sys
+
+results_dir, count = sys.argv[1], int(sys.argv[2])
+
+report = []
+for i in range(count):
+    with open(f"{results_dir}/{i}.profile") as f:
+        name, rtt_ms, loss_pct, rate_mbit = f.read().split()
+    rtt_ms, loss_pct, rate_mbit = float(rtt_ms), float(loss_pct), float(rate_mbit)
+
+    # Bytes in flight needed to fill the link
+    bdp_bytes = int(rate_mbit * 1e6 / 8 * rtt_ms / 1e3)
+
+    try:
+        with open(f"{results_dir}/{i}.json") as f:
+            results = json.load(f)
+    except (OSError, ValueError):
+        results = []
+
+    for result in results:
+        goodput_mbit = result["gbps"] * 1000.0
+        result.update({
+            "profile": name,
+            "rtt_ms": rtt_ms,
+            "loss_pct": loss_pct,
+            "rate_mbit": rate_mbit,
+            "bdp_bytes": bdp_bytes,
+            "goodput_mbit": round(goodput_mbit, 1),
+            "link_utilization": round(goodput_mbit / rate_mbit, 3),
+        })
+        report.append(result)
+
+json.dump(report, sys.stdout, indent=2)
+print()
+
+# Summary on stderr so stdout stays JSON
+print(f"{'profile':<18}{'body':>10}{'conc':>6}{'conns':>6}{'BDP':>12}{'goodput':>12}{'util':>7}", file=sys.stderr)
+for r in report:
+    print(f"{r['profile']:<18}{r['body_bytes']:>10}{r['concurrency']:>6}{r['connections']:>6}"
+          f"{r['bdp_bytes']:>12}{r['goodput_mbit']:>9.1f} Mb{r['link_utilization']:>7.1%}", file=sys.stderr)
+EOF
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <boost/intrusive_ptr.hpp>
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+#define MAX_DATAGRAM_SEND_SIZE 1350
+
+// Packet buffers are carved out of slabs this size, which matches a huge page
+#define SEND_BUFFER_SLAB_BYTES (2 * 1024 * 1024)
+
+// Free buffers each thread keeps before returning a batch to the shared depot
+#define SEND_BUFFER_THREAD_CACHE 256
+#define SEND_BUFFER_TRANSFER_BATCH 64
+
+// Default ceiling on pooled packet buffers (about 90 MB)
+#define SEND_BUFFER_DEFAULT_LIMIT 65536
+
+// Body buffers smaller than this come from malloc instead of the pool
+#define BODY_POOL_MIN_BYTES (64 * 1024)
+
+// Power-of-two size classes from BODY_POOL_MIN_BYTES up to 1 GiB.
+// Larger buffers are mapped directly and unmapped when released
+#define BODY_POOL_CLASS_COUNT 15
+
+// Default ceiling on idle memory the body pool keeps for reuse
+#define BODY_POOL_DEFAULT_CACHED_BYTES (1024ull * 1024 * 1024)
+
+// Idle objects each ObjectPool keeps for reuse
+#define OBJECT_POOL_MAX_FREE 4096
+
+
+//------------------------------------------------------------------------------
+// Large Regions
+
+// Allocates a zeroed region from the OS, backed by huge pages when possible:
+// MAP_HUGETLB first, then a regular mapping advised for transparent huge pages.
+// Returns nullptr on failure.  huge_pages is set if MAP_HUGETLB succeeded.
+void* AllocateLargeRegion(size_t bytes, bool* huge_pages = nullptr);
+void FreeLargeRegion(void* region, size_t bytes, bool huge_pages);
+
+
+//------------------------------------------------------------------------------
+// SendBuffer
+
+struct SendBuffer {
+    uint8_t Payload[MAX_DATAGRAM_SEND_SIZE];
+    int Length = 0;
+
+    // Intrusive reference count managed by SendBufferPtr
+    std::atomic<uint32_t> RefCount = ATOMIC_VAR_INIT(0);
+
+    // False if allocated from the heap because the pool was at its ceiling
+    bool Pooled = true;
+
+    // Free list link while the buffer is not in use
+    SendBuffer* NextFree = nullptr;
+};
+
+void intrusive_ptr_add_ref(SendBuffer* buffer);
+void intrusive_ptr_release(SendBuffer* buffer);
+
+using SendBufferPtr = boost::intrusive_ptr<SendBuffer>;
+
+
+//------------------------------------------------------------------------------
+// SendAllocator
+
+struct SendAllocatorStats {
+    // Allocations served from a free list
+    uint64_t Hits = 0;
+
+    // Allocations that had to carve a new slab or fall back to the heap
+    uint64_t Misses = 0;
+
+    // Heap allocations made because the pool was at its ceiling
+    uint64_t Overflows = 0;
+
+    // Buffers currently handed out
+    uint64_t Outstanding = 0;
+
+    // Peak of Outstanding since the process started
+    uint64_t HighWater = 0;
+
+    // Buffers carved from slabs so far, and the ceiling on that number
+    uint64_t Pooled = 0;
+    uint64_t Limit = 0;
+
+    uint64_t Slabs = 0;
+    uint64_t HugePageSlabs = 0;
+};
+
+// Hands out packet buffers from a process-wide slab pool.
+// Each thread keeps a lock-free cache of free buffers, so Allocate() and the
+// release from the asio send completion normally touch no shared state.
+// Threads exchange buffers with a shared depot in batches.
+class SendAllocator {
+public:
+    SendBufferPtr Allocate();
+
+    // Ceiling on buffers carved from slabs.  Past it, buffers come from the
+    // heap and are freed when released instead of being pooled
+    static void SetLimit(uint64_t max_buffers);
+
+    static SendAllocatorStats GetStats();
+};
+
+
+//------------------------------------------------------------------------------
+// PooledBuffer
+
+struct BodyPoolStats {
+    // Acquisitions served from a recycled region
+    uint64_t Hits = 0;
+
+    // Acquisitions that had to map a new region
+    uint64_t Misses = 0;
+
+    // Idle bytes held for reuse, and the ceiling on that number
+    uint64_t CachedBytes = 0;
+    uint64_t CachedLimit = 0;
+
+    uint64_t HugePageRegions = 0;
+};
+
+// Growable byte buffer for request and response bodies.
+// Storage of BODY_POOL_MIN_BYTES or more comes from a process-wide pool of
+// power-of-two regions that are recycled across requests, so steady-state
+// transfers reuse memory that is already faulted in and huge-page backed.
+// Move-only; the storage returns to the pool on destruction or Release().
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    ~PooledBuffer() {
+        Release();
+    }
+
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    // Keeps the storage for reuse by the same owner
+    void clear() { size_ = 0; }
+
+    void reserve(size_t bytes);
+    void append(const void* data, size_t bytes);
+
+    // Returns the storage to the pool
+    void Release();
+
+    static void SetPoolLimit(uint64_t max_cached_bytes);
+    static BodyPoolStats GetPoolStats();
+
+protected:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+
+    enum class Storage : uint8_t {
+        None,
+        Heap,
+        Pooled,
+        Mapped,
+    };
+    Storage storage_ = Storage::None;
+    bool huge_pages_ = false;
+};
+
+
+//------------------------------------------------------------------------------
+// ObjectPool
+
+// Recycles objects of one type through a process-wide free list, so they are
+// not constructed and freed for each use.  T must provide Reset(), which is
+// called when the object is recycled and should keep reusable capacity.
+template<class T>
+class ObjectPool {
+public:
+    static T* Acquire() {
+        ObjectPool& pool = Instance();
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex_);
+            if (!pool.free_.empty()) {
+                T* object = pool.free_.back();
+                pool.free_.pop_back();
+                return object;
+            }
+        }
+        return new T;
+    }
+
+    static void Recycle(T* object) {
+        object->Reset();
+
+        ObjectPool& pool = Instance();
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex_);
+            if (pool.free_.size() < OBJECT_POOL_MAX_FREE) {
+                pool.free_.push_back(object);
+                return;
+            }
+        }
+        delete object;
+    }
+
+protected:
+    std::mutex mutex_;
+    std::vector<T*> free_;
+
+    static ObjectPool& Instance() {
+        // Leaked so that objects released during static destruction are safe
+        static ObjectPool* pool = new ObjectPool;
+        return *pool;
+    }
+};
@@ -12,10 +12,21 @@ struct QuicSendClientSettings {
     std::string Host;
     uint16_t Port;
     std::string CertPath;
+
+    MailboxWaitPolicy WaitPolicy;
+
+    // Optional qlog tracing of the connection
+    QlogSettings Qlog;
+
+    // Recent events of the connection, dumped when it times out
+    FlightRecorderSettings FlightRecorder;
 };
 
 class QuicSendClient {
 public:
+    // Handler for QuicheRoleConnection and QuicheSocket
+    static constexpr bool IsServer = false;
+
     QuicSendClient(const QuicSendClientSettings& settings);
     ~QuicSendClient();
 
@@ -25,14 +36,53 @@ public:
 
     void Close();
 
+    // The priority is sent to the server in the priority header and also
+    // orders the request body against other requests on this connection
     int64_t Request(
         const std::string& path,
         const std::string& header_info,
-        BodyData body);
+        BodyData body,
+        const StreamPriority& priority = StreamPriority());
+
+    // Moves a request that is still in flight to a new priority, on this
+    // connection and at the server.  Returns false if the request is done
+    bool UpdatePriority(int64_t request_id, const StreamPriority& priority) {
+        if (closed_ || request_id < 0) {
+            return false;
+        }
+        return connection_->UpdateRequestPriority(static_cast<uint64_t>(request_id), priority);
+    }
+
+    MailboxMetrics GetMailboxMetrics() const {
+        return mailbox_.GetMetrics();
+    }
+
+    // Stats for the connection to the server
+    void GetStats(ConnectionStats& stats) {
+        connection_->GetStats(stats);
+    }
+
+    // Time to first and last response byte of all requests
+    void GetLatency(RequestLatencyStats& stats) const {
+        connection_->GetLatency(stats);
+    }
+
+    // Same, by request path
+    std::vector<PathLatencyStats> GetPathLatency() const {
+        return latency_->GetStats();
+    }
+
+    // Connection state and the most recent events, one per line
+    std::string GetFlightRecorder() {
+        return connection_->FormatFlightRecorder("requested");
+    }
 
     QuicheMailbox mailbox_;
 
 private:
+    template<class> friend class QuicheRoleConnection;
+    friend class QuicheSocket;
+
     QuicSendClientSettings settings_;
 
     boost::asio::io_context io_context_;
@@ -41,10 +91,33 @@ private:
     boost::asio::ip::udp::resolver resolver_;
     boost::asio::ip::udp::endpoint resolved_endpoint_;
 
+    // Request headers built once for the connection and patched per request.
+    // The body headers come last so requests without a body can drop them
+    HeaderTemplate request_headers_;
+    int method_header_ = 0;
+    int path_header_ = 0;
+    int info_header_ = 0;
+    int content_type_header_ = 0;
+    int content_length_header_ = 0;
+
     std::shared_ptr<QuicheSocket> qs_;
     std::shared_ptr<QuicheConnection> connection_;
     std::shared_ptr<QuicheSender> sender_;
+    std::shared_ptr<QlogTracer> qlog_;
+    std::shared_ptr<PathLatencyTracker> latency_;
 
     std::shared_ptr<std::thread> loop_thread_;
     std::atomic<bool> closed_ = ATOMIC_VAR_INIT(false);
+
+    void OnDatagram(
+        uint8_t* data,
+        std::size_t bytes,
+        const boost::asio::ip::udp::endpoint& peer_endpoint);
+    void OnConnect(
+        QuicheConnection& connection,
+        const boost::asio::ip::udp::endpoint& peer_endpoint);
+    void OnTimeout(QuicheConnection& connection);
+    void OnData(
+        QuicheConnection& connection,
+        const QuicheMailbox::Event& event);
 };
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+// Events kept per connection by default.  Each takes 32 bytes
+#define FLIGHT_RECORDER_DEFAULT_EVENTS 512
+
+// Events written to the log when there is no dump directory
+#define FLIGHT_RECORDER_LOG_EVENTS 256
+
+
+//------------------------------------------------------------------------------
+// FlightRecorderSettings
+
+struct FlightRecorderSettings {
+    // Events kept per connection, rounded up to a power of two.  0 disables
+    uint32_t Events = FLIGHT_RECORDER_DEFAULT_EVENTS;
+
+    // Directory for dumps, written as flight_<assigned id>_<usec>.txt.
+    // Empty writes the most recent events to the log instead
+    std::string DumpDirectory;
+
+    // Dump when a connection times out with requests or responses still in
+    // flight.  Idle connections time out quietly
+    bool DumpOnTimeout = true;
+
+    // Dump every connection when the process receives SIGUSR2.
+    // Installs a process-wide signal handler
+    bool DumpOnSignal = false;
+};
+
+
+//------------------------------------------------------------------------------
+// FlightRecorder
+
+enum class FlightEvent : uint8_t {
+    PacketRecv,         // bytes
+    PacketSend,         // bytes, pacing delay usec
+    RecvError,          // quiche error
+    Established,
+    ConnectRetry,
+    TimerFired,
+    StreamHeaders,      // stream id
+    StreamData,         // stream id, body bytes so far
+    StreamFinished,     // stream id, body bytes
+    StreamReset,        // stream id
+    RequestSent,        // stream id, body bytes
+    RequestBlocked,     // quiche error
+    BodyBlocked,        // stream id, bytes queued
+    ResponseSent,       // stream id, body bytes
+    ResponseCached,     // stream id, body bytes
+    CachedResponseSent, // stream id
+    GoAway,
+    Closed,             // timed out, error code
+
+    Count
+};
+
+const char* FlightEventName(FlightEvent type);
+
+struct FlightRecord {
+    int64_t Nsec = 0; // GetNsec() when recorded
+    FlightEvent Type = FlightEvent::Count;
+    uint64_t Arg0 = 0;
+    uint64_t Arg1 = 0;
+};
+
+// Fixed-size ring of the most recent events of one connection.
+// Record() is lock-free and wait-free, and may be called from any thread.
+// Snapshot() reads without stopping writers and skips slots that are being
+// overwritten while it reads them.
+class FlightRecorder {
+public:
+    // Allocates the ring.  0 leaves the recorder disabled
+    void Initialize(uint32_t events);
+
+    // No-op if disabled
+    void Record(FlightEvent type, uint64_t arg0 = 0, uint64_t arg1 = 0);
+
+    // Events oldest first
+    void Snapshot(std::vector<FlightRecord>& records) const;
+
+    // One line per event with times relative to now_nsec.
+    // max_events > 0 keeps only the most recent events
+    std::string Format(int64_t now_nsec, size_t max_events = 0) const;
+
+    // Number of SIGUSR2 signals received since InstallSignalHandler()
+    static uint32_t SignalCount();
+    static void InstallSignalHandler();
+
+    // Writes text to path, or to the log one line at a time if path is empty.
+    // The write happens on a background thread, so callers may hold a
+    // connection lock or the sender mutex
+    static void QueueDump(std::string path, std::string text);
+
+protected:
+    // Sequence is 2 * index + 1 while the slot is written and 2 * index + 2
+    // once it is complete.  Stamp holds the event type in the top 8 bits
+    // and the timestamp in the rest
+    struct Slot {
+        std::atomic<uint64_t> Sequence;
+        std::atomic<uint64_t> Stamp;
+        std::atomic<uint64_t> Arg0;
+        std::atomic<uint64_t> Arg1;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    uint64_t mask_ = 0;
+    std::atomic<uint64_t> next_ = ATOMIC_VAR_INIT(0);
+};
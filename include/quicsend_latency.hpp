@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+// Values below this are recorded exactly, in microseconds.  Above it each
+// power of two is split into LATENCY_HISTOGRAM_LINEAR / 2 buckets, so
+// percentiles are within about 3% of the recorded value
+#define LATENCY_HISTOGRAM_LINEAR 64
+
+// Largest value recorded (about 3 days in microseconds).  Larger values
+// are clamped
+#define LATENCY_HISTOGRAM_MAX_BITS 38
+
+// Distinct request paths tracked per client or server.  Requests for
+// further paths are folded into LATENCY_OTHER_PATH
+#define LATENCY_MAX_PATHS 256
+#define LATENCY_OTHER_PATH "*"
+
+
+//------------------------------------------------------------------------------
+// LatencyHistogram
+
+struct LatencyStats {
+    uint64_t Count = 0;
+    uint64_t MeanUsec = 0;
+    uint64_t P50Usec = 0;
+    uint64_t P90Usec = 0;
+    uint64_t P99Usec = 0;
+    uint64_t P999Usec = 0;
+    uint64_t MaxUsec = 0;
+};
+
+// HDR-style log-linear histogram of microsecond latencies.
+// Record() is lock-free and may be called from any thread.  GetStats() reads
+// the buckets without stopping writers, so concurrent samples may be missed.
+class LatencyHistogram {
+public:
+    void Record(int64_t usec);
+
+    void GetStats(LatencyStats& stats) const;
+
+protected:
+    static constexpr int kHalf = LATENCY_HISTOGRAM_LINEAR / 2;
+
+    // One row of kHalf buckets for each power of two above the linear range,
+    // which ends at 2^6
+    static constexpr int kBucketCount = LATENCY_HISTOGRAM_LINEAR +
+        (LATENCY_HISTOGRAM_MAX_BITS - 6) * kHalf;
+    static_assert(LATENCY_HISTOGRAM_LINEAR == 64, "kBucketCount assumes 2^6 linear buckets");
+
+    std::atomic<uint64_t> buckets_[kBucketCount] = {};
+    std::atomic<uint64_t> count_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> sum_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> max_ = ATOMIC_VAR_INIT(0);
+
+    static int BucketIndex(uint64_t usec);
+
+    // Largest value that lands in the bucket
+    static uint64_t BucketValue(int index);
+};
+
+
+//------------------------------------------------------------------------------
+// RequestLatency
+
+struct RequestLatencyStats {
+    // Client: Request submitted until response headers arrive.
+    // Server: Request headers arrive until response headers are sent
+    LatencyStats FirstByte;
+
+    // Client: Request submitted until the response is complete.
+    // Server: Request headers arrive until the last response byte is written
+    LatencyStats LastByte;
+};
+
+struct RequestLatency {
+    LatencyHistogram FirstByte;
+    LatencyHistogram LastByte;
+
+    void GetStats(RequestLatencyStats& stats) const {
+        FirstByte.GetStats(stats.FirstByte);
+        LastByte.GetStats(stats.LastByte);
+    }
+};
+
+struct PathLatencyStats {
+    std::string Path;
+    RequestLatencyStats Latency;
+};
+
+// Request latency histograms by path, shared by all connections of a client
+// or server.  Histograms are never removed, so pointers from ForPath() stay
+// valid for the life of the tracker.
+class PathLatencyTracker {
+public:
+    RequestLatency* ForPath(std::string_view path);
+
+    std::vector<PathLatencyStats> GetStats();
+
+protected:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<RequestLatency>> paths_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+
+//------------------------------------------------------------------------------
+// Metric Ids
+
+// Keep in sync with the table in quicsend_metrics.cpp
+enum class Metric : int {
+    // Counters
+    PacketsIn,
+    PacketsOut,
+    BytesIn,
+    BytesOut,
+    SendErrors,
+    RecvErrors,
+    InvalidPackets,
+    RetriesSent,
+    VersionNegotiations,
+    ConnectionsOpened,
+    ConnectionsClosed,
+    RequestsSent,
+    ResponsesSent,
+
+    // Gauges
+    ConnectionsActive,
+    IncomingStreams,
+    OutgoingStreamsQueued,
+    CachedResponses,
+    MailboxDepth,
+
+    Count
+};
+
+
+//------------------------------------------------------------------------------
+// Metrics
+
+// One cache line per metric so threads updating different metrics do not
+// contend
+struct alignas(64) MetricSlot {
+    std::atomic<int64_t> Value = ATOMIC_VAR_INIT(0);
+};
+
+// Process-wide counters and gauges.  Updates are relaxed atomic adds, so
+// they are cheap enough for per-packet paths.
+// Allocator stats are read from SendAllocator and PooledBuffer at export.
+class Metrics {
+public:
+    static inline void Add(Metric metric, int64_t value = 1) {
+        slots_[static_cast<int>(metric)].Value.fetch_add(value, std::memory_order_relaxed);
+    }
+    static inline void Sub(Metric metric, int64_t value = 1) {
+        slots_[static_cast<int>(metric)].Value.fetch_sub(value, std::memory_order_relaxed);
+    }
+    static inline int64_t Get(Metric metric) {
+        return slots_[static_cast<int>(metric)].Value.load(std::memory_order_relaxed);
+    }
+
+    // Prometheus text exposition format, version 0.0.4
+    static std::string ExportPrometheus();
+
+    // Serves ExportPrometheus() over HTTP on 127.0.0.1:port from a background
+    // thread.  Returns false if the port could not be bound
+    static bool StartHttpServer(uint16_t port);
+    static void StopHttpServer();
+
+protected:
+    static inline MetricSlot slots_[static_cast<int>(Metric::Count)];
+};
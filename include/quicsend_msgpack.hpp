@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+// Nesting limit for decoded containers, to bound recursion when building objects
+#define MSGPACK_MAX_DEPTH 512
+
+
+//------------------------------------------------------------------------------
+// MsgpackWriter
+
+// Appends msgpack encoded values to a byte vector.
+// Binary payloads can be left out of the vector by writing only the header
+// with WriteBinHeader() and sending the payload as a separate body segment.
+class MsgpackWriter {
+public:
+    explicit MsgpackWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+    void WriteNil();
+    void WriteBool(bool value);
+    void WriteInt(int64_t value);
+    void WriteUInt(uint64_t value);
+    void WriteFloat(double value);
+    void WriteStr(const char* data, size_t bytes);
+    void WriteBin(const void* data, size_t bytes);
+    void WriteBinHeader(size_t bytes);
+    void WriteArrayHeader(size_t count);
+    void WriteMapHeader(size_t count);
+
+protected:
+    std::vector<uint8_t>& out_;
+
+    void WriteByte(uint8_t value) {
+        out_.push_back(value);
+    }
+    void WriteTagged8(uint8_t tag, uint8_t value);
+    void WriteTagged16(uint8_t tag, uint16_t value);
+    void WriteTagged32(uint8_t tag, uint32_t value);
+    void WriteTagged64(uint8_t tag, uint64_t value);
+};
+
+
+//------------------------------------------------------------------------------
+// MsgpackParse
+
+struct MsgpackToken {
+    enum class Type : uint8_t {
+        Nil,
+        Bool,
+        Int,
+        UInt,
+        Float,
+        Str,
+        Bin,
+        Array,
+        Map,
+    };
+
+    Type Kind = Type::Nil;
+
+    bool Bool = false;
+    int64_t Int = 0;
+    uint64_t UInt = 0;
+    double Float = 0.0;
+
+    // Str/Bin: Points into the parsed buffer
+    const uint8_t* Data = nullptr;
+
+    // Str/Bin: Bytes, Array: Element count, Map: Key/value pair count
+    uint64_t Length = 0;
+};
+
+// Validates a complete msgpack message and flattens it into tokens in
+// pre-order.  Does not allocate per value or touch any Python state, so it
+// can run without the GIL.  Returns false on malformed or trailing data.
+bool MsgpackParse(
+    const uint8_t* data,
+    size_t bytes,
+    std::vector<MsgpackToken>& tokens);
@@ -17,7 +17,7 @@ extern "C" {
 // These must be kept in sync with quicsend_wrapper.py
 struct PythonBody {
     const char* ContentType;
-    PyObject* Data; // bytes object
+    PyObject* Data; // bytes-like object, or list/tuple of them to send scatter-gather
     int32_t Length;
 };
 
@@ -44,6 +44,15 @@ struct PythonQuicSendClientSettings {
     const char* Host;
     const char* CertPath;
     uint16_t Port;
+    int32_t MailboxSpinUsec; // 0 = park immediately
+
+    const char* QlogDir; // Optional: Enables qlog tracing
+    int32_t QlogSampleRate; // Trace 1 in N connections
+    uint64_t QlogMaxBytes; // 0 = unlimited
+
+    int32_t FlightEvents; // Events kept per connection: 0 = default, < 0 = disabled
+    const char* FlightDumpDir; // Optional: Dumps go to the log without it
+    int32_t FlightDumpOnSignal; // Non-zero dumps all connections on SIGUSR2
 };
 
 struct PythonQuicSendServerSettings {
@@ -51,6 +60,74 @@ struct PythonQuicSendServerSettings {
     const char* CertPath;
     const char* KeyPath;
     uint16_t Port;
+    int32_t MailboxSpinUsec; // 0 = park immediately
+    int32_t DispatchShards; // > 1 allows concurrent quicsend_server_poll() calls
+
+    const char* QlogDir; // Optional: Enables qlog tracing
+    int32_t QlogSampleRate; // Trace 1 in N connections
+    uint64_t QlogMaxBytes; // 0 = unlimited
+
+    int32_t FlightEvents; // Events kept per connection: 0 = default, < 0 = disabled
+    const char* FlightDumpDir; // Optional: Dumps go to the log without it
+    int32_t FlightDumpOnSignal; // Non-zero dumps all connections on SIGUSR2
+};
+
+struct PythonMailboxMetrics {
+    uint64_t Polls;
+    uint64_t Events;
+    uint64_t Immediate;
+    uint64_t SpinHits;
+    uint64_t SpinMisses;
+    uint64_t Parks;
+    int64_t SpinBudgetUsec;
+    int64_t InterArrivalUsec;
+};
+
+struct PythonConnectionStats {
+    uint64_t ConnectionId;
+    uint64_t PacketsSent;
+    uint64_t PacketsReceived;
+    uint64_t PacketsLost;
+    uint64_t PacketsRetransmitted;
+    uint64_t BytesSent;
+    uint64_t BytesReceived;
+    uint64_t BytesAcked;
+    uint64_t BytesLost;
+    uint64_t BytesRetransmitted;
+    uint64_t BytesInFlight;
+    uint64_t SmoothedRttUsec;
+    uint64_t CongestionWindow;
+    uint64_t DeliveryRate;
+    uint64_t PathMtu;
+    uint64_t PacingRate;
+    uint64_t QueuedBytes;
+    int32_t StreamCount; // Total, which may exceed the streams returned
+};
+
+struct PythonStreamStats {
+    uint64_t StreamId;
+    uint64_t QueuedBytes;
+    uint64_t WrittenBytes;
+    int32_t Urgency;
+};
+
+struct PythonLatencyStats {
+    uint64_t Count;
+    uint64_t MeanUsec;
+    uint64_t P50Usec;
+    uint64_t P90Usec;
+    uint64_t P99Usec;
+    uint64_t P999Usec;
+    uint64_t MaxUsec;
+};
+
+// Longer paths are truncated
+#define PYTHON_LATENCY_PATH_MAX 128
+
+struct PythonPathLatency {
+    char Path[PYTHON_LATENCY_PATH_MAX];
+    PythonLatencyStats FirstByte;
+    PythonLatencyStats LastByte;
 };
 
 #pragma pack(pop)
@@ -68,11 +145,26 @@ QuicSendClient* quicsend_client_create(const PythonQuicSendClientSettings* setti
 
 void quicsend_client_destroy(QuicSendClient* client);
 
+// urgency: 0 (most urgent) to 7, default 3.  incremental: 0 or 1.
+// The body's buffers are referenced until sent, not copied.
+// Returns the request id, or -1 on failure, including a body part that
+// does not support the buffer protocol
 int64_t quicsend_client_request(
     QuicSendClient* client,
     const char* path,
     const char* header_info, // Optional string sent in headers
-    PythonBody body); // Optional
+    PythonBody body, // Optional
+    int32_t urgency,
+    int32_t incremental);
+
+// Changes the priority of a request that is still in flight, with the same
+// urgency and incremental values as quicsend_client_request().
+// Returns 0 if the request has already finished
+int32_t quicsend_client_update_priority(
+    QuicSendClient* client,
+    int64_t request_id,
+    int32_t urgency,
+    int32_t incremental);
 
 // Returns non-zero if the client is still valid
 int32_t quicsend_client_poll(
@@ -82,6 +174,37 @@ int32_t quicsend_client_poll(
     response_callback on_response,
     int32_t timeout_msec);
 
+void quicsend_client_mailbox_metrics(
+    QuicSendClient* client,
+    PythonMailboxMetrics* metrics);
+
+// Fills up to max_streams entries of streams.  Returns the number written
+int32_t quicsend_client_stats(
+    QuicSendClient* client,
+    PythonConnectionStats* stats,
+    PythonStreamStats* streams,
+    int32_t max_streams);
+
+// Time from request submit to the first and last response byte
+void quicsend_client_latency(
+    QuicSendClient* client,
+    PythonLatencyStats* first_byte,
+    PythonLatencyStats* last_byte);
+
+// Fills up to max_paths entries.  Returns the total number of paths
+int32_t quicsend_client_path_latency(
+    QuicSendClient* client,
+    PythonPathLatency* paths,
+    int32_t max_paths);
+
+// Writes the connection state and its most recent events, nul-terminated.
+// Returns the length of the full text, which may exceed bytes - 1 if the
+// buffer was too small
+int32_t quicsend_client_flight_recorder(
+    QuicSendClient* client,
+    char* buffer,
+    int32_t bytes);
+
 
 //------------------------------------------------------------------------------
 // C API : QuicSendServer
@@ -90,7 +213,8 @@ QuicSendServer* quicsend_server_create(const PythonQuicSendServerSettings* setti
 
 void quicsend_server_destroy(QuicSendServer* server);
 
-// Returns non-zero if the server is still valid
+// Returns non-zero if the server is still valid.
+// May be called from several threads at once when DispatchShards > 1
 int32_t quicsend_server_poll(
     QuicSendServer* server,
     connect_callback on_connect,
@@ -98,17 +222,93 @@ int32_t quicsend_server_poll(
     request_callback on_request,
     int32_t timeout_msec);
 
-void quicsend_server_respond(
+// urgency: 0 (most urgent) to 7, or -1 to follow the request's priority.
+// The body's buffers are referenced until sent, not copied.
+// Returns 0 if a body part does not support the buffer protocol
+int32_t quicsend_server_respond(
     QuicSendServer* server,
     uint64_t connection_id,
     int64_t request_id,
     int32_t status,
     const char* header_info, // Optional string sent in headers
-    PythonBody body);
+    PythonBody body,
+    int32_t urgency,
+    int32_t incremental);
 
 void quicsend_server_close(
     QuicSendServer* server,
     uint64_t connection_id);
 
+// Share of egress for the connection relative to others.  Default 1
+void quicsend_server_set_connection_weight(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    uint32_t weight);
+
+void quicsend_server_mailbox_metrics(
+    QuicSendServer* server,
+    PythonMailboxMetrics* metrics);
+
+// Fills up to max_streams entries of streams.  Returns the number written,
+// or -1 if the connection was not found
+int32_t quicsend_server_stats(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    PythonConnectionStats* stats,
+    PythonStreamStats* streams,
+    int32_t max_streams);
+
+// Time from request headers to the first and last response byte.
+// Returns 0 if the connection was not found
+int32_t quicsend_server_latency(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    PythonLatencyStats* first_byte,
+    PythonLatencyStats* last_byte);
+
+// Fills up to max_paths entries.  Returns the total number of paths
+int32_t quicsend_server_path_latency(
+    QuicSendServer* server,
+    PythonPathLatency* paths,
+    int32_t max_paths);
+
+// Same as quicsend_client_flight_recorder().
+// Returns -1 if the connection was not found
+int32_t quicsend_server_flight_recorder(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    char* buffer,
+    int32_t bytes);
+
+
+//------------------------------------------------------------------------------
+// C API : Metrics
+
+// Writes the process-wide metrics in Prometheus text format, nul-terminated.
+// Returns the length of the full text, which may exceed bytes - 1 if the
+// buffer was too small
+int32_t quicsend_metrics_prometheus(char* buffer, int32_t bytes);
+
+// Serves the metrics over HTTP on 127.0.0.1:port.  Returns non-zero on success
+int32_t quicsend_metrics_start_http(uint16_t port);
+
+void quicsend_metrics_stop_http();
+
+
+
+//------------------------------------------------------------------------------
+// C API : msgpack
+//
+// These must be called with the GIL held (load through ctypes.PyDLL).
+
+// Encodes a Python object as msgpack.  Returns bytes, or a tuple of buffers
+// to send scatter-gather when large binary fields are referenced in place.
+PyObject* quicsend_msgpack_pack(PyObject* obj);
+
+// Decodes msgpack from a bytes-like object.  The GIL is released while the
+// message is validated.  Binary fields are returned as zero-copy memoryviews
+// into the input buffer.
+PyObject* quicsend_msgpack_unpack(PyObject* data);
+
 
 } // extern "C"
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+#include <quiche.h>
+
+
+//------------------------------------------------------------------------------
+// QlogSettings
+
+struct QlogSettings {
+    // Directory for qlog files.  Empty disables tracing
+    std::string Directory;
+
+    // Trace 1 in SampleRate connections.  1 traces every connection
+    uint32_t SampleRate = 1;
+
+    // Ceiling on the total size of qlog files in Directory.  Checked on a
+    // background thread when a trace starts or ends and every
+    // QLOG_ENFORCE_INTERVAL_MSEC; past it, the oldest finished traces are
+    // deleted to get back under it.
+    // 0 = unlimited
+    uint64_t MaxTotalBytes = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// QlogTracer
+
+// Attaches quiche qlog output to sampled connections.  Each trace is written
+// by quiche to <Directory>/<assigned id>_<peer>_<start usec>.sqlog.
+// Requires quiche built with the qlog feature (QUICSEND_ENABLE_QLOG).
+class QlogTracer {
+public:
+    explicit QlogTracer(const QlogSettings& settings);
+    ~QlogTracer();
+
+    bool IsEnabled() const {
+        return enabled_;
+    }
+
+    // Called once quiche_accept() or quiche_connect() succeeds.
+    // Returns true if the connection is being traced
+    bool Attach(
+        quiche_conn* conn,
+        uint64_t assigned_id,
+        const boost::asio::ip::udp::endpoint& peer_endpoint,
+        bool is_server);
+
+    // Called just before the connection is freed.  Its trace may be deleted
+    // by later checks of MaxTotalBytes
+    void Detach(quiche_conn* conn);
+
+protected:
+    QlogSettings settings_;
+    bool enabled_ = false;
+
+    std::atomic<uint64_t> connection_count_ = ATOMIC_VAR_INIT(0);
+
+    // Paths of traces quiche is still writing, which are never deleted.
+    // Only held to update or copy the map, never across file system calls
+    std::mutex active_mutex_;
+    std::unordered_map<quiche_conn*, std::string> active_paths_;
+
+    // Enforces MaxTotalBytes off the connection threads, including while long
+    // connections keep growing their traces
+    std::shared_ptr<std::thread> enforce_thread_;
+    std::mutex enforce_mutex_;
+    std::condition_variable enforce_cv_;
+    bool enforce_requested_ = false;
+    bool terminated_ = false;
+
+    void EnforceLoop();
+
+    // Wakes the enforce thread.  No-op without MaxTotalBytes
+    void RequestEnforce();
+
+    // Deletes the oldest finished traces until there is room for one more.
+    // Only called from the enforce thread
+    void EnforceSizeCap();
+};
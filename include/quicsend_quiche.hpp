@@ -6,8 +6,15 @@
 #include <cstdlib>
 #include <cstring>
 #include <random>
+#include <memory>
+#include <string_view>
 
 #include <quicsend_tools.hpp>
+#include <quicsend_alloc.hpp>
+#include <quicsend_metrics.hpp>
+#include <quicsend_qlog.hpp>
+#include <quicsend_latency.hpp>
+#include <quicsend_flight.hpp>
 
 #include <quiche.h>
 
@@ -18,15 +25,37 @@
 // Constants
 
 #define LOCAL_CONN_ID_LEN 16
-#define MAX_DATAGRAM_SEND_SIZE 1350
 #define MAX_DATAGRAM_RECV_SIZE 1400 * 2
 #define MAX_PARALLEL_QUIC_STREAMS 8
+#define STREAM_TABLE_INITIAL_SLOTS 16
+#define MAX_TEMPLATE_HEADERS 12
+
+// Most body bytes reserved from an unverified content-length header.
+// Larger bodies grow the buffer as data arrives
+#define MAX_CONTENT_LENGTH_RESERVE (4 * 1024 * 1024)
+
+#define STREAM_DEFAULT_URGENCY 3
+#define STREAM_MAX_URGENCY 7
 #define INITIAL_MAX_DATA 8 * 1024 * 1024
 #define INITIAL_MAX_STREAM_DATA 1 * 1024 * 1024
 #define QUIC_IDLE_TIMEOUT_MSEC 5000
 #define QUIC_SEND_BUFFER_SIZE 8 * 1024 * 1024
 #define QUIC_SEND_SLOW_INTERVAL_MSEC 20
 #define QUIC_SEND_FAST_INTERVAL_MSEC 10
+
+// Packets a weight-1 connection may send per scheduler round before the
+// other connections get a turn
+#define QUIC_SEND_TURN_PACKETS 16
+#define QUIC_SEND_TURN_BYTES (QUIC_SEND_TURN_PACKETS * MAX_DATAGRAM_SEND_SIZE)
+
+// Bytes the sender loop sends per pass across all connections, at most what
+// the socket send buffer holds.  When a pass runs out, backlogged connections
+// keep their deficits, so the weights decide each connection's share
+#define QUIC_SEND_PASS_BYTES (QUIC_SEND_BUFFER_SIZE)
+
+// Upper bound on connection weights
+#define QUIC_SEND_MAX_WEIGHT 1000
+#define QUIC_RECV_BURST_MAX 64
 #define QUIC_CONNECT_TIMEOUT_MSEC 3000
 #define QUIC_TLS_CNAME "catid.io" /* MUST match key generation on CLI */
 #define QUICSEND_CLIENT_AGENT "quicsend-client"
@@ -79,75 +108,116 @@ bool read_token(
     ConnectionId& odcid);
 
 std::pair<sockaddr_storage, socklen_t> to_sockaddr(const boost::asio::ip::udp::endpoint& endpoint);
-boost::asio::ip::udp::endpoint sockaddr_to_endpoint(const sockaddr* addr, socklen_t len);
+
+// Copies a raw IPv4/IPv6 address into an endpoint.  Returns false if the
+// address family or length is not supported.  Does not throw
+bool sockaddr_to_endpoint(const sockaddr* addr, socklen_t len, boost::asio::ip::udp::endpoint& endpoint);
 
 const char* quiche_h3_error_to_string(int error);
 const char* quiche_error_to_string(int error);
 
 
-//------------------------------------------------------------------------------
-// SendAllocator
-
-struct SendBuffer {
-    uint8_t Payload[MAX_DATAGRAM_SEND_SIZE];
-    int Length = 0;
-};
-
-class SendAllocator {
-public:
-    std::shared_ptr<SendBuffer> Allocate();
-    void Free(std::shared_ptr<SendBuffer> buffer);
-
-protected:
-    std::mutex mutex_;
-    std::vector<std::shared_ptr<SendBuffer>> free_buffers_;
-    std::atomic<uint32_t> free_buffers_count_ = ATOMIC_VAR_INIT(0);
-};
-
-
 //------------------------------------------------------------------------------
 // QuicheSocket
 
 class QuicheConnection;
 
-using DatagramCallback = std::function<void(
-    uint8_t* data,
-    std::size_t bytes,
-    const boost::asio::ip::udp::endpoint& peer_endpoint)>;
-
 class QuicheSocket {
 public:
     friend class QuicheConnection;
 
     QuicheSocket(
         boost::asio::io_context& io_context,
-        DatagramCallback on_datagram,
         uint16_t port = 0,
         const std::string& cert_path = "",
         const std::string& key_path = "");
     ~QuicheSocket();
 
-    void StartReceive();
+    // Datagrams are handed to handler->OnDatagram(data, bytes, peer_endpoint),
+    // a direct call since the handler type is known at compile time.
+    // Each receive completion also drains up to QUIC_RECV_BURST_MAX queued
+    // datagrams without blocking.  Connections that received data process
+    // H3 events and flush egress once at the end of the burst.
+    template<class Handler>
+    void StartReceive(Handler* handler) {
+        auto fn = [this, handler](boost::system::error_code ec, std::size_t bytes) {
+            if (!ec && bytes > 0) {
+                Metrics::Add(Metric::PacketsIn);
+                Metrics::Add(Metric::BytesIn, bytes);
+                handler->OnDatagram(recv_buf_.data(), bytes, sender_endpoint_);
+                DrainReceive(handler);
+                FinishBurst();
+            }
+            StartReceive(handler);
+        };
+
+        socket_->async_receive_from(
+            boost::asio::buffer(recv_buf_),
+            sender_endpoint_,
+            fn);
+    }
 
     void Send(
-        std::shared_ptr<SendBuffer> buffer,
+        SendBufferPtr buffer,
         const boost::asio::ip::udp::endpoint& dest_endpoint);
 
+    // Ends the QuicheSender wait early, when a connection had more to send
+    // than it may send outside the sender loop
+    void WakeSender();
+
+    // Used by QuicheSender.  Returns after timeout_msec or a WakeSender() call
+    void WaitForSender(int timeout_msec);
+
     // Socket
     SendAllocator allocator_;
     boost::asio::io_context* io_context_ = nullptr;
     std::shared_ptr<boost::asio::ip::udp::socket> socket_;
 
+    // Bound address, read once so the packet path does not call getsockname()
+    boost::asio::ip::udp::endpoint local_endpoint_;
+
     quiche_config* config_ = nullptr;
 
 protected:
     // Contexts
     quiche_h3_config* h3_config_ = nullptr;
 
+    // Serializes sends from the IO thread, QuicheSender and API callers
+    std::mutex send_mutex_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    bool wake_requested_ = false;
+
     // Receive buffer
     std::array<uint8_t, MAX_DATAGRAM_RECV_SIZE> recv_buf_;
     boost::asio::ip::udp::endpoint sender_endpoint_;
-    DatagramCallback on_datagram_;
+
+    // Connections that received datagrams during the current burst.
+    // Only touched from the IO thread
+    std::vector<std::shared_ptr<QuicheConnection>> burst_connections_;
+    std::vector<std::shared_ptr<QuicheConnection>> burst_scratch_;
+
+    template<class Handler>
+    void DrainReceive(Handler* handler) {
+        for (int i = 1; i < QUIC_RECV_BURST_MAX; ++i) {
+            boost::system::error_code ec;
+            std::size_t bytes = socket_->receive_from(
+                boost::asio::buffer(recv_buf_),
+                sender_endpoint_,
+                0,
+                ec);
+            if (ec || bytes == 0) {
+                // would_block: The socket queue is empty, so the burst is over
+                break;
+            }
+            Metrics::Add(Metric::PacketsIn);
+            Metrics::Add(Metric::BytesIn, bytes);
+            handler->OnDatagram(recv_buf_.data(), bytes, sender_endpoint_);
+        }
+    }
+
+    void FinishBurst();
 
     // Shared between all connections
     std::array<uint8_t, MAX_DATAGRAM_RECV_SIZE> body_buf_;
@@ -157,17 +227,66 @@ protected:
 //------------------------------------------------------------------------------
 // BodyData
 
+struct BodySegment {
+    const uint8_t* Data = nullptr;
+    int64_t Length = 0;
+};
+
 struct BodyData {
     const char* ContentType = nullptr;
     const uint8_t* Data = nullptr;
     int32_t Length = 0;
 
+    // Optional scatter-gather list.  If non-empty it is sent in order instead of Data/Length
+    std::vector<BodySegment> Segments;
+
+    // Optional: Keeps Data and Segments valid until the body is fully sent.
+    // Without it the memory is only borrowed for the call, and whatever
+    // quiche cannot accept right away is copied
+    std::shared_ptr<void> Owner;
+
+    int64_t TotalLength() const {
+        if (Segments.empty()) {
+            return Data ? Length : 0;
+        }
+        int64_t total = 0;
+        for (const auto& segment : Segments) {
+            total += segment.Length;
+        }
+        return total;
+    }
+
     bool Empty() const {
-        return Length == 0 || !Data || !ContentType;
+        return TotalLength() <= 0 || !ContentType;
     }
 };
 
 
+//------------------------------------------------------------------------------
+// Stream Priority
+
+// Extensible priority from RFC 9218.  Lower urgency is sent first.
+// Incremental streams of the same urgency share bandwidth instead of
+// being sent one after another
+struct StreamPriority {
+    uint8_t Urgency = STREAM_DEFAULT_URGENCY;
+    bool Incremental = false;
+
+    bool IsDefault() const {
+        return Urgency == STREAM_DEFAULT_URGENCY && !Incremental;
+    }
+};
+
+// Parses a priority header value such as "u=1, i".  Unknown parameters are
+// ignored and invalid ones leave the default in place
+StreamPriority ParsePriorityHeader(std::string_view value);
+
+// Writes the header value for the priority.  Returns the length written,
+// which is at most PRIORITY_HEADER_MAX bytes
+#define PRIORITY_HEADER_MAX 8
+size_t FormatPriorityHeader(const StreamPriority& priority, char* out);
+
+
 //------------------------------------------------------------------------------
 // IncomingStream
 
@@ -176,10 +295,59 @@ struct IncomingStream {
 
     std::string Method, Path, Status, Authorization, ContentType, HeaderInfo;
 
-    std::vector<uint8_t> Buffer;
+    // From the priority header, if the peer sent one
+    StreamPriority Priority;
+
+    PooledBuffer Buffer;
 
-    void OnHeader(const std::string& name, const std::string& value);
+    // Intrusive reference count managed by IncomingStreamPtr
+    std::atomic<uint32_t> RefCount = ATOMIC_VAR_INIT(0);
+
+    void OnHeader(std::string_view name, std::string_view value);
     void OnData(const void* data, size_t bytes);
+
+    // Called by ObjectPool before reuse.  Keeps string capacity
+    void Reset();
+};
+
+void intrusive_ptr_add_ref(IncomingStream* stream);
+void intrusive_ptr_release(IncomingStream* stream);
+
+using IncomingStreamPtr = boost::intrusive_ptr<IncomingStream>;
+
+
+//------------------------------------------------------------------------------
+// QueuedBody
+
+// Part of a body that quiche has not accepted yet.  It is written from the
+// caller's segments while Owner keeps them valid, so bodies held back by
+// flow control are not copied.  Bodies without an owner are gathered into
+// Copy instead
+struct QueuedBody {
+    std::vector<BodySegment> Segments;
+    size_t Index = 0; // Next segment to send
+    int64_t Offset = 0; // Bytes of Segments[Index] already sent
+
+    std::shared_ptr<void> Owner;
+    PooledBuffer Copy;
+
+    // Queues the segments, skipping offset bytes of the first one
+    void Assign(
+        const BodySegment* segments,
+        int segment_count,
+        int64_t offset,
+        const std::shared_ptr<void>& owner);
+
+    bool Empty() const {
+        return Index >= Segments.size();
+    }
+    int64_t Remaining() const;
+
+    // Advances past bytes accepted by quiche
+    void Consume(int64_t bytes);
+
+    // Drops the segments and their owner
+    void Release();
 };
 
 
@@ -189,14 +357,201 @@ struct IncomingStream {
 struct OutgoingStream {
     uint64_t Id = 0;
 
-    int SendOffset = 0;
-    std::vector<uint8_t> Buffer;
+    // Position in the local flush order.  Lower goes first
+    uint8_t Urgency = STREAM_DEFAULT_URGENCY;
+
+    QueuedBody Body;
+
+    // Body bytes accepted by quiche so far
+    uint64_t WrittenBytes = 0;
+
+    // Called by ObjectPool before reuse
+    void Reset();
+};
+
+
+//------------------------------------------------------------------------------
+// RequestTiming
+
+// GetNsec() timestamps of one request stream, from the point of view of the
+// side that holds it.  Zero until the step happens
+struct RequestTiming {
+    // Client: Request submitted.  Server: Request headers received
+    int64_t StartNsec = 0;
+
+    // Client: Request headers sent.  Server: Response headers sent
+    int64_t HeadersSentNsec = 0;
+
+    // First body byte accepted by quiche.  quiche does not report when
+    // stream data is acknowledged, so this is the closest point we see
+    int64_t BodySentNsec = 0;
+
+    // Client: Response headers received
+    int64_t PeerHeadersNsec = 0;
+
+    // QUICHE_H3_EVENT_FINISHED: Peer finished sending
+    int64_t FinishedNsec = 0;
+
+    // Histograms for the request path, or nullptr if not known yet
+    RequestLatency* PathLatency = nullptr;
+};
+
+
+//------------------------------------------------------------------------------
+// StreamSlotTable
+
+// Maps QUIC stream ids to stream objects without hashing or allocating.
+// Request stream ids are dense (id/4 counts up by one per request), so they
+// index a small power-of-two ring of slots directly.  The ring doubles only
+// when a new stream lands on a slot that a live stream still holds.
+template<class Ptr>
+class StreamSlotTable {
+public:
+    StreamSlotTable() {
+        slots_.resize(STREAM_TABLE_INITIAL_SLOTS);
+    }
+
+    // Returns nullptr if the stream is not in the table
+    Ptr* Find(uint64_t stream_id) {
+        Slot& slot = slots_[SlotIndex(stream_id, slots_.size())];
+        if (!slot.Used || slot.Id != stream_id) {
+            return nullptr;
+        }
+        return &slot.Stream;
+    }
+
+    // Replaces the stream if the id is already in the table
+    Ptr& Insert(uint64_t stream_id, Ptr stream) {
+        for (;;) {
+            Slot& slot = slots_[SlotIndex(stream_id, slots_.size())];
+            if (!slot.Used) {
+                break;
+            }
+            if (slot.Id == stream_id) {
+                slot.Stream = std::move(stream);
+                return slot.Stream;
+            }
+            Grow();
+        }
+        Slot& slot = slots_[SlotIndex(stream_id, slots_.size())];
+        slot.Used = true;
+        slot.Id = stream_id;
+        slot.Stream = std::move(stream);
+        count_++;
+        return slot.Stream;
+    }
+
+    // Moves the stream out of the table.  Returns false if it was not found
+    bool Erase(uint64_t stream_id, Ptr* removed = nullptr) {
+        Slot& slot = slots_[SlotIndex(stream_id, slots_.size())];
+        if (!slot.Used || slot.Id != stream_id) {
+            return false;
+        }
+        if (removed) {
+            *removed = std::move(slot.Stream);
+        }
+        slot = Slot();
+        count_--;
+        return true;
+    }
+
+    template<class F>
+    void ForEach(F&& fn) {
+        for (Slot& slot : slots_) {
+            if (slot.Used) {
+                fn(slot.Stream);
+            }
+        }
+    }
+
+    size_t Count() const {
+        return count_;
+    }
+
+protected:
+    struct Slot {
+        uint64_t Id = 0;
+        bool Used = false;
+        Ptr Stream = Ptr();
+    };
+
+    std::vector<Slot> slots_;
+    size_t count_ = 0;
+
+    static size_t SlotIndex(uint64_t stream_id, size_t slot_count) {
+        return static_cast<size_t>(stream_id >> 2) & (slot_count - 1);
+    }
+
+    void Grow() {
+        std::vector<Slot> old_slots;
+        old_slots.swap(slots_);
+
+        size_t slot_count = old_slots.size() * 2;
+        for (;;) {
+            // Live ids may still collide at the new size, so keep doubling
+            std::vector<Slot> slots(slot_count);
+            bool collided = false;
+            for (Slot& old_slot : old_slots) {
+                if (!old_slot.Used) {
+                    continue;
+                }
+                Slot& slot = slots[SlotIndex(old_slot.Id, slot_count)];
+                if (slot.Used) {
+                    collided = true;
+                    break;
+                }
+                slot.Used = true;
+                slot.Id = old_slot.Id;
+            }
+            if (!collided) {
+                for (Slot& old_slot : old_slots) {
+                    if (old_slot.Used) {
+                        slots[SlotIndex(old_slot.Id, slot_count)].Stream = std::move(old_slot.Stream);
+                    }
+                }
+                slots_.swap(slots);
+                return;
+            }
+            slot_count *= 2;
+        }
+    }
 };
 
 
 //------------------------------------------------------------------------------
 // QuicheMailbox
 
+struct MailboxWaitPolicy {
+    // Longest time Poll() spins before parking on the condition variable.
+    // 0 disables spinning, which is the lowest CPU option.
+    int MaxSpinUsec = 0;
+
+    // Size the spin window from recent event inter-arrival times, and skip
+    // spinning when events arrive too rarely for it to pay off
+    bool Adaptive = true;
+};
+
+struct MailboxMetrics {
+    uint64_t Polls = 0;
+    uint64_t Events = 0;
+
+    // Events were already waiting when Poll() was called
+    uint64_t Immediate = 0;
+
+    // An event arrived during the spin phase
+    uint64_t SpinHits = 0;
+
+    // Spun for the whole window without an event, then parked
+    uint64_t SpinMisses = 0;
+
+    // Waited on the condition variable
+    uint64_t Parks = 0;
+
+    // Current adaptive spin window and smoothed inter-arrival time
+    int64_t SpinBudgetUsec = 0;
+    int64_t InterArrivalUsec = 0;
+};
+
 class QuicheMailbox {
 public:
     enum class EventType {
@@ -212,14 +567,50 @@ public:
         boost::asio::ip::udp::endpoint PeerEndpoint;
         uint64_t ConnectionAssignedId = 0;
 
-        std::shared_ptr<IncomingStream> Stream;
+        IncomingStreamPtr Stream;
     };
 
-    using MailboxCallback = std::function<void(const Event& event)>;
+    QuicheMailbox();
+
+    void SetWaitPolicy(const MailboxWaitPolicy& policy);
+    MailboxMetrics GetMetrics() const;
+
+    // Events are sharded by ConnectionAssignedId.  Each shard is handed to
+    // one Poll() caller at a time, so several threads may call Poll() at once
+    // while events of one connection are still delivered in order.
+    // A connection joins the shard with the fewest live connections, so the
+    // load stays even as connections come and go.  Shards do not know how
+    // busy each connection is, so two heavy connections can still share one
+    // shard and be handled by one thread at a time.
+    // Must be called before any events are posted.
+    void SetShardCount(int shard_count);
 
     void Shutdown();
-    // Wait for events.  Pass -1 for timeout_msec to wait indefinitely.
-    void Poll(MailboxCallback callback, int timeout_msec = -1);
+
+    // Wait for events and call callback(const Event&) for each one.
+    // Pass -1 for timeout_msec to wait indefinitely.
+    template<class Callback>
+    void Poll(Callback&& callback, int timeout_msec = -1) {
+        std::vector<Event> events;
+        const int shard_index = AcquireShard(events, timeout_msec);
+        if (shard_index < 0) {
+            return;
+        }
+
+        // Release the shard even if a callback throws
+        struct ShardScope {
+            QuicheMailbox* Mailbox;
+            int Index;
+            std::vector<Event>& Events;
+            ~ShardScope() { Mailbox->ReleaseShard(Index, Events); }
+        } release_scope{this, shard_index, events};
+
+        // Process events without lock held to avoid deadlock and blocking IO thread
+        for (const auto& event : events) {
+            callback(event);
+        }
+    }
+
     void Post(const Event& event);
 
 protected:
@@ -227,7 +618,114 @@ protected:
     std::condition_variable cv_;
     std::atomic<bool> terminated_ = ATOMIC_VAR_INIT(false);
 
-    std::vector<Event> events_;
+    struct Shard {
+        std::vector<Event> Events;
+
+        // A Poll() caller is running callbacks for this shard
+        bool Busy = false;
+
+        // Live connections assigned to this shard
+        size_t Connections = 0;
+    };
+    std::vector<Shard> shards_;
+
+    // Shard of each live connection, when there is more than one shard.
+    // Entries are added on the first event and removed on Timeout
+    std::unordered_map<uint64_t, size_t> connection_shards_;
+
+    // Called with lock held
+    size_t AssignShard(const Event& event);
+
+    // Rotates the first shard examined so busy shards do not starve others
+    size_t next_shard_ = 0;
+
+    // Returns a shard index with events that no poller owns, or -1.
+    // Called with lock held
+    int FindReadyShard() const;
+    bool AnyEvents() const;
+
+    // Lets Poll() spin on new events without taking the lock
+    std::atomic<bool> has_events_ = ATOMIC_VAR_INIT(false);
+
+    std::atomic<int> max_spin_usec_ = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> adaptive_spin_ = ATOMIC_VAR_INIT(true);
+
+    // Smoothed time between Post() calls, updated with lock held
+    int64_t last_post_nsec_ = 0;
+    std::atomic<int64_t> interarrival_nsec_ = ATOMIC_VAR_INIT(0);
+
+    std::atomic<uint64_t> polls_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> events_delivered_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> immediate_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> spin_hits_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> spin_misses_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> parks_ = ATOMIC_VAR_INIT(0);
+
+    int64_t SpinBudgetUsec() const;
+
+    // Returns true if an event arrived within the spin window
+    bool SpinWait(int64_t spin_usec);
+
+    // Waits for a ready shard and takes its events.  Returns the shard index,
+    // or -1 on timeout or shutdown
+    int AcquireShard(std::vector<Event>& events, int timeout_msec);
+
+    // Hands the shard to the next poller and recycles the event vector
+    void ReleaseShard(int shard_index, std::vector<Event>& events);
+};
+
+
+//------------------------------------------------------------------------------
+// Header Templates
+
+// Fixed list of HTTP/3 headers built once, with the constant values stored
+// here.  Per-message values are patched into a HeaderBlock copy.
+class HeaderTemplate {
+public:
+    // Returns the index of the header for HeaderBlock::Set()
+    int Add(const char* name, const std::string& value = std::string());
+
+    const quiche_h3_header* data() const { return headers_.data(); }
+    size_t size() const { return headers_.size(); }
+
+protected:
+    std::vector<quiche_h3_header> headers_;
+
+    // Heap allocated so the header pointers stay valid as the list grows
+    std::vector<std::unique_ptr<std::string>> values_;
+};
+
+// Copy of a HeaderTemplate on the stack with per-message values patched in.
+// Patched values point at caller memory, which must outlive the send call.
+class HeaderBlock {
+public:
+    explicit HeaderBlock(const HeaderTemplate& header_template);
+
+    void Set(int index, const char* value, size_t length);
+    void Set(int index, const std::string& value) {
+        Set(index, value.data(), value.size());
+    }
+
+    // Formats into storage inside the block.  Only one integer field per block
+    void SetInt(int index, int64_t value);
+
+    // Drops trailing headers, e.g. body headers for a message without a body
+    void Truncate(size_t count) {
+        count_ = std::min(count_, count);
+    }
+
+    // Adds a header that is not in the template.  The name must be a literal.
+    // Returns false without adding it if the block already holds
+    // MAX_TEMPLATE_HEADERS, in which case the message must not be sent
+    bool Append(const char* name, const char* value, size_t length);
+
+    const quiche_h3_header* data() const { return headers_.data(); }
+    size_t size() const { return count_; }
+
+protected:
+    std::array<quiche_h3_header, MAX_TEMPLATE_HEADERS> headers_;
+    size_t count_ = 0;
+    char number_[24];
 };
 
 
@@ -237,36 +735,88 @@ protected:
 struct CachedResponse {
     uint64_t stream_id = 0;
     std::vector<quiche_h3_header> headers;
-    std::shared_ptr<std::vector<uint8_t>> data; // Shared pointer to the body data
-    int bytes_left = 0; // Number of bytes left to send
+    std::string header_storage; // Owns the header names and values
+    QueuedBody body; // Sent once the headers go out
+    int64_t bytes_left = 0; // Number of bytes left to send
+    StreamPriority priority;
 };
 
 
 //------------------------------------------------------------------------------
-// Connection State
+// Connection Stats
 
-using OnConnectCallback = std::function<void(uint64_t connection_id, const boost::asio::ip::udp::endpoint& peer_endpoint)>;
-using OnTimeoutCallback = std::function<void(uint64_t connection_id)>;
-using OnDataCallback = std::function<void(const QuicheMailbox::Event& event)>;
+struct StreamStats {
+    uint64_t StreamId = 0;
+    uint8_t Urgency = STREAM_DEFAULT_URGENCY;
+
+    // Body bytes waiting in our buffer for quiche to accept them
+    uint64_t QueuedBytes = 0;
+
+    // Body bytes quiche has accepted.  quiche does not report per-stream
+    // acknowledgements, so these are sent or awaiting acknowledgement
+    uint64_t WrittenBytes = 0;
+};
+
+struct ConnectionStats {
+    uint64_t ConnectionId = 0;
+
+    // From quiche_conn_stats()
+    uint64_t PacketsSent = 0;
+    uint64_t PacketsReceived = 0;
+    uint64_t PacketsLost = 0;
+    uint64_t PacketsRetransmitted = 0;
+    uint64_t BytesSent = 0;
+    uint64_t BytesReceived = 0;
+    uint64_t BytesAcked = 0;
+    uint64_t BytesLost = 0;
+    uint64_t BytesRetransmitted = 0;
+
+    // Sent bytes not yet acknowledged or declared lost
+    uint64_t BytesInFlight = 0;
+
+    // From quiche_conn_path_stats() for the active path
+    uint64_t SmoothedRttUsec = 0;
+    uint64_t CongestionWindow = 0;
+    uint64_t DeliveryRate = 0; // bytes per second
+    uint64_t PathMtu = 0;
+
+    // Bytes per second, estimated from the release times quiche assigns to
+    // paced packets.  0 until a paced packet has been sent
+    uint64_t PacingRate = 0;
+
+    // Streams with body data not yet accepted by quiche
+    uint64_t QueuedBytes = 0;
+    std::vector<StreamStats> Streams;
+};
 
-struct QCSettings {
-    // The server can only receive requests and send responses.
-    // The client can only send requests and receive responses.
-    bool IsServer = false;
 
+//------------------------------------------------------------------------------
+// Connection State
+
+struct QCSettings {
     // Identifier assigned to this connection by the server
     uint64_t AssignedId = 0;
 
     std::shared_ptr<QuicheSocket> qs;
 
+    // Connection id that packets from the peer are addressed to.
+    // Clients pick it at random and Connect() uses it as the source id
     ConnectionId dcid;
 
-    OnConnectCallback on_connect;
-    OnTimeoutCallback on_timeout;
-    OnDataCallback on_data;
+    // Optional: Traces this connection if it is sampled
+    std::shared_ptr<QlogTracer> qlog;
+
+    // Optional: Request latency by path, shared with other connections
+    std::shared_ptr<PathLatencyTracker> latency;
+
+    // Ring of recent events kept for post-mortem dumps
+    FlightRecorderSettings flight;
 };
 
-class QuicheConnection {
+// Role-independent connection state.  Events found while processing under
+// the connection lock are queued as signals and delivered by the
+// QuicheRoleConnection<Handler> that owns this object.
+class QuicheConnection : public std::enable_shared_from_this<QuicheConnection> {
 public:
     QCSettings settings_;
 
@@ -284,30 +834,58 @@ public:
         const ConnectionId& odcid);
     bool Connect(boost::asio::ip::udp::endpoint server_endpoint);
 
+    // Feeds one datagram to quiche.  The rest of the processing is deferred
+    // to OnBurstEnd(), which the socket calls once per receive burst
     void OnDatagram(
         uint8_t* data,
         std::size_t bytes,
-        boost::asio::ip::udp::endpoint peer_endpoint);
+        const boost::asio::ip::udp::endpoint& peer_endpoint);
+    void OnBurstEnd();
 
-    // Returns the stream id or -1 on failure
+    // Returns the stream id or -1 on failure.
+    // The priority orders the request body against other streams locally;
+    // the caller also puts it in the priority header for the server
     int64_t SendRequest(
-        const std::vector<std::pair<std::string, std::string>>& headers,
-        const void* data = nullptr,
-        int bytes = 0);
-
+        const quiche_h3_header* headers,
+        size_t header_count,
+        const BodySegment* segments = nullptr,
+        int segment_count = 0,
+        const std::shared_ptr<void>& owner = nullptr,
+        const StreamPriority& priority = StreamPriority());
+
+    // If priority is nullptr, the response uses the priority the client
+    // asked for in its request headers
     bool SendResponse(
         uint64_t stream_id,
-        const std::vector<std::pair<std::string, std::string>>& headers,
-        const void* data = nullptr,
-        int bytes = 0);
-
+        const quiche_h3_header* headers,
+        size_t header_count,
+        const BodySegment* segments = nullptr,
+        int segment_count = 0,
+        const std::shared_ptr<void>& owner = nullptr,
+        const StreamPriority* priority = nullptr);
+
+    // Client only: moves an in-flight request to a new priority.  The server
+    // learns it from a PRIORITY_UPDATE frame (RFC 9218), and request body
+    // still queued here is reordered.  Returns false if the request is done
+    bool UpdateRequestPriority(uint64_t stream_id, const StreamPriority& priority);
+
+    // Sends up to QUIC_SEND_TURN_BYTES right away, e.g. after queueing a
+    // request.  QuicheSender sends the rest and charges these bytes to the
+    // connection's next turn
     inline bool FlushEgress() {
-        std::shared_ptr<SendBuffer> buffer;
-        bool sent = FlushEgress(buffer);
-        settings_.qs->allocator_.Free(buffer);
-        return sent;
+        SendBufferPtr buffer;
+        return FlushEgress(buffer);
+    }
+    bool FlushEgress(SendBufferPtr& buffer);
+
+    // Used by QuicheSender.  Stops once max_bytes have been sent.  The last
+    // packet may go past it.  Returns the number of bytes sent
+    int64_t FlushEgress(SendBufferPtr& buffer, int64_t max_bytes);
+
+    // Bytes sent outside of QuicheSender since the last call
+    int64_t TakeUnscheduledBytes() {
+        return unscheduled_bytes_.exchange(0, std::memory_order_relaxed);
     }
-    bool FlushEgress(std::shared_ptr<SendBuffer>& buffer);
 
     // This checks peer certificate and closes the connection if it does not match
     bool ComparePeerCertificate(const void* cert_cer_data, int bytes);
@@ -321,8 +899,20 @@ public:
 
     void Close(const char* reason = "exit");
 
-    // Returns true if the connection is still connected
-    bool Poll(OnConnectCallback on_connect, OnTimeoutCallback on_timeout);
+    void GetStats(ConnectionStats& stats);
+
+    // Time to first and last byte of requests on this connection
+    void GetLatency(RequestLatencyStats& stats) const {
+        latency_.GetStats(stats);
+    }
+
+    // Connection stats followed by the recent events, oldest first
+    std::string FormatFlightRecorder(const char* reason, size_t max_events = 0);
+
+    // Queues FormatFlightRecorder() for the dump directory, or the most recent
+    // events for the log if there is none.  The write happens on another
+    // thread
+    void DumpFlightRecorder(const char* reason);
 
 protected:
     std::recursive_mutex mutex_;
@@ -338,27 +928,157 @@ protected:
     // If the server does not respond to a connection request, quiche does not flag a timeout
     std::shared_ptr<boost::asio::deadline_timer> connection_timer_;
 
+    // Endpoints hold raw sockaddrs, which are passed to quiche directly
+    boost::asio::ip::udp::endpoint local_endpoint_;
     boost::asio::ip::udp::endpoint peer_endpoint_;
 
-    std::unordered_map<uint64_t, std::shared_ptr<IncomingStream>> incoming_streams_by_id_;
-    std::unordered_map<uint64_t, std::shared_ptr<OutgoingStream>> outgoing_streams_by_id_;
+    StreamSlotTable<IncomingStreamPtr> incoming_streams_;
+    StreamSlotTable<OutgoingStream*> outgoing_streams_;
+
+    // Outgoing streams with queued data or a pending FIN, sorted by urgency
+    // and then by creation order
+    std::vector<OutgoingStream*> active_outgoing_;
+
+    // Non-default priorities from request headers, kept until the response
+    std::vector<std::pair<uint64_t, StreamPriority>> requested_priorities_;
+
+    // Smoothed estimate for ConnectionStats::PacingRate
+    uint64_t pacing_rate_ = 0;
+
+    // Set by Accept().  Decides which side of a request the timings describe
+    bool is_server_ = false;
+
+    // Requests in flight, and the histograms they are folded into
+    StreamSlotTable<RequestTiming> request_timings_;
+    RequestLatency latency_;
+
+    FlightRecorder flight_;
 
     uint64_t highest_processed_stream_id_ = 0;
     std::atomic<bool> goaway_sent_ = ATOMIC_VAR_INIT(false);
 
+    // Set while the connection is queued for OnBurstEnd()
+    bool burst_pending_ = false;
+
+    // Sent by FlushEgress() and receive bursts, for TakeUnscheduledBytes()
+    std::atomic<int64_t> unscheduled_bytes_ = ATOMIC_VAR_INIT(0);
+
+    // Signals raised under the lock and not yet delivered to the handler
+    struct Signals {
+        bool Connected = false;
+        bool TimedOut = false;
+        std::vector<IncomingStreamPtr> Finished;
+    };
+    Signals signals_;
+    std::atomic<bool> signals_pending_ = ATOMIC_VAR_INIT(false);
+    bool dispatching_ = false;
+
+    // Set by QuicheRoleConnection.  Called with lock held to deliver signals_
+    void (*signal_dispatch_)(QuicheConnection* connection) = nullptr;
+
+    // Delivers queued signals unless a dispatch is already running
+    inline void DispatchSignals() {
+        if (signals_pending_.load(std::memory_order_acquire)) {
+            RunSignalDispatch();
+        }
+    }
+    void RunSignalDispatch();
+    void ProcessBurst();
+    int64_t WriteEgress(SendBufferPtr& buffer, int64_t max_bytes);
+
     // Cache for responses that couldn't be sent immediately
     std::vector<std::shared_ptr<CachedResponse>> response_cache_;
 
     // Called from function with lock held
-    bool SendBody(uint64_t stream_id, const void* data, int bytes);
+    bool SendBody(uint64_t stream_id, const BodySegment* segments, int segment_count,
+        const std::shared_ptr<void>& owner, uint8_t urgency);
+    bool WriteBody(uint64_t stream_id, const BodySegment* segments, int segment_count,
+        const std::shared_ptr<void>& owner, uint8_t urgency);
     void ProcessH3Events();
     void TickTimeout();
+    void OnClosed();
     void FlushCachedResponses();
     void FlushTransfers();
 
-    std::shared_ptr<IncomingStream> GetIncomingStream(uint64_t stream_id, bool create = true);
-    std::shared_ptr<OutgoingStream> GetOutgoingStream(uint64_t stream_id, bool create = true);
+    IncomingStream* GetIncomingStream(uint64_t stream_id, bool create = true);
+    OutgoingStream* GetOutgoingStream(uint64_t stream_id, uint8_t urgency = STREAM_DEFAULT_URGENCY);
+    StreamPriority TakeRequestedPriority(uint64_t stream_id);
+    void OnPriorityUpdate(uint64_t stream_id, const StreamPriority& priority);
+    void ReprioritizeStream(uint64_t stream_id, const StreamPriority& priority);
+    void DestroyOutgoingStream(uint64_t stream_id);
     void DestroyStream(uint64_t stream_id);
+
+    // Request timing steps.  No-ops for streams without a timing
+    void OnBodySent(uint64_t stream_id);
+    void OnResponseHeadersSent(uint64_t stream_id);
+    void OnLocalFinished(uint64_t stream_id);
+    void RecordLatency(const RequestTiming& timing, int64_t now_nsec, bool last_byte);
+    void FinishRequestTiming(uint64_t stream_id, int64_t now_nsec);
+};
+
+// Connection bound to a client or server handler type.  Handler provides:
+//   static constexpr bool IsServer;
+//   void OnConnect(QuicheConnection& connection, const endpoint& peer_endpoint);
+//   void OnData(QuicheConnection& connection, const QuicheMailbox::Event& event);
+//   void OnTimeout(QuicheConnection& connection);
+// The calls are made directly with the connection lock held, from whichever
+// thread flushed the connection: the socket's io_context thread after a
+// receive burst or timer, the QuicheSender thread with the sender mutex held,
+// or an application thread inside SendRequest()/SendResponse().  Handlers
+// must only queue work (e.g. post to a QuicheMailbox) and must not block or
+// touch other connections.
+// Only signal delivery is specialized: request handling, timings and flight
+// records are shared code that checks is_server_ at run time.
+template<class Handler>
+class QuicheRoleConnection : public QuicheConnection {
+public:
+    explicit QuicheRoleConnection(Handler* handler)
+        : handler_(handler)
+    {
+        signal_dispatch_ = &QuicheRoleConnection::Dispatch;
+    }
+
+protected:
+    Handler* handler_;
+
+    // Signals being delivered, swapped with signals_ to keep their capacity
+    Signals delivering_;
+
+    static void Dispatch(QuicheConnection* connection) {
+        // Called from function with lock held
+
+        auto self = static_cast<QuicheRoleConnection*>(connection);
+        Signals& signals = self->delivering_;
+        std::swap(signals, self->signals_);
+
+        if (signals.Connected) {
+            signals.Connected = false;
+            self->handler_->OnConnect(*self, self->peer_endpoint_);
+        }
+
+        for (auto& stream : signals.Finished) {
+            const uint64_t stream_id = stream->Id;
+
+            QuicheMailbox::Event event;
+            event.Type = QuicheMailbox::EventType::Data;
+            event.PeerEndpoint = self->peer_endpoint_;
+            event.ConnectionAssignedId = self->settings_.AssignedId;
+            event.Stream = std::move(stream);
+
+            self->handler_->OnData(*self, event);
+
+            // After client gets a response, destroy the stream
+            if constexpr (!Handler::IsServer) {
+                self->DestroyStream(stream_id);
+            }
+        }
+        signals.Finished.clear();
+
+        if (signals.TimedOut) {
+            signals.TimedOut = false;
+            self->handler_->OnTimeout(*self);
+        }
+    }
 };
 
 
@@ -372,6 +1092,10 @@ struct ConnectEvent {
 
 using QuicheConnectionMap = std::unordered_map<ConnectionId, std::shared_ptr<QuicheConnection>, ConnectionIdHash>;
 
+// Flushes connections with deficit round robin.  Each round a connection
+// earns QUIC_SEND_TURN_PACKETS full packets of credit per unit of weight and
+// sends until the credit is spent or it has nothing left, so one bulk
+// transfer cannot starve the other connections.
 class QuicheSender {
 public:
     QuicheSender(std::shared_ptr<QuicheSocket> qs);
@@ -381,6 +1105,10 @@ public:
     std::shared_ptr<QuicheConnection> Find(const ConnectionId& dcid);
     std::shared_ptr<QuicheConnection> Find(uint64_t connection_id);
 
+    // Share of egress for the connection relative to others.  Default 1.
+    // Returns false if the connection was not found
+    bool SetWeight(uint64_t connection_id, uint32_t weight);
+
 protected:
     std::mutex mutex_;
 
@@ -388,8 +1116,26 @@ protected:
     QuicheConnectionMap connections_;
     std::unordered_map<uint64_t, std::shared_ptr<QuicheConnection>> connections_by_id_;
 
+    struct ScheduledConnection {
+        std::shared_ptr<QuicheConnection> Connection;
+        uint32_t Weight = 1;
+
+        // Bytes of credit left over from the previous round.
+        // Negative if the last packet went past the credit
+        int64_t Deficit = 0;
+    };
+
+    // Connections in the order they were added
+    std::vector<ScheduledConnection> schedule_;
+
+    // Position in schedule_ that goes first on the next pass
+    size_t next_start_ = 0;
+
     std::shared_ptr<std::thread> send_thread_;
     std::atomic<bool> terminated_ = ATOMIC_VAR_INIT(false);
 
+    // FlightRecorder::SignalCount() when connections were last dumped
+    uint32_t flight_signals_ = 0;
+
     void Loop();
 };
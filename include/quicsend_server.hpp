@@ -12,10 +12,26 @@ struct QuicSendServerSettings {
     uint16_t Port;
     std::string KeyPath;
     std::string CertPath;
+
+    MailboxWaitPolicy WaitPolicy;
+
+    // Number of connection-affinity shards for Poll().  With more than one,
+    // several threads can call Poll() concurrently.  Events from the same
+    // connection are never processed by two threads at once and stay in order.
+    int DispatchShards = 1;
+
+    // Optional qlog tracing of sampled connections
+    QlogSettings Qlog;
+
+    // Recent events of each connection, dumped when one times out
+    FlightRecorderSettings FlightRecorder;
 };
 
 class QuicSendServer {
 public:
+    // Handler for QuicheRoleConnection and QuicheSocket
+    static constexpr bool IsServer = true;
+
     QuicSendServer(const QuicSendServerSettings& settings);
     ~QuicSendServer();
 
@@ -24,26 +40,69 @@ public:
     }
 
     // API calls
+    // These are safe to call concurrently from multiple Poll() threads
     void Close(uint64_t connection_id);
 
+    // Share of egress bandwidth for the connection relative to others when
+    // several are sending at once.  Default 1, up to QUIC_SEND_MAX_WEIGHT
+    void SetConnectionWeight(uint64_t connection_id, uint32_t weight);
+
+    // If priority is nullptr, the response follows the priority header of
+    // the request
     void Respond(
         uint64_t connection_id,
         int64_t request_id,
         int32_t status,
         const std::string& header_info,
-        BodyData body);
+        BodyData body,
+        const StreamPriority* priority = nullptr);
 
+    // Calls on_event(const QuicheMailbox::Event&) for each event
+    template<class Callback>
     void Poll(
-        OnDataCallback on_event,
-        int timeout_msec = 100);
+        Callback&& on_event,
+        int timeout_msec = 100)
+    {
+        mailbox_.Poll(on_event, timeout_msec);
+    }
+
+    MailboxMetrics GetMailboxMetrics() const {
+        return mailbox_.GetMetrics();
+    }
+
+    // Returns false if the connection was not found
+    bool GetStats(uint64_t connection_id, ConnectionStats& stats);
+
+    // Time from request headers to the first and last response byte.
+    // Returns false if the connection was not found
+    bool GetLatency(uint64_t connection_id, RequestLatencyStats& stats);
+
+    // Connection state and the most recent events, one per line.
+    // Returns false if the connection was not found
+    bool GetFlightRecorder(uint64_t connection_id, std::string& text);
+
+    // Same across all connections, by request path
+    std::vector<PathLatencyStats> GetPathLatency() const {
+        return latency_->GetStats();
+    }
 
 protected:
+    template<class> friend class QuicheRoleConnection;
+    friend class QuicheSocket;
+
     QuicSendServerSettings settings_;
 
     void OnDatagram(
         uint8_t* data,
         std::size_t bytes,
         const boost::asio::ip::udp::endpoint& peer_endpoint);
+    void OnConnect(
+        QuicheConnection& connection,
+        const boost::asio::ip::udp::endpoint& peer_endpoint);
+    void OnTimeout(QuicheConnection& connection);
+    void OnData(
+        QuicheConnection& connection,
+        const QuicheMailbox::Event& event);
 
     void SendVersionNegotiation(
         const ConnectionId& scid,
@@ -59,10 +118,20 @@ protected:
         const ConnectionId& odcid,
         const boost::asio::ip::udp::endpoint& peer_endpoint);
 
+    // Response headers built once and patched per response.
+    // The body headers come last so responses without a body can drop them
+    HeaderTemplate response_headers_;
+    int status_header_ = 0;
+    int info_header_ = 0;
+    int content_type_header_ = 0;
+    int content_length_header_ = 0;
+
     boost::asio::io_context io_context_;
 
     std::shared_ptr<QuicheSocket> qs_;
     std::shared_ptr<QuicheSender> sender_;
+    std::shared_ptr<QlogTracer> qlog_;
+    std::shared_ptr<PathLatencyTracker> latency_;
     QuicheMailbox mailbox_;
 
     std::shared_ptr<std::thread> loop_thread_;
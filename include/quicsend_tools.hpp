@@ -17,6 +17,67 @@
 //------------------------------------------------------------------------------
 // Logger
 
+// Levels below this are compiled out.  0 = DEBUG, 1 = INFO, 2 = WARN, 3 = ERROR.
+// Release builds set this to 1 from CMake
+#ifndef QUICSEND_LOG_MIN_LEVEL
+#define QUICSEND_LOG_MIN_LEVEL 0
+#endif
+
+// Longest formatted message.  Longer messages are truncated
+#define LOG_MESSAGE_MAX 480
+
+// Messages each thread can queue before new ones are dropped
+#define LOG_RING_SLOTS 256
+
+// Default messages per second allowed from one LOG_*() call site
+#define LOG_DEFAULT_RATE_LIMIT 20
+
+// How often the logger thread checks the rings when idle
+#define LOG_FLUSH_INTERVAL_MSEC 10
+
+// State kept by each LOG_*() call site for rate limiting
+class LogCallSite {
+public:
+    constexpr LogCallSite(const char* file, int line, int level)
+        : File(file)
+        , Line(line)
+        , Level(level)
+    {
+    }
+
+    // Returns false if the call site is over its rate limit for this second
+    bool Allow();
+
+    // Number of messages suppressed since the last report
+    uint32_t TakeSuppressed() {
+        return Suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Returns true if no message was allowed during the current second
+    bool IsQuiet(int64_t now_sec) const {
+        return WindowSec.load(std::memory_order_relaxed) != now_sec;
+    }
+
+    const char* const File;
+    const int Line;
+    const int Level;
+
+    // Call sites that have suppressed messages, linked through Next, so the
+    // logger thread can report counts for floods that stop.  Sites are
+    // static and never leave the list
+    static std::atomic<LogCallSite*> SuppressingSites;
+    LogCallSite* Next = nullptr;
+
+protected:
+    std::atomic<int64_t> WindowSec = ATOMIC_VAR_INIT(0);
+    std::atomic<uint32_t> WindowCount = ATOMIC_VAR_INIT(0);
+    std::atomic<uint32_t> Suppressed = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> Listed = ATOMIC_VAR_INIT(false);
+};
+
+// Each logging thread formats into a thread-local buffer and queues the
+// message on its own single-producer ring, so logging takes no locks and
+// does not allocate.  The logger thread drains the rings and writes output.
 class Logger {
 public:
     enum LogLevel { DEBUG, INFO, WARN, ERROR };
@@ -29,60 +90,67 @@ public:
     void SetLogLevel(LogLevel level);
     void SetCallback(std::function<void(LogLevel, const std::string&)> callback);
 
+    // Messages per second allowed from each call site.  0 disables the limit
+    static void SetRateLimit(uint32_t messages_per_second);
+    static uint32_t GetRateLimit() {
+        return RateLimit.load(std::memory_order_relaxed);
+    }
+
+    bool IsEnabled(LogLevel level) const {
+        return CurrentLogLevel.load(std::memory_order_relaxed) <= level;
+    }
+
+    // Logs each line of text as its own message, for multi-line reports that
+    // would be truncated at LOG_MESSAGE_MAX.  Not rate limited, and waits for
+    // the logger thread instead of dropping lines when the ring is full, so
+    // only call it from threads that may block
+    void LogLines(LogLevel level, const std::string& text);
+
+    struct LogRing;
+    struct LogFormatter;
+
     class LogStream {
     public:
-        LogStream(Logger& logger, LogLevel level, bool log_enabled = true)
-            : logger_(logger)
-            , level_(level)
-            , log_enabled_(log_enabled)
-        {
-        }
-        LogStream(const LogStream&& other)
-            : logger_(other.logger_)
-            , level_(other.level_)
-        {
-        }
-        ~LogStream() {
-            if (log_enabled_) {
-                logger_.Log(level_, std::move(ss_));
-            }
-        }
+        LogStream(LogLevel level, LogCallSite& site);
+        ~LogStream();
+
+        LogStream(const LogStream&) = delete;
+        LogStream& operator=(const LogStream&) = delete;
 
         template<typename T>
         LogStream& operator<<(const T& value) {
-            if (log_enabled_) {
-                ss_ << value;
-            }
+            *os_ << value;
             return *this;
         }
 
     private:
-        Logger& logger_;
         LogLevel level_;
-        bool log_enabled_ = false;
+        LogCallSite& site_;
 
-        std::ostringstream ss_;
+        // Thread-local formatter, or nullptr if this message is nested in
+        // another one on the same thread and uses fallback_ instead
+        LogFormatter* formatter_ = nullptr;
+        std::ostream* os_ = nullptr;
+        std::unique_ptr<std::ostringstream> fallback_;
     };
 
-    LogStream Debug() { return LogStream(*this, LogLevel::DEBUG, CurrentLogLevel <= LogLevel::DEBUG); }
-    LogStream Info() { return LogStream(*this, LogLevel::INFO, CurrentLogLevel <= LogLevel::INFO); }
-    LogStream Warn() { return LogStream(*this, LogLevel::WARN, CurrentLogLevel <= LogLevel::WARN); }
-    LogStream Error() { return LogStream(*this, LogLevel::ERROR, CurrentLogLevel <= LogLevel::ERROR); }
+    LogStream Debug(LogCallSite& site) { return LogStream(LogLevel::DEBUG, site); }
+    LogStream Info(LogCallSite& site) { return LogStream(LogLevel::INFO, site); }
+    LogStream Warn(LogCallSite& site) { return LogStream(LogLevel::WARN, site); }
+    LogStream Error(LogCallSite& site) { return LogStream(LogLevel::ERROR, site); }
 
     void Terminate();
 
 private:
     static std::unique_ptr<Logger> Instance;
     static std::once_flag InitInstanceFlag;
+    static std::atomic<uint32_t> RateLimit;
 
-    struct LogEntry {
-        LogLevel Level;
-        std::string Message;
-    };
-
-    std::vector<LogEntry> LogQueue;
-    std::mutex LogQueueMutex;
-    std::condition_variable LogQueueCV;
+    // Rings of all threads that have logged.  Only locked when a thread logs
+    // for the first time and by the logger thread
+    std::vector<std::shared_ptr<LogRing>> Rings;
+    std::mutex RingsMutex;
+    std::condition_variable LogCV;
 
     std::thread LoggerThread;
     std::atomic<LogLevel> CurrentLogLevel = ATOMIC_VAR_INIT(LogLevel::INFO);
@@ -90,18 +158,34 @@ private:
 
     std::atomic<bool> Terminated = ATOMIC_VAR_INIT(false);
 
-    std::vector<LogEntry> LogsToProcess;
+    std::string LineScratch;
+    std::vector<std::shared_ptr<LogRing>> DrainList;
+    int64_t LastSuppressedReportSec = 0;
+
+    // Queues a message on the calling thread's ring
+    void Log(LogLevel level, const char* message, size_t length);
+    LogRing* GetThreadRing();
 
-    void Log(LogLevel level, std::ostringstream&& message);
     void RunLogger();
-    void ProcessLogQueue();
+    bool DrainRings();
+    void ReportSuppressed();
+    void Write(LogLevel level, const std::string& message);
 };
 
-// Macros for logging
-#define LOG_DEBUG() Logger::getInstance().Debug()
-#define LOG_INFO() Logger::getInstance().Info()
-#define LOG_WARN() Logger::getInstance().Warn()
-#define LOG_ERROR() Logger::getInstance().Error()
+// Macros for logging.
+// Call sites below QUICSEND_LOG_MIN_LEVEL or the runtime log level do not
+// evaluate their arguments.  Each call site is rate limited separately, and
+// the next message it logs reports how many were suppressed
+#define QUICSEND_LOG_AT(level, method) \
+    if (Logger::level < QUICSEND_LOG_MIN_LEVEL) {} else \
+    if (!Logger::getInstance().IsEnabled(Logger::level)) {} else \
+    if (static LogCallSite log_call_site_(__FILE__, __LINE__, Logger::level); !log_call_site_.Allow()) {} else \
+        Logger::getInstance().method(log_call_site_)
+
+#define LOG_DEBUG() QUICSEND_LOG_AT(DEBUG, Debug)
+#define LOG_INFO() QUICSEND_LOG_AT(INFO, Info)
+#define LOG_WARN() QUICSEND_LOG_AT(WARN, Warn)
+#define LOG_ERROR() QUICSEND_LOG_AT(ERROR, Error)
 #define LOG_TERMINATE() Logger::getInstance().Terminate();
 
 void EnableQuicheDebugLogging();
@@ -112,8 +196,20 @@ void EnableQuicheDebugLogging();
 
 void JoinThread(std::shared_ptr<std::thread> th);
 
+// Monotonic clock, which is also the clock quiche uses for packet times
 int64_t GetNsec();
 
+// Hint to the CPU that we are in a spin-wait loop
+inline void CpuPause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
 struct CallbackScope {
     CallbackScope(std::function<void()> func) : func(func) {}
     ~CallbackScope() { func(); }
@@ -157,3 +253,43 @@ inline uint32_t read_uint32_le(const void* buffer) {
            (static_cast<uint32_t>(ptr[2]) << 16) |
            (static_cast<uint32_t>(ptr[3]) << 24);
 }
+
+inline void write_uint16_be(void* buffer, uint16_t value) {
+    uint8_t* ptr = static_cast<uint8_t*>(buffer);
+    ptr[0] = static_cast<uint8_t>(value >> 8);
+    ptr[1] = static_cast<uint8_t>(value);
+}
+
+inline uint16_t read_uint16_be(const void* buffer) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(buffer);
+    return (static_cast<uint16_t>(ptr[0]) << 8) |
+           static_cast<uint16_t>(ptr[1]);
+}
+
+inline void write_uint32_be(void* buffer, uint32_t value) {
+    uint8_t* ptr = static_cast<uint8_t*>(buffer);
+    ptr[0] = static_cast<uint8_t>(value >> 24);
+    ptr[1] = static_cast<uint8_t>(value >> 16);
+    ptr[2] = static_cast<uint8_t>(value >> 8);
+    ptr[3] = static_cast<uint8_t>(value);
+}
+
+inline uint32_t read_uint32_be(const void* buffer) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(buffer);
+    return (static_cast<uint32_t>(ptr[0]) << 24) |
+           (static_cast<uint32_t>(ptr[1]) << 16) |
+           (static_cast<uint32_t>(ptr[2]) << 8) |
+           static_cast<uint32_t>(ptr[3]);
+}
+
+inline void write_uint64_be(void* buffer, uint64_t value) {
+    uint8_t* ptr = static_cast<uint8_t*>(buffer);
+    write_uint32_be(ptr, static_cast<uint32_t>(value >> 32));
+    write_uint32_be(ptr + 4, static_cast<uint32_t>(value));
+}
+
+inline uint64_t read_uint64_be(const void* buffer) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(buffer);
+    return (static_cast<uint64_t>(read_uint32_be(ptr)) << 32) |
+           read_uint32_be(ptr + 4);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+
+//------------------------------------------------------------------------------
+// USDT Probes
+
+// Static tracepoints for bpftrace and perf, provider "quicsend".
+// Built in when CMake finds <sys/sdt.h> and QUICSEND_ENABLE_USDT is on.
+// An unattached probe is a nop, so the probes stay in release builds.
+// Otherwise the macros expand to nothing and arguments are not evaluated.
+//
+// Probes and arguments.  conn_id is QCSettings::AssignedId:
+//   packet_recv     (conn_id, bytes)
+//   packet_send     (conn_id, bytes)
+//   h3_event        (conn_id, stream_id, quiche_h3_event_type)
+//   stream_open     (conn_id, stream_id, local)  local = 1 for requests sent
+//   stream_finish   (conn_id, stream_id, body_bytes)
+//   request_blocked (conn_id, error)  SendRequest() is waiting on flow control
+//   request_sent    (conn_id, stream_id, blocked_usec)
+//   mailbox_post    (conn_id, event_type)
+//   mailbox_poll    (shard, event_count)
+//
+// Example:
+//   bpftrace -e 'usdt:./quicsend_library.so:quicsend:request_sent { @usec = hist(arg2); }'
+
+#if defined(QUICSEND_ENABLE_USDT)
+
+#include <sys/sdt.h>
+
+#define QS_TRACE0(name) DTRACE_PROBE(quicsend, name)
+#define QS_TRACE1(name, a) DTRACE_PROBE1(quicsend, name, a)
+#define QS_TRACE2(name, a, b) DTRACE_PROBE2(quicsend, name, a, b)
+#define QS_TRACE3(name, a, b, c) DTRACE_PROBE3(quicsend, name, a, b, c)
+
+#else // QUICSEND_ENABLE_USDT
+
+#define QS_TRACE0(name) do {} while (0)
+#define QS_TRACE1(name, a) do {} while (0)
+#define QS_TRACE2(name, a, b) do {} while (0)
+#define QS_TRACE3(name, a, b, c) do {} while (0)
+
+#endif // QUICSEND_ENABLE_USDT
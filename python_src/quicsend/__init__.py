@@ -1,3 +1,5 @@
 from .quicsend_wrapper import Request, Response
-from .quicsend_wrapper import Body, ToBody, FromBody
+from .quicsend_wrapper import Body, ToBody, ToBodyList, FromBody
+from .quicsend_wrapper import CONTENT_TYPE_BYTES, CONTENT_TYPE_TEXT, CONTENT_TYPE_MSGPACK, CONTENT_TYPE_TENSOR
 from .quicsend_wrapper import Client, Server
+from .quicsend_wrapper import metrics_text, start_metrics_server, stop_metrics_server
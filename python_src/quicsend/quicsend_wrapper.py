@@ -2,8 +2,7 @@ import ctypes
 import os
 import site
 from enum import Enum
-from typing import Any, Optional
-import msgpack
+from typing import Any, Optional, Sequence, Union
 
 # Load the shared library (assuming it's named 'quicsend_library.so')
 so_file_name = "quicsend_library.so"
@@ -19,6 +18,9 @@ if not lib_path:
 
 lib = ctypes.CDLL(lib_path)
 
+# Functions that work on Python objects must keep the GIL held when called
+lib_py = ctypes.PyDLL(lib_path)
+
 # These must be kept in sync with quicsend_python.h
 class Body(ctypes.Structure):
     _pack_ = 4
@@ -55,6 +57,13 @@ class PythonQuicSendClientSettings(ctypes.Structure):
         ("Host", ctypes.c_char_p),
         ("CertPath", ctypes.c_char_p),
         ("Port", ctypes.c_uint16),
+        ("MailboxSpinUsec", ctypes.c_int32),
+        ("QlogDir", ctypes.c_char_p),
+        ("QlogSampleRate", ctypes.c_int32),
+        ("QlogMaxBytes", ctypes.c_uint64),
+        ("FlightEvents", ctypes.c_int32),
+        ("FlightDumpDir", ctypes.c_char_p),
+        ("FlightDumpOnSignal", ctypes.c_int32),
     ]
 
 class PythonQuicSendServerSettings(ctypes.Structure):
@@ -64,8 +73,120 @@ class PythonQuicSendServerSettings(ctypes.Structure):
         ("CertPath", ctypes.c_char_p),
         ("KeyPath", ctypes.c_char_p),
         ("Port", ctypes.c_uint16),
+        ("MailboxSpinUsec", ctypes.c_int32),
+        ("DispatchShards", ctypes.c_int32),
+        ("QlogDir", ctypes.c_char_p),
+        ("QlogSampleRate", ctypes.c_int32),
+        ("QlogMaxBytes", ctypes.c_uint64),
+        ("FlightEvents", ctypes.c_int32),
+        ("FlightDumpDir", ctypes.c_char_p),
+        ("FlightDumpOnSignal", ctypes.c_int32),
+    ]
+
+class MailboxMetrics(ctypes.Structure):
+    _pack_ = 4
+    _fields_ = [
+        ("Polls", ctypes.c_uint64),
+        ("Events", ctypes.c_uint64),
+        ("Immediate", ctypes.c_uint64),
+        ("SpinHits", ctypes.c_uint64),
+        ("SpinMisses", ctypes.c_uint64),
+        ("Parks", ctypes.c_uint64),
+        ("SpinBudgetUsec", ctypes.c_int64),
+        ("InterArrivalUsec", ctypes.c_int64),
+    ]
+
+    def to_dict(self):
+        return {name: getattr(self, name) for name, _ in self._fields_}
+
+class ConnectionStats(ctypes.Structure):
+    _pack_ = 4
+    _fields_ = [
+        ("ConnectionId", ctypes.c_uint64),
+        ("PacketsSent", ctypes.c_uint64),
+        ("PacketsReceived", ctypes.c_uint64),
+        ("PacketsLost", ctypes.c_uint64),
+        ("PacketsRetransmitted", ctypes.c_uint64),
+        ("BytesSent", ctypes.c_uint64),
+        ("BytesReceived", ctypes.c_uint64),
+        ("BytesAcked", ctypes.c_uint64),
+        ("BytesLost", ctypes.c_uint64),
+        ("BytesRetransmitted", ctypes.c_uint64),
+        ("BytesInFlight", ctypes.c_uint64),
+        ("SmoothedRttUsec", ctypes.c_uint64),
+        ("CongestionWindow", ctypes.c_uint64),
+        ("DeliveryRate", ctypes.c_uint64),
+        ("PathMtu", ctypes.c_uint64),
+        ("PacingRate", ctypes.c_uint64),
+        ("QueuedBytes", ctypes.c_uint64),
+        ("StreamCount", ctypes.c_int32),
+    ]
+
+    def to_dict(self):
+        return {name: getattr(self, name) for name, _ in self._fields_}
+
+class StreamStats(ctypes.Structure):
+    _pack_ = 4
+    _fields_ = [
+        ("StreamId", ctypes.c_uint64),
+        ("QueuedBytes", ctypes.c_uint64),
+        ("WrittenBytes", ctypes.c_uint64),
+        ("Urgency", ctypes.c_int32),
+    ]
+
+    def to_dict(self):
+        return {name: getattr(self, name) for name, _ in self._fields_}
+
+# Streams reported per stats() call
+MAX_STATS_STREAMS = 256
+
+def _stats_dict(fetch) -> Optional[dict]:
+    stats = ConnectionStats()
+    streams = (StreamStats * MAX_STATS_STREAMS)()
+    count = fetch(ctypes.byref(stats), streams, MAX_STATS_STREAMS)
+    if count < 0:
+        return None
+    result = stats.to_dict()
+    result["Streams"] = [streams[i].to_dict() for i in range(count)]
+    return result
+
+class LatencyStats(ctypes.Structure):
+    _pack_ = 4
+    _fields_ = [
+        ("Count", ctypes.c_uint64),
+        ("MeanUsec", ctypes.c_uint64),
+        ("P50Usec", ctypes.c_uint64),
+        ("P90Usec", ctypes.c_uint64),
+        ("P99Usec", ctypes.c_uint64),
+        ("P999Usec", ctypes.c_uint64),
+        ("MaxUsec", ctypes.c_uint64),
+    ]
+
+    def to_dict(self):
+        return {name: getattr(self, name) for name, _ in self._fields_}
+
+class PathLatency(ctypes.Structure):
+    _pack_ = 4
+    _fields_ = [
+        ("Path", ctypes.c_char * 128),
+        ("FirstByte", LatencyStats),
+        ("LastByte", LatencyStats),
     ]
 
+# Paths tracked per client or server, plus the overflow path "*"
+MAX_LATENCY_PATHS = 257
+
+def _path_latency_dict(fetch) -> dict:
+    paths = (PathLatency * MAX_LATENCY_PATHS)()
+    count = min(fetch(paths, MAX_LATENCY_PATHS), MAX_LATENCY_PATHS)
+    return {
+        paths[i].Path.decode(errors="replace"): {
+            "FirstByte": paths[i].FirstByte.to_dict(),
+            "LastByte": paths[i].LastByte.to_dict(),
+        }
+        for i in range(count)
+    }
+
 # Define callback function types
 CONNECT_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.c_uint64, ctypes.c_char_p)
 TIMEOUT_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.c_uint64)
@@ -79,12 +200,30 @@ lib.quicsend_client_create.restype = ctypes.c_void_p
 lib.quicsend_client_destroy.argtypes = [ctypes.c_void_p]
 lib.quicsend_client_destroy.restype = None
 
-lib.quicsend_client_request.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, Body]
+lib.quicsend_client_request.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, Body, ctypes.c_int32, ctypes.c_int32]
 lib.quicsend_client_request.restype = ctypes.c_int64
 
+lib.quicsend_client_update_priority.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_int32, ctypes.c_int32]
+lib.quicsend_client_update_priority.restype = ctypes.c_int32
+
 lib.quicsend_client_poll.argtypes = [ctypes.c_void_p, CONNECT_CALLBACK, TIMEOUT_CALLBACK, RESPONSE_CALLBACK, ctypes.c_int32]
 lib.quicsend_client_poll.restype = ctypes.c_int32
 
+lib.quicsend_client_mailbox_metrics.argtypes = [ctypes.c_void_p, ctypes.POINTER(MailboxMetrics)]
+lib.quicsend_client_mailbox_metrics.restype = None
+
+lib.quicsend_client_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ConnectionStats), ctypes.POINTER(StreamStats), ctypes.c_int32]
+lib.quicsend_client_stats.restype = ctypes.c_int32
+
+lib.quicsend_client_latency.argtypes = [ctypes.c_void_p, ctypes.POINTER(LatencyStats), ctypes.POINTER(LatencyStats)]
+lib.quicsend_client_latency.restype = None
+
+lib.quicsend_client_path_latency.argtypes = [ctypes.c_void_p, ctypes.POINTER(PathLatency), ctypes.c_int32]
+lib.quicsend_client_path_latency.restype = ctypes.c_int32
+
+lib.quicsend_client_flight_recorder.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int32]
+lib.quicsend_client_flight_recorder.restype = ctypes.c_int32
+
 lib.quicsend_server_create.argtypes = [ctypes.POINTER(PythonQuicSendServerSettings)]
 lib.quicsend_server_create.restype = ctypes.c_void_p
 
@@ -94,55 +233,268 @@ lib.quicsend_server_destroy.restype = None
 lib.quicsend_server_poll.argtypes = [ctypes.c_void_p, CONNECT_CALLBACK, TIMEOUT_CALLBACK, REQUEST_CALLBACK, ctypes.c_int32]
 lib.quicsend_server_poll.restype = ctypes.c_int32
 
-lib.quicsend_server_respond.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_int64, ctypes.c_int32, ctypes.c_char_p, Body]
-lib.quicsend_server_respond.restype = None
+lib.quicsend_server_respond.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_int64, ctypes.c_int32, ctypes.c_char_p, Body, ctypes.c_int32, ctypes.c_int32]
+lib.quicsend_server_respond.restype = ctypes.c_int32
 
 lib.quicsend_server_close.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
 lib.quicsend_server_close.restype = None
 
+lib.quicsend_server_set_connection_weight.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint32]
+lib.quicsend_server_set_connection_weight.restype = None
+
+lib.quicsend_server_mailbox_metrics.argtypes = [ctypes.c_void_p, ctypes.POINTER(MailboxMetrics)]
+lib.quicsend_server_mailbox_metrics.restype = None
+
+lib.quicsend_server_stats.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.POINTER(ConnectionStats), ctypes.POINTER(StreamStats), ctypes.c_int32]
+lib.quicsend_server_stats.restype = ctypes.c_int32
+
+lib.quicsend_server_latency.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.POINTER(LatencyStats), ctypes.POINTER(LatencyStats)]
+lib.quicsend_server_latency.restype = ctypes.c_int32
+
+lib.quicsend_server_path_latency.argtypes = [ctypes.c_void_p, ctypes.POINTER(PathLatency), ctypes.c_int32]
+lib.quicsend_server_path_latency.restype = ctypes.c_int32
+
+lib.quicsend_server_flight_recorder.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_char_p, ctypes.c_int32]
+lib.quicsend_server_flight_recorder.restype = ctypes.c_int32
+
+lib.quicsend_metrics_prometheus.argtypes = [ctypes.c_char_p, ctypes.c_int32]
+lib.quicsend_metrics_prometheus.restype = ctypes.c_int32
+
+lib.quicsend_metrics_start_http.argtypes = [ctypes.c_uint16]
+lib.quicsend_metrics_start_http.restype = ctypes.c_int32
+
+lib.quicsend_metrics_stop_http.argtypes = []
+lib.quicsend_metrics_stop_http.restype = None
+
+lib_py.quicsend_msgpack_pack.argtypes = [ctypes.py_object]
+lib_py.quicsend_msgpack_pack.restype = ctypes.py_object
+
+lib_py.quicsend_msgpack_unpack.argtypes = [ctypes.py_object]
+lib_py.quicsend_msgpack_unpack.restype = ctypes.py_object
+
+# Content types used for bodies produced by ToBody()
+CONTENT_TYPE_BYTES = b"application/octet-stream"
+CONTENT_TYPE_TEXT = b"text/plain"
+CONTENT_TYPE_MSGPACK = b"application/msgpack"
+CONTENT_TYPE_TENSOR = b"application/x-quicsend-tensor"
+
+def _import_numpy():
+    try:
+        import numpy
+    except ImportError:
+        raise TypeError("Tensor bodies require numpy to be installed")
+    return numpy
+
+def _is_tensor(data: Any) -> bool:
+    if hasattr(data, "__dlpack__"):
+        return True
+    try:
+        memoryview(data).release()
+        return True
+    except TypeError:
+        return False
+
+def _contiguous_strides(shape, itemsize: int, fortran: bool):
+    strides = []
+    stride = itemsize
+    for d in (shape if fortran else reversed(shape)):
+        strides.append(stride)
+        stride *= max(d, 1)
+    return tuple(strides if fortran else reversed(strides))
+
+def _tensor_content_type(array) -> bytes:
+    # Tensor metadata rides in the content-type parameters, so the body itself
+    # is the raw element buffer.  Strides are in bytes and allow Fortran-order
+    # tensors to be sent without a copy.  They are recomputed rather than taken
+    # from the array, which may report any stride for dimensions of size 1
+    fortran = not array.flags.c_contiguous
+    shape = ",".join(str(d) for d in array.shape)
+    strides = ",".join(str(s) for s in _contiguous_strides(array.shape, array.itemsize, fortran))
+    return f"{CONTENT_TYPE_TENSOR.decode()}; dtype={array.dtype.str}; shape={shape}; strides={strides}".encode()
+
+def _to_tensor_array(data: Any):
+    np = _import_numpy()
+
+    if hasattr(data, "__dlpack__") and not isinstance(data, np.ndarray):
+        # Zero-copy for CPU tensors (torch, jax, cupy host arrays, ...)
+        array = np.from_dlpack(data)
+    else:
+        array = np.asarray(data)
+
+    if not (array.flags.c_contiguous or array.flags.f_contiguous):
+        # Arbitrary strided views cannot be sent as one buffer
+        array = np.ascontiguousarray(array)
+    return array
+
+def _parse_tensor_content_type(content_type: bytes):
+    params = {}
+    for part in content_type.decode().split(";")[1:]:
+        key, _, value = part.strip().partition("=")
+        params[key] = value
+
+    def dims(value):
+        return tuple(int(d) for d in value.split(",") if d)
+
+    return params["dtype"], dims(params.get("shape", "")), dims(params.get("strides", ""))
+
+def _tensor_from_buffer(data, content_type: bytes):
+    # The metadata comes from the peer, so it must describe exactly the bytes
+    # received before any view is built over them
+    np = _import_numpy()
+    try:
+        dtype_str, shape, strides = _parse_tensor_content_type(content_type)
+        dtype = np.dtype(dtype_str)
+    except (KeyError, ValueError, TypeError):
+        raise ValueError("FromBody: Invalid tensor metadata")
+
+    if dtype.hasobject or dtype.kind == "V" or dtype.itemsize == 0:
+        raise ValueError(f"FromBody: Unsupported tensor dtype {dtype_str}")
+    if any(d < 0 for d in shape):
+        raise ValueError("FromBody: Negative tensor dimension")
+
+    count = 1
+    for d in shape:
+        count *= d
+    if count * dtype.itemsize != len(data):
+        raise ValueError("FromBody: Tensor shape does not match body length")
+
+    if not strides or strides == _contiguous_strides(shape, dtype.itemsize, False):
+        order = "C"
+    elif strides == _contiguous_strides(shape, dtype.itemsize, True):
+        order = "F"
+    else:
+        raise ValueError("FromBody: Tensor strides are not contiguous")
+
+    return np.frombuffer(data, dtype=dtype).reshape(shape, order=order)
+
 def ToBody(data: Any) -> Body:
     body = Body()
     if isinstance(data, bytes):
-        body.ContentType = b"application/octet-stream"
+        body.ContentType = CONTENT_TYPE_BYTES
         body.datab_ = data
     elif isinstance(data, str):
-        body.ContentType = b"text/plain"
+        body.ContentType = CONTENT_TYPE_TEXT
         body.datab_ = data.encode()
-    elif isinstance(data, (dict, list, int, float, bool, tuple, None)):
-        body.ContentType = b"application/msgpack"
-        body.datab_ = msgpack.packb(data, use_bin_type=False) 
+    elif isinstance(data, (dict, list, int, float, bool, tuple, type(None))):
+        body.ContentType = CONTENT_TYPE_MSGPACK
+        # Large binary fields come back as separate zero-copy parts
+        body.datab_ = lib_py.quicsend_msgpack_pack(data)
+        if isinstance(body.datab_, tuple):
+            body.Data = body.datab_
+            body.Length = sum(memoryview(part).nbytes for part in body.datab_)
+            return body
+    elif _is_tensor(data):
+        array = _to_tensor_array(data)
+        body.ContentType = _tensor_content_type(array)
+        # Keep the tensor alive while the body is referenced.
+        # The flat byte view aliases the tensor memory in either memory order.
+        body.tensor_ = array
+        body.datab_ = array.reshape(-1, order="A").view(_import_numpy().uint8)
     else:
         raise TypeError("ToBody: Unexpected data type")
     body.Data = body.datab_
     body.Length = len(body.datab_)
     return body
 
-def FromBody(body: Body) -> Any:
+def ToBodyList(parts: Sequence[Any], content_type: bytes = CONTENT_TYPE_BYTES) -> Body:
+    """
+    Build a scatter-gather body from a list of buffer-protocol objects.
+    The parts are sent back to back without being concatenated first.
+    """
+    body = Body()
+    body.ContentType = content_type
+    body.datab_ = tuple(parts)
+    body.Data = body.datab_
+    body.Length = sum(memoryview(part).nbytes for part in body.datab_)
+    return body
+
+def FromBody(body: Body, tensor_format: str = "numpy") -> Any:
+    """
+    Decode a received body.
+
+    Bytes and tensor results, and binary fields inside msgpack bodies, are
+    zero-copy views of the received buffer, which is only valid until the
+    poll callback returns.
+    Pass tensor_format="dlpack" to receive tensors as DLPack capsules.
+    """
     data = body.Data
+    content_type = body.ContentType or b""
+
+    if content_type.startswith(CONTENT_TYPE_TENSOR):
+        # Empty tensors arrive without a buffer but still have a shape
+        array = _tensor_from_buffer(data if data is not None else b"", content_type)
+        if tensor_format == "dlpack":
+            return array.__dlpack__()
+        return array
 
     if data is None or body.Length <= 0:
         return None
 
-    if body.ContentType == b"application/msgpack":
-        return msgpack.unpackb(data.tobytes(), raw=False)
-    elif body.ContentType == b"application/octet-stream":
+    if content_type == CONTENT_TYPE_MSGPACK:
+        return lib_py.quicsend_msgpack_unpack(data)
+    elif content_type == CONTENT_TYPE_BYTES:
         return data # MemoryView object for zero-copy
-    elif body.ContentType == b"text/plain":
+    elif content_type == CONTENT_TYPE_TEXT:
         return data.tobytes().decode()
     else:
         raise TypeError("FromBody:Unexpected content type")
 
+def _read_text(fill, size: int = 16384) -> Optional[str]:
+    # Calls fill(buffer, size) with a larger buffer until the text fits.
+    # None if fill returns -1
+    while True:
+        buffer = ctypes.create_string_buffer(size)
+        length = fill(buffer, size)
+        if length < 0:
+            return None
+        if length < size:
+            return buffer.value.decode()
+        size = length + 1
+
+def metrics_text() -> str:
+    """
+    Process-wide metrics in Prometheus text format.
+    """
+    return _read_text(lib.quicsend_metrics_prometheus)
+
+def start_metrics_server(port: int) -> bool:
+    # Serves metrics_text() over HTTP on 127.0.0.1:port for Prometheus to scrape
+    return lib.quicsend_metrics_start_http(port) != 0
+
+def stop_metrics_server():
+    lib.quicsend_metrics_stop_http()
+
 class Client:
     def __init__(self,
                  auth_token: str,
                  host: str,
                  port: int,
-                 cert_path: str):
+                 cert_path: str,
+                 mailbox_spin_usec: int = 0,
+                 qlog_dir: Optional[str] = None,
+                 qlog_max_bytes: int = 0,
+                 flight_events: int = 0,
+                 flight_dump_dir: Optional[str] = None,
+                 flight_dump_on_signal: bool = False):
+        # mailbox_spin_usec > 0 makes poll() spin up to that long before
+        # sleeping, trading CPU for lower response latency.
+        # qlog_dir writes a quiche qlog trace of the connection there.
+        # The flight recorder keeps the last flight_events events (0 = default
+        # of 512, < 0 = off) and dumps them to flight_dump_dir, or the log,
+        # when the connection times out with requests or responses in flight,
+        # or on SIGUSR2 with flight_dump_on_signal
         settings = PythonQuicSendClientSettings(
             AuthToken=auth_token.encode(),
             Host=host.encode(),
             Port=port,
-            CertPath=cert_path.encode()
+            CertPath=cert_path.encode(),
+            MailboxSpinUsec=mailbox_spin_usec,
+            QlogDir=qlog_dir.encode() if qlog_dir else None,
+            QlogSampleRate=1,
+            QlogMaxBytes=qlog_max_bytes,
+            FlightEvents=flight_events,
+            FlightDumpDir=flight_dump_dir.encode() if flight_dump_dir else None,
+            FlightDumpOnSignal=1 if flight_dump_on_signal else 0
         )
         self.client = lib.quicsend_client_create(ctypes.byref(settings))
         if not self.client:
@@ -159,7 +511,13 @@ class Client:
     def request(self,
                 path: str,
                 header_info: Optional[str] = None,
-                body: Optional[Body] = Body()) -> int:
+                body: Optional[Union[Body, Sequence[Any]]] = Body(),
+                urgency: int = 3,
+                incremental: bool = False) -> int:
+        # urgency is 0 (most urgent) to 7.  Lower urgency requests and their
+        # responses overtake bulk transfers queued on the same connection
+        if isinstance(body, (list, tuple)):
+            body = ToBodyList(body)
         path_encoded = path.encode()
         header_info_encoded = header_info.encode() if header_info else None
 
@@ -167,7 +525,21 @@ class Client:
             self.client,
             path_encoded,
             header_info_encoded,
-            body)
+            body,
+            urgency,
+            1 if incremental else 0)
+
+    def update_priority(self,
+                        request_id: int,
+                        urgency: int,
+                        incremental: bool = False) -> bool:
+        # Reprioritizes a request that is still in flight: its queued body
+        # here and the server's response.  False if the request is done
+        return lib.quicsend_client_update_priority(
+            self.client,
+            request_id,
+            urgency,
+            1 if incremental else 0) != 0
 
     def poll(self, on_connect, on_timeout, on_response, timeout_msec):
         def connect_callback(connection_id, peer_endpoint):
@@ -185,17 +557,66 @@ class Client:
 
         return lib.quicsend_client_poll(self.client, connect_cb, timeout_cb, response_cb, timeout_msec)
 
+    def mailbox_metrics(self) -> dict:
+        metrics = MailboxMetrics()
+        lib.quicsend_client_mailbox_metrics(self.client, ctypes.byref(metrics))
+        return metrics.to_dict()
+
+    def stats(self) -> dict:
+        # Transport stats for the connection: RTT, cwnd, loss, delivery rate,
+        # and bytes queued per stream
+        return _stats_dict(lambda stats, streams, max_streams:
+            lib.quicsend_client_stats(self.client, stats, streams, max_streams))
+
+    def latency(self) -> dict:
+        # Percentiles of time from request() to the first and last response byte
+        first_byte = LatencyStats()
+        last_byte = LatencyStats()
+        lib.quicsend_client_latency(self.client, ctypes.byref(first_byte), ctypes.byref(last_byte))
+        return {"FirstByte": first_byte.to_dict(), "LastByte": last_byte.to_dict()}
+
+    def path_latency(self) -> dict:
+        # latency() broken down by request path
+        return _path_latency_dict(lambda paths, max_paths:
+            lib.quicsend_client_path_latency(self.client, paths, max_paths))
+
+    def flight_recorder(self) -> str:
+        # Connection state and its most recent events, for debugging stalls
+        return _read_text(lambda buffer, size:
+            lib.quicsend_client_flight_recorder(self.client, buffer, size))
+
 class Server:
     def __init__(self,
                  auth_token: str,
                  port: int,
                  cert_path: str,
-                 key_path: str):
+                 key_path: str,
+                 mailbox_spin_usec: int = 0,
+                 dispatch_shards: int = 1,
+                 qlog_dir: Optional[str] = None,
+                 qlog_sample_rate: int = 1,
+                 qlog_max_bytes: int = 0,
+                 flight_events: int = 0,
+                 flight_dump_dir: Optional[str] = None,
+                 flight_dump_on_signal: bool = False):
+        # dispatch_shards > 1 lets several threads call poll() at once.
+        # Requests from one connection are still handled in order by one thread at a time.
+        # qlog_dir writes quiche qlog traces for 1 in qlog_sample_rate connections,
+        # deleting the oldest traces once they total more than qlog_max_bytes.
+        # flight_* are the same as for Client, per connection
         settings = PythonQuicSendServerSettings(
             AuthToken=auth_token.encode(),
             Port=port,
             CertPath=cert_path.encode(),
-            KeyPath=key_path.encode()
+            KeyPath=key_path.encode(),
+            MailboxSpinUsec=mailbox_spin_usec,
+            DispatchShards=dispatch_shards,
+            QlogDir=qlog_dir.encode() if qlog_dir else None,
+            QlogSampleRate=qlog_sample_rate,
+            QlogMaxBytes=qlog_max_bytes,
+            FlightEvents=flight_events,
+            FlightDumpDir=flight_dump_dir.encode() if flight_dump_dir else None,
+            FlightDumpOnSignal=1 if flight_dump_on_signal else 0
         )
         self.server = lib.quicsend_server_create(ctypes.byref(settings))
         if not self.server:
@@ -230,16 +651,57 @@ class Server:
                 request_id: int,
                 status: int,
                 header_info: Optional[str] = None,
-                body: Optional[Body] = Body()):
+                body: Optional[Union[Body, Sequence[Any]]] = Body(),
+                urgency: Optional[int] = None,
+                incremental: bool = False):
+        # By default the response uses the priority the client requested
+        if isinstance(body, (list, tuple)):
+            body = ToBodyList(body)
         header_info_encoded = header_info.encode() if header_info else None
 
-        lib.quicsend_server_respond(
-            self.server,
-            connection_id,
-            request_id,
-            status,
-            header_info_encoded,
-            body)
+        if not lib.quicsend_server_respond(
+                self.server,
+                connection_id,
+                request_id,
+                status,
+                header_info_encoded,
+                body,
+                -1 if urgency is None else urgency,
+                1 if incremental else 0):
+            raise TypeError("respond: Body parts must support the buffer protocol")
 
     def close(self, connection_id):
         lib.quicsend_server_close(self.server, connection_id)
+
+    def set_connection_weight(self, connection_id, weight: int):
+        # Share of egress for this connection relative to others.  Default 1
+        lib.quicsend_server_set_connection_weight(self.server, connection_id, weight)
+
+    def mailbox_metrics(self) -> dict:
+        metrics = MailboxMetrics()
+        lib.quicsend_server_mailbox_metrics(self.server, ctypes.byref(metrics))
+        return metrics.to_dict()
+
+    def stats(self, connection_id) -> Optional[dict]:
+        # Transport stats for the connection, or None if it is gone
+        return _stats_dict(lambda stats, streams, max_streams:
+            lib.quicsend_server_stats(self.server, connection_id, stats, streams, max_streams))
+
+    def latency(self, connection_id) -> Optional[dict]:
+        # Percentiles of time from request headers to the first and last
+        # response byte, or None if the connection is gone
+        first_byte = LatencyStats()
+        last_byte = LatencyStats()
+        if not lib.quicsend_server_latency(self.server, connection_id, ctypes.byref(first_byte), ctypes.byref(last_byte)):
+            return None
+        return {"FirstByte": first_byte.to_dict(), "LastByte": last_byte.to_dict()}
+
+    def path_latency(self) -> dict:
+        # Latency across all connections by request path
+        return _path_latency_dict(lambda paths, max_paths:
+            lib.quicsend_server_path_latency(self.server, paths, max_paths))
+
+    def flight_recorder(self, connection_id) -> Optional[str]:
+        # Connection state and its most recent events, or None if it is gone
+        return _read_text(lambda buffer, size:
+            lib.quicsend_server_flight_recorder(self.server, connection_id, buffer, size))
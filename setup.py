@@ -40,6 +40,7 @@ class BuildPackage(build_ext):
         extdir = os.path.abspath(os.path.dirname(self.get_ext_fullpath(ext.name)))
         cmake_args = [
             f"-DCMAKE_LIBRARY_OUTPUT_DIRECTORY={extdir}",
+            "-DQUICSEND_BUILD_BENCH=OFF",
         ]
         build_args = ["--config", "Release"]
 
@@ -78,5 +79,5 @@ setup(
     long_description_content_type='text/markdown',
     package_dir={'': 'python_src'},
     packages=find_namespace_packages(where='python_src'),
-    install_requires=['msgpack']
+    extras_require={'tensor': ['numpy']}
 )
@@ -0,0 +1,686 @@
+#include <quicsend_alloc.hpp>
+#include <quicsend_tools.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#include <sys/mman.h>
+
+
+//------------------------------------------------------------------------------
+// Large Regions
+
+static void* map_aligned_region(size_t bytes)
+{
+    // Over-allocate so the region can be trimmed to a huge page boundary,
+    // otherwise transparent huge pages can only back the aligned middle part
+    const size_t padded = bytes + SEND_BUFFER_SLAB_BYTES;
+
+    void* raw = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned = (start + SEND_BUFFER_SLAB_BYTES - 1) & ~static_cast<uintptr_t>(SEND_BUFFER_SLAB_BYTES - 1);
+    const size_t head = aligned - start;
+    const size_t tail = padded - head - bytes;
+
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+    }
+
+    return reinterpret_cast<void*>(aligned);
+}
+
+void* AllocateLargeRegion(size_t bytes, bool* huge_pages)
+{
+    if (huge_pages) {
+        *huge_pages = false;
+    }
+
+#ifdef MAP_HUGETLB
+    // Only succeeds if the administrator reserved huge pages
+    if (bytes % SEND_BUFFER_SLAB_BYTES == 0) {
+        void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region != MAP_FAILED) {
+            if (huge_pages) {
+                *huge_pages = true;
+            }
+            return region;
+        }
+    }
+#endif
+
+    void* region = map_aligned_region(bytes);
+    if (!region) {
+        return nullptr;
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise(region, bytes, MADV_HUGEPAGE);
+#endif
+
+    return region;
+}
+
+void FreeLargeRegion(void* region, size_t bytes, bool huge_pages)
+{
+    (void)huge_pages;
+    if (region) {
+        munmap(region, bytes);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// SendBufferPool
+
+namespace {
+
+// Round the stride up to a cache line so reference counts of neighbouring
+// buffers released on different threads do not share a line
+static const size_t kSendBufferStride = (sizeof(SendBuffer) + 63) & ~static_cast<size_t>(63);
+static const size_t kBuffersPerSlab = SEND_BUFFER_SLAB_BYTES / kSendBufferStride;
+
+struct ThreadCache;
+
+class SendBufferPool {
+public:
+    static SendBufferPool& Instance() {
+        // Leaked so that buffers released during static destruction are safe
+        static SendBufferPool* pool = new SendBufferPool;
+        return *pool;
+    }
+
+    // Slow paths, called when the thread cache is empty or full
+    SendBuffer* Refill(ThreadCache& cache);
+    void Spill(ThreadCache& cache, int count);
+
+    SendBuffer* AllocateOverflow();
+    void FreeOverflow(SendBuffer* buffer);
+
+    // Used when the calling thread's cache has already been destroyed
+    SendBuffer* AllocateFromDepot();
+    void FreeToDepot(SendBuffer* buffer);
+
+    // Counts buffers handed out, for Outstanding and HighWater
+    void OnAllocated();
+    void OnFreed() {
+        outstanding_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void Register(ThreadCache* cache);
+    void Unregister(ThreadCache* cache);
+
+    void SetLimit(uint64_t max_buffers) {
+        limit_ = max_buffers;
+    }
+    SendAllocatorStats GetStats();
+
+protected:
+    std::mutex mutex_;
+
+    // Shared free list that thread caches exchange batches with
+    SendBuffer* depot_ = nullptr;
+    uint64_t depot_count_ = 0;
+
+    struct Slab {
+        void* Region = nullptr;
+        bool HugePages = false;
+    };
+    std::vector<Slab> slabs_;
+    uint64_t huge_page_slabs_ = 0;
+
+    std::vector<ThreadCache*> caches_;
+
+    // Counters folded in from exited threads
+    uint64_t retired_hits_ = 0;
+
+    std::atomic<uint64_t> limit_ = ATOMIC_VAR_INIT(SEND_BUFFER_DEFAULT_LIMIT);
+    std::atomic<uint64_t> pooled_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> misses_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> overflows_ = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> high_water_ = ATOMIC_VAR_INIT(0);
+
+    // One shared counter is the only exact way to find the peak, and costs a
+    // relaxed atomic add per buffer on top of the thread cache
+    std::atomic<uint64_t> outstanding_ = ATOMIC_VAR_INIT(0);
+
+    // Called from function with lock held
+    bool CarveSlab();
+};
+
+// Per-thread free list.  Only the owning thread touches the list, and the
+// counter is only written by the owner so it needs no atomic increments
+struct ThreadCache {
+    SendBuffer* Head = nullptr;
+    int Count = 0;
+
+    std::atomic<uint64_t> Hits = ATOMIC_VAR_INIT(0);
+
+    ThreadCache();
+    ~ThreadCache();
+
+    SendBuffer* Pop() {
+        SendBuffer* buffer = Head;
+        if (buffer) {
+            Head = buffer->NextFree;
+            buffer->NextFree = nullptr;
+            Count--;
+        }
+        return buffer;
+    }
+
+    void Push(SendBuffer* buffer) {
+        buffer->NextFree = Head;
+        Head = buffer;
+        Count++;
+    }
+
+    static void Bump(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// Stays readable after the thread cache is destroyed during thread exit
+static thread_local bool tls_cache_destroyed = false;
+static thread_local ThreadCache tls_cache;
+
+ThreadCache::ThreadCache() {
+    SendBufferPool::Instance().Register(this);
+}
+
+ThreadCache::~ThreadCache() {
+    tls_cache_destroyed = true;
+    SendBufferPool::Instance().Unregister(this);
+}
+
+void SendBufferPool::Register(ThreadCache* cache) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    caches_.push_back(cache);
+}
+
+void SendBufferPool::Unregister(ThreadCache* cache) {
+    Spill(*cache, cache->Count);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    retired_hits_ += cache->Hits;
+    caches_.erase(std::remove(caches_.begin(), caches_.end(), cache), caches_.end());
+}
+
+bool SendBufferPool::CarveSlab() {
+    // Called from function with lock held
+
+    const uint64_t limit = limit_;
+    const uint64_t pooled = pooled_;
+    if (pooled >= limit) {
+        return false;
+    }
+    const uint64_t count = std::min<uint64_t>(kBuffersPerSlab, limit - pooled);
+
+    Slab slab;
+    slab.Region = AllocateLargeRegion(SEND_BUFFER_SLAB_BYTES, &slab.HugePages);
+    if (!slab.Region) {
+        LOG_WARN() << "SendBufferPool: Failed to map a " << SEND_BUFFER_SLAB_BYTES << " byte slab";
+        return false;
+    }
+    slabs_.push_back(slab);
+    if (slab.HugePages) {
+        huge_page_slabs_++;
+    }
+
+    uint8_t* base = static_cast<uint8_t*>(slab.Region);
+    for (uint64_t i = 0; i < count; ++i) {
+        SendBuffer* buffer = new (base + i * kSendBufferStride) SendBuffer;
+        buffer->NextFree = depot_;
+        depot_ = buffer;
+    }
+    depot_count_ += count;
+    pooled_ += count;
+    return true;
+}
+
+SendBuffer* SendBufferPool::Refill(ThreadCache& cache) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    bool carved = false;
+    if (depot_count_ == 0) {
+        if (!CarveSlab()) {
+            return nullptr;
+        }
+        carved = true;
+    }
+
+    for (int i = 0; i < SEND_BUFFER_TRANSFER_BATCH && depot_; ++i) {
+        SendBuffer* buffer = depot_;
+        depot_ = buffer->NextFree;
+        depot_count_--;
+        cache.Push(buffer);
+    }
+
+    if (carved) {
+        misses_++;
+    } else {
+        ThreadCache::Bump(cache.Hits);
+    }
+    return cache.Pop();
+}
+
+void SendBufferPool::Spill(ThreadCache& cache, int count) {
+    if (count <= 0) {
+        return;
+    }
+
+    // Link the batch outside of the lock, then splice it onto the depot
+    SendBuffer* first = cache.Pop();
+    SendBuffer* last = first;
+    for (int i = 1; i < count; ++i) {
+        SendBuffer* buffer = cache.Pop();
+        last->NextFree = buffer;
+        last = buffer;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    last->NextFree = depot_;
+    depot_ = first;
+    depot_count_ += count;
+}
+
+SendBuffer* SendBufferPool::AllocateFromDepot() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        bool available = depot_count_ > 0;
+        if (!available && CarveSlab()) {
+            misses_++;
+            available = true;
+        }
+        if (available) {
+            SendBuffer* buffer = depot_;
+            depot_ = buffer->NextFree;
+            depot_count_--;
+            buffer->NextFree = nullptr;
+            return buffer;
+        }
+    }
+    return AllocateOverflow();
+}
+
+void SendBufferPool::FreeToDepot(SendBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer->NextFree = depot_;
+    depot_ = buffer;
+    depot_count_++;
+}
+
+SendBuffer* SendBufferPool::AllocateOverflow() {
+    SendBuffer* buffer = new SendBuffer;
+    buffer->Pooled = false;
+
+    misses_++;
+    overflows_++;
+
+    return buffer;
+}
+
+void SendBufferPool::FreeOverflow(SendBuffer* buffer) {
+    delete buffer;
+}
+
+void SendBufferPool::OnAllocated() {
+    const uint64_t outstanding = outstanding_.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint64_t high_water = high_water_.load(std::memory_order_relaxed);
+    while (outstanding > high_water &&
+        !high_water_.compare_exchange_weak(high_water, outstanding, std::memory_order_relaxed)) {
+    }
+}
+
+SendAllocatorStats SendBufferPool::GetStats() {
+    SendAllocatorStats stats;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    uint64_t hits = retired_hits_;
+    for (ThreadCache* cache : caches_) {
+        hits += cache->Hits.load(std::memory_order_relaxed);
+    }
+
+    stats.Hits = hits;
+    stats.Misses = misses_;
+    stats.Overflows = overflows_;
+    stats.Outstanding = outstanding_.load(std::memory_order_relaxed);
+    stats.HighWater = high_water_.load(std::memory_order_relaxed);
+    stats.Pooled = pooled_;
+    stats.Limit = limit_;
+    stats.Slabs = slabs_.size();
+    stats.HugePageSlabs = huge_page_slabs_;
+    return stats;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+// SendBuffer
+
+void intrusive_ptr_add_ref(SendBuffer* buffer)
+{
+    buffer->RefCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(SendBuffer* buffer)
+{
+    if (buffer->RefCount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    SendBufferPool& pool = SendBufferPool::Instance();
+    pool.OnFreed();
+
+    if (tls_cache_destroyed) {
+        if (buffer->Pooled) {
+            pool.FreeToDepot(buffer);
+        } else {
+            pool.FreeOverflow(buffer);
+        }
+        return;
+    }
+
+    ThreadCache& cache = tls_cache;
+
+    if (!buffer->Pooled) {
+        pool.FreeOverflow(buffer);
+        return;
+    }
+
+    cache.Push(buffer);
+    if (cache.Count > SEND_BUFFER_THREAD_CACHE) {
+        pool.Spill(cache, SEND_BUFFER_TRANSFER_BATCH);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// SendAllocator
+
+SendBufferPtr SendAllocator::Allocate()
+{
+    SendBufferPool& pool = SendBufferPool::Instance();
+    pool.OnAllocated();
+
+    // Same as the release path: Do not recreate the cache during thread exit
+    if (tls_cache_destroyed) {
+        return SendBufferPtr(pool.AllocateFromDepot());
+    }
+
+    // Touching tls_cache constructs and registers it on first use
+    ThreadCache& cache = tls_cache;
+
+    SendBuffer* buffer = cache.Pop();
+    if (buffer) {
+        ThreadCache::Bump(cache.Hits);
+    } else {
+        buffer = pool.Refill(cache);
+        if (!buffer) {
+            buffer = pool.AllocateOverflow();
+        }
+    }
+
+    return SendBufferPtr(buffer);
+}
+
+void SendAllocator::SetLimit(uint64_t max_buffers)
+{
+    SendBufferPool::Instance().SetLimit(max_buffers);
+}
+
+SendAllocatorStats SendAllocator::GetStats()
+{
+    return SendBufferPool::Instance().GetStats();
+}
+
+
+//------------------------------------------------------------------------------
+// BodyPool
+
+namespace {
+
+static size_t body_class_bytes(int size_class)
+{
+    return static_cast<size_t>(BODY_POOL_MIN_BYTES) << size_class;
+}
+
+// Returns -1 if the buffer is too large for any size class
+static int body_size_class(size_t bytes)
+{
+    for (int i = 0; i < BODY_POOL_CLASS_COUNT; ++i) {
+        if (bytes <= body_class_bytes(i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+class BodyPool {
+public:
+    static BodyPool& Instance() {
+        // Leaked so that buffers released during static destruction are safe
+        static BodyPool* pool = new BodyPool;
+        return *pool;
+    }
+
+    uint8_t* Acquire(int size_class, bool& huge_pages);
+    void Recycle(int size_class, uint8_t* region, bool huge_pages);
+
+    void SetLimit(uint64_t max_cached_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        limit_ = max_cached_bytes;
+    }
+    BodyPoolStats GetStats();
+
+protected:
+    std::mutex mutex_;
+
+    struct Region {
+        uint8_t* Data = nullptr;
+        bool HugePages = false;
+    };
+    std::vector<Region> free_[BODY_POOL_CLASS_COUNT];
+
+    uint64_t cached_bytes_ = 0;
+    uint64_t limit_ = BODY_POOL_DEFAULT_CACHED_BYTES;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t huge_page_regions_ = 0;
+};
+
+uint8_t* BodyPool::Acquire(int size_class, bool& huge_pages)
+{
+    const size_t bytes = body_class_bytes(size_class);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& free_list = free_[size_class];
+        if (!free_list.empty()) {
+            Region region = free_list.back();
+            free_list.pop_back();
+            cached_bytes_ -= bytes;
+            hits_++;
+            huge_pages = region.HugePages;
+            return region.Data;
+        }
+        misses_++;
+    }
+
+    // Map outside of the lock since first use can take a while
+    uint8_t* data = static_cast<uint8_t*>(AllocateLargeRegion(bytes, &huge_pages));
+    if (data && huge_pages) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        huge_page_regions_++;
+    }
+    return data;
+}
+
+void BodyPool::Recycle(int size_class, uint8_t* data, bool huge_pages)
+{
+    const size_t bytes = body_class_bytes(size_class);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cached_bytes_ + bytes <= limit_) {
+            Region region;
+            region.Data = data;
+            region.HugePages = huge_pages;
+            free_[size_class].push_back(region);
+            cached_bytes_ += bytes;
+            return;
+        }
+        if (huge_pages) {
+            huge_page_regions_--;
+        }
+    }
+
+    FreeLargeRegion(data, bytes, huge_pages);
+}
+
+BodyPoolStats BodyPool::GetStats()
+{
+    BodyPoolStats stats;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.Hits = hits_;
+    stats.Misses = misses_;
+    stats.CachedBytes = cached_bytes_;
+    stats.CachedLimit = limit_;
+    stats.HugePageRegions = huge_page_regions_;
+    return stats;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+// PooledBuffer
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept
+{
+    if (this != &other) {
+        Release();
+
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        storage_ = other.storage_;
+        huge_pages_ = other.huge_pages_;
+
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+        other.storage_ = Storage::None;
+        other.huge_pages_ = false;
+    }
+    return *this;
+}
+
+void PooledBuffer::reserve(size_t bytes)
+{
+    if (bytes <= capacity_) {
+        return;
+    }
+
+    if (bytes < BODY_POOL_MIN_BYTES && storage_ != Storage::Pooled && storage_ != Storage::Mapped) {
+        uint8_t* data = static_cast<uint8_t*>(std::realloc(data_, bytes));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        data_ = data;
+        capacity_ = bytes;
+        storage_ = Storage::Heap;
+        return;
+    }
+
+    PooledBuffer grown;
+
+    const int size_class = body_size_class(bytes);
+    if (size_class >= 0) {
+        grown.data_ = BodyPool::Instance().Acquire(size_class, grown.huge_pages_);
+        grown.capacity_ = body_class_bytes(size_class);
+        grown.storage_ = Storage::Pooled;
+    } else {
+        const size_t rounded = (bytes + SEND_BUFFER_SLAB_BYTES - 1) & ~static_cast<size_t>(SEND_BUFFER_SLAB_BYTES - 1);
+        grown.data_ = static_cast<uint8_t*>(AllocateLargeRegion(rounded, &grown.huge_pages_));
+        grown.capacity_ = rounded;
+        grown.storage_ = Storage::Mapped;
+    }
+    if (!grown.data_) {
+        grown.storage_ = Storage::None;
+        throw std::bad_alloc();
+    }
+
+    if (size_ > 0) {
+        std::memcpy(grown.data_, data_, size_);
+    }
+    grown.size_ = size_;
+
+    *this = std::move(grown);
+}
+
+void PooledBuffer::append(const void* data, size_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+    if (size_ + bytes > capacity_) {
+        reserve(std::max(size_ + bytes, capacity_ * 2));
+    }
+    std::memcpy(data_ + size_, data, bytes);
+    size_ += bytes;
+}
+
+void PooledBuffer::Release()
+{
+    switch (storage_) {
+    case Storage::Heap:
+        std::free(data_);
+        break;
+    case Storage::Pooled:
+        BodyPool::Instance().Recycle(body_size_class(capacity_), data_, huge_pages_);
+        break;
+    case Storage::Mapped:
+        FreeLargeRegion(data_, capacity_, huge_pages_);
+        break;
+    case Storage::None:
+        break;
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    storage_ = Storage::None;
+    huge_pages_ = false;
+}
+
+void PooledBuffer::SetPoolLimit(uint64_t max_cached_bytes)
+{
+    BodyPool::Instance().SetLimit(max_cached_bytes);
+}
+
+BodyPoolStats PooledBuffer::GetPoolStats()
+{
+    return BodyPool::Instance().GetStats();
+}
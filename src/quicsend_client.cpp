@@ -9,59 +9,42 @@ QuicSendClient::QuicSendClient(const QuicSendClientSettings& settings)
 {
     settings_ = settings;
 
+    mailbox_.SetWaitPolicy(settings_.WaitPolicy);
+
+    method_header_ = request_headers_.Add(":method");
+    request_headers_.Add(":scheme", "https");
+    request_headers_.Add(":authority", settings_.Host);
+    path_header_ = request_headers_.Add(":path");
+    request_headers_.Add("user-agent", QUICSEND_CLIENT_AGENT);
+    request_headers_.Add("Authorization", settings_.Authorization);
+    info_header_ = request_headers_.Add(QUICSEND_HEADER_INFO);
+    content_type_header_ = request_headers_.Add("content-type");
+    content_length_header_ = request_headers_.Add("content-length");
+
     cert_der_ = LoadPEMCertAsDER(settings_.CertPath);
 
-    auto datagram_callback = [this](
-        uint8_t* data,
-        std::size_t bytes,
-        const boost::asio::ip::udp::endpoint& peer_endpoint)
-    {
-        if (peer_endpoint != resolved_endpoint_) {
-            LOG_ERROR() << "received packet from unexpected endpoint";
-            return;
-        }
+    qs_ = std::make_shared<QuicheSocket>(io_context_);
 
-        connection_->OnDatagram(data, bytes, peer_endpoint);
-    };
+    sender_ = std::make_shared<QuicheSender>(qs_);
 
-    qs_ = std::make_shared<QuicheSocket>(
-        io_context_,
-        datagram_callback);
+    connection_ = std::make_shared<QuicheRoleConnection<QuicSendClient>>(this);
 
-    sender_ = std::make_shared<QuicheSender>(qs_);
+    if (!settings_.Qlog.Directory.empty()) {
+        qlog_ = std::make_shared<QlogTracer>(settings_.Qlog);
+    }
 
-    connection_ = std::make_shared<QuicheConnection>();
+    latency_ = std::make_shared<PathLatencyTracker>();
+
+    if (settings_.FlightRecorder.DumpOnSignal) {
+        FlightRecorder::InstallSignalHandler();
+    }
 
     QCSettings qcs;
-    qcs.IsServer = false;
     qcs.qs = qs_;
-    qcs.dcid = ConnectionId();
-    qcs.on_timeout = [this](uint64_t connection_id) {
-        Close();
-
-        // Queue timeout event
-        QuicheMailbox::Event event;
-        event.Type = QuicheMailbox::EventType::Timeout;
-        event.ConnectionAssignedId = connection_id;
-        mailbox_.Post(event);
-    };
-    qcs.on_connect = [this](uint64_t connection_id, const boost::asio::ip::udp::endpoint& peer_endpoint) { 
-        if (connection_->ComparePeerCertificate(cert_der_.data(), cert_der_.size())) {
-            LOG_INFO() << "*** Connection established";
-
-            // Queue connect event
-            QuicheMailbox::Event event;
-            event.Type = QuicheMailbox::EventType::Connect;
-            event.ConnectionAssignedId = connection_id;
-            event.PeerEndpoint = peer_endpoint;
-            mailbox_.Post(event);
-        }
-    };
-    qcs.on_data = [this](const QuicheMailbox::Event& event) {
-        if (connection_->IsConnected()) {
-            mailbox_.Post(event);
-        }
-    };
+    qcs.dcid.Randomize();
+    qcs.qlog = qlog_;
+    qcs.latency = latency_;
+    qcs.flight = settings_.FlightRecorder;
 
     connection_->Initialize(qcs);
 
@@ -74,7 +57,7 @@ QuicSendClient::QuicSendClient(const QuicSendClientSettings& settings)
                     Close();
                     return;
                 }
-                qs_->StartReceive();
+                qs_->StartReceive(this);
                 connection_->FlushEgress();
             } else {
                 LOG_ERROR() << "Failed to resolve host: " << ec.message();
@@ -89,6 +72,54 @@ QuicSendClient::QuicSendClient(const QuicSendClientSettings& settings)
     });
 }
 
+void QuicSendClient::OnDatagram(
+    uint8_t* data,
+    std::size_t bytes,
+    const boost::asio::ip::udp::endpoint& peer_endpoint)
+{
+    if (peer_endpoint != resolved_endpoint_) {
+        LOG_ERROR() << "received packet from unexpected endpoint";
+        return;
+    }
+
+    connection_->OnDatagram(data, bytes, peer_endpoint);
+}
+
+void QuicSendClient::OnConnect(
+    QuicheConnection& connection,
+    const boost::asio::ip::udp::endpoint& peer_endpoint)
+{
+    if (connection.ComparePeerCertificate(cert_der_.data(), cert_der_.size())) {
+        LOG_INFO() << "*** Connection established";
+
+        // Queue connect event
+        QuicheMailbox::Event event;
+        event.Type = QuicheMailbox::EventType::Connect;
+        event.ConnectionAssignedId = connection.settings_.AssignedId;
+        event.PeerEndpoint = peer_endpoint;
+        mailbox_.Post(event);
+    }
+}
+
+void QuicSendClient::OnTimeout(QuicheConnection& connection) {
+    Close();
+
+    // Queue timeout event
+    QuicheMailbox::Event event;
+    event.Type = QuicheMailbox::EventType::Timeout;
+    event.ConnectionAssignedId = connection.settings_.AssignedId;
+    mailbox_.Post(event);
+}
+
+void QuicSendClient::OnData(
+    QuicheConnection& connection,
+    const QuicheMailbox::Event& event)
+{
+    if (connection.IsConnected()) {
+        mailbox_.Post(event);
+    }
+}
+
 QuicSendClient::~QuicSendClient() {
     mailbox_.Shutdown();
     Close();
@@ -108,37 +139,49 @@ void QuicSendClient::Close() {
 int64_t QuicSendClient::Request(
     const std::string& path,
     const std::string& header_info,
-    BodyData body)
+    BodyData body,
+    const StreamPriority& priority)
 {
     if (closed_) {
         return -1;
     }
 
+    HeaderBlock headers(request_headers_);
+    headers.Set(path_header_, path);
+    headers.Set(info_header_, header_info);
+
+    // The default priority is implied when the header is absent
+    char priority_text[PRIORITY_HEADER_MAX];
+    const bool send_priority = !priority.IsDefault();
+
     if (body.Empty()) {
-        const std::vector<std::pair<std::string, std::string>> headers = {
-            {":method", "GET"},
-            {":scheme", "https"},
-            {":authority", settings_.Host},
-            {":path", path},
-            {"user-agent", QUICSEND_CLIENT_AGENT},
-            {"Authorization", settings_.Authorization},
-            {QUICSEND_HEADER_INFO, header_info},
-        };
-
-        return connection_->SendRequest(headers);
+        headers.Set(method_header_, "GET", 3);
+        headers.Truncate(content_type_header_);
+        if (send_priority &&
+            !headers.Append("priority", priority_text, FormatPriorityHeader(priority, priority_text)))
+        {
+            return -1;
+        }
+
+        return connection_->SendRequest(headers.data(), headers.size(), nullptr, 0, nullptr, priority);
+    }
+
+    headers.Set(method_header_, "POST", 4);
+    headers.Set(content_type_header_, body.ContentType, std::strlen(body.ContentType));
+    headers.SetInt(content_length_header_, body.TotalLength());
+    if (send_priority &&
+        !headers.Append("priority", priority_text, FormatPriorityHeader(priority, priority_text)))
+    {
+        return -1;
+    }
+
+    if (!body.Segments.empty()) {
+        return connection_->SendRequest(headers.data(), headers.size(),
+            body.Segments.data(), body.Segments.size(), body.Owner, priority);
     }
 
-    const std::vector<std::pair<std::string, std::string>> headers = {
-        {":method", "POST"},
-        {":scheme", "https"},
-        {":authority", settings_.Host},
-        {":path", path},
-        {"user-agent", QUICSEND_CLIENT_AGENT},
-        {"Authorization", std::string("Bearer ") + settings_.Authorization},
-        {QUICSEND_HEADER_INFO, header_info},
-        {"content-type", body.ContentType},
-        {"content-length", std::to_string(body.Length)},
-    };
-
-    return connection_->SendRequest(headers, body.Data, body.Length);
+    BodySegment segment;
+    segment.Data = body.Data;
+    segment.Length = body.Length;
+    return connection_->SendRequest(headers.data(), headers.size(), &segment, 1, body.Owner, priority);
 }
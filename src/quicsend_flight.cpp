@@ -0,0 +1,282 @@
+#include <quicsend_flight.hpp>
+#include <quicsend_tools.hpp>
+
+#include <csignal>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+
+//------------------------------------------------------------------------------
+// FlightEvent
+
+struct FlightEventInfo {
+    const char* Name;
+
+    // nullptr if the argument is unused
+    const char* Arg0;
+    const char* Arg1;
+};
+
+static const FlightEventInfo kFlightEventInfo[] = {
+    { "packet_recv", "bytes", nullptr },
+    { "packet_send", "bytes", "paced_usec" },
+    { "recv_error", "error", nullptr },
+    { "established", nullptr, nullptr },
+    { "connect_retry", nullptr, nullptr },
+    { "timer_fired", nullptr, nullptr },
+    { "stream_headers", "stream", nullptr },
+    { "stream_data", "stream", "bytes" },
+    { "stream_finished", "stream", "bytes" },
+    { "stream_reset", "stream", nullptr },
+    { "request_sent", "stream", "bytes" },
+    { "request_blocked", "error", nullptr },
+    { "body_blocked", "stream", "queued" },
+    { "response_sent", "stream", "bytes" },
+    { "response_cached", "stream", "bytes" },
+    { "cached_response_sent", "stream", nullptr },
+    { "goaway", nullptr, nullptr },
+    { "closed", "timed_out", "error" },
+};
+static_assert(sizeof(kFlightEventInfo) / sizeof(kFlightEventInfo[0]) == static_cast<size_t>(FlightEvent::Count),
+    "kFlightEventInfo must have one entry per FlightEvent");
+
+const char* FlightEventName(FlightEvent type)
+{
+    if (type >= FlightEvent::Count) {
+        return "unknown";
+    }
+    return kFlightEventInfo[static_cast<size_t>(type)].Name;
+}
+
+
+//------------------------------------------------------------------------------
+// FlightRecorder
+
+static constexpr int kStampTypeShift = 56;
+static constexpr uint64_t kStampNsecMask = (1ull << kStampTypeShift) - 1;
+
+void FlightRecorder::Initialize(uint32_t events)
+{
+    if (events == 0) {
+        slots_.reset();
+        mask_ = 0;
+        return;
+    }
+
+    uint64_t count = 1;
+    while (count < events) {
+        count <<= 1;
+    }
+
+    // Zeroed, so no slot matches a sequence number before it is written
+    slots_.reset(new Slot[count]());
+    mask_ = count - 1;
+    next_ = 0;
+}
+
+void FlightRecorder::Record(FlightEvent type, uint64_t arg0, uint64_t arg1)
+{
+    if (!slots_) {
+        return;
+    }
+
+    const uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[index & mask_];
+
+    // Seqlock write: Mark the slot busy before the fields change
+    slot.Sequence.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const uint64_t stamp = (static_cast<uint64_t>(type) << kStampTypeShift) |
+        (static_cast<uint64_t>(GetNsec()) & kStampNsecMask);
+    slot.Stamp.store(stamp, std::memory_order_relaxed);
+    slot.Arg0.store(arg0, std::memory_order_relaxed);
+    slot.Arg1.store(arg1, std::memory_order_relaxed);
+
+    slot.Sequence.store(index * 2 + 2, std::memory_order_release);
+}
+
+void FlightRecorder::Snapshot(std::vector<FlightRecord>& records) const
+{
+    records.clear();
+    if (!slots_) {
+        return;
+    }
+
+    const uint64_t end = next_.load(std::memory_order_acquire);
+    const uint64_t capacity = mask_ + 1;
+    const uint64_t begin = end > capacity ? end - capacity : 0;
+    records.reserve(end - begin);
+
+    for (uint64_t index = begin; index < end; ++index) {
+        const Slot& slot = slots_[index & mask_];
+
+        const uint64_t sequence = slot.Sequence.load(std::memory_order_acquire);
+        if (sequence != index * 2 + 2) {
+            // Still being written, or already overwritten by a newer event
+            continue;
+        }
+
+        const uint64_t stamp = slot.Stamp.load(std::memory_order_relaxed);
+        FlightRecord record;
+        record.Arg0 = slot.Arg0.load(std::memory_order_relaxed);
+        record.Arg1 = slot.Arg1.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.Sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+
+        record.Nsec = static_cast<int64_t>(stamp & kStampNsecMask);
+        record.Type = static_cast<FlightEvent>(stamp >> kStampTypeShift);
+        records.push_back(record);
+    }
+}
+
+std::string FlightRecorder::Format(int64_t now_nsec, size_t max_events) const
+{
+    std::vector<FlightRecord> records;
+    Snapshot(records);
+
+    size_t first = 0;
+    if (max_events > 0 && records.size() > max_events) {
+        first = records.size() - max_events;
+    }
+
+    // Timestamps lost their top bits when stored
+    now_nsec &= static_cast<int64_t>(kStampNsecMask);
+
+    std::string text;
+    text.reserve((records.size() - first) * 64);
+
+    char line[160];
+    for (size_t i = first; i < records.size(); ++i) {
+        const FlightRecord& record = records[i];
+        const FlightEventInfo& info = kFlightEventInfo[static_cast<size_t>(record.Type)];
+
+        int length = std::snprintf(line, sizeof(line), "%12.3f ms  %-20s",
+            (record.Nsec - now_nsec) * 1e-6, info.Name);
+        if (info.Arg0 && length < (int)sizeof(line)) {
+            length += std::snprintf(line + length, sizeof(line) - length, " %s=%llu",
+                info.Arg0, static_cast<unsigned long long>(record.Arg0));
+        }
+        if (info.Arg1 && length < (int)sizeof(line)) {
+            length += std::snprintf(line + length, sizeof(line) - length, " %s=%llu",
+                info.Arg1, static_cast<unsigned long long>(record.Arg1));
+        }
+        text.append(line, std::min<size_t>(length, sizeof(line) - 1));
+        text.push_back('\n');
+    }
+    return text;
+}
+
+
+//------------------------------------------------------------------------------
+// Signal Handler
+
+static std::atomic<uint32_t> g_flight_signals = ATOMIC_VAR_INIT(0);
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Signal handler needs a lock-free counter");
+
+static void flight_signal_handler(int)
+{
+    // Async-signal-safe: Senders notice the change and dump from their threads
+    g_flight_signals.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t FlightRecorder::SignalCount()
+{
+    return g_flight_signals.load(std::memory_order_relaxed);
+}
+
+void FlightRecorder::InstallSignalHandler()
+{
+    static std::once_flag once;
+    std::call_once(once, []() {
+        struct sigaction action = {};
+        action.sa_handler = flight_signal_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR2, &action, nullptr) != 0) {
+            LOG_ERROR() << "Failed to install SIGUSR2 handler for flight recorder dumps";
+        }
+    });
+}
+
+
+//------------------------------------------------------------------------------
+// FlightDumpWriter
+
+struct FlightDump {
+    std::string Path;
+    std::string Text;
+};
+
+// Single background thread that writes queued dumps
+struct FlightDumpWriter {
+    std::mutex Lock;
+    std::condition_variable CV;
+    std::deque<FlightDump> Queue;
+    std::shared_ptr<std::thread> Thread;
+    bool Terminated = false;
+
+    ~FlightDumpWriter() {
+        {
+            std::lock_guard<std::mutex> locker(Lock);
+            Terminated = true;
+        }
+        CV.notify_all();
+        JoinThread(Thread);
+    }
+
+    void Run();
+};
+
+static FlightDumpWriter flight_dump_writer;
+
+void FlightDumpWriter::Run()
+{
+    std::unique_lock<std::mutex> locker(Lock);
+    for (;;) {
+        CV.wait(locker, [this] { return Terminated || !Queue.empty(); });
+        if (Terminated) {
+            return;
+        }
+
+        FlightDump dump = std::move(Queue.front());
+        Queue.pop_front();
+        locker.unlock();
+
+        if (dump.Path.empty()) {
+            Logger::getInstance().LogLines(Logger::WARN, dump.Text);
+        } else {
+            std::ofstream file(dump.Path);
+            file << dump.Text;
+            if (!file) {
+                LOG_ERROR() << "Failed to write flight recorder dump: " << dump.Path;
+            } else {
+                LOG_WARN() << "Flight recorder written to " << dump.Path;
+            }
+        }
+
+        locker.lock();
+    }
+}
+
+void FlightRecorder::QueueDump(std::string path, std::string text)
+{
+    {
+        std::lock_guard<std::mutex> locker(flight_dump_writer.Lock);
+        if (flight_dump_writer.Terminated) {
+            return;
+        }
+        flight_dump_writer.Queue.push_back({ std::move(path), std::move(text) });
+        if (!flight_dump_writer.Thread) {
+            flight_dump_writer.Thread = std::make_shared<std::thread>(&FlightDumpWriter::Run, &flight_dump_writer);
+        }
+    }
+    flight_dump_writer.CV.notify_one();
+}
@@ -0,0 +1,147 @@
+#include <quicsend_latency.hpp>
+
+#include <algorithm>
+
+
+//------------------------------------------------------------------------------
+// LatencyHistogram
+
+static int highest_bit(uint64_t value)
+{
+    return 63 - __builtin_clzll(value);
+}
+
+int LatencyHistogram::BucketIndex(uint64_t usec)
+{
+    if (usec < LATENCY_HISTOGRAM_LINEAR) {
+        return static_cast<int>(usec);
+    }
+
+    const uint64_t max_usec = (1ull << LATENCY_HISTOGRAM_MAX_BITS) - 1;
+    if (usec > max_usec) {
+        usec = max_usec;
+    }
+
+    // Keep the top bits of the value: the leading one and log2(kHalf) more
+    const int shift = highest_bit(usec) - highest_bit(kHalf);
+    const int sub_bucket = static_cast<int>(usec >> shift) - kHalf;
+    return LATENCY_HISTOGRAM_LINEAR + (shift - 1) * kHalf + sub_bucket;
+}
+
+uint64_t LatencyHistogram::BucketValue(int index)
+{
+    if (index < LATENCY_HISTOGRAM_LINEAR) {
+        return static_cast<uint64_t>(index);
+    }
+
+    const int shift = (index - LATENCY_HISTOGRAM_LINEAR) / kHalf + 1;
+    const uint64_t sub_bucket = (index - LATENCY_HISTOGRAM_LINEAR) % kHalf + kHalf;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(int64_t usec)
+{
+    if (usec < 0) {
+        usec = 0;
+    }
+    const uint64_t value = static_cast<uint64_t>(usec);
+
+    buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t prev_max = max_.load(std::memory_order_relaxed);
+    while (value > prev_max &&
+        !max_.compare_exchange_weak(prev_max, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::GetStats(LatencyStats& stats) const
+{
+    stats = LatencyStats();
+
+    uint64_t counts[kBucketCount];
+    uint64_t total = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    stats.Count = total;
+    stats.MeanUsec = sum_.load(std::memory_order_relaxed) / std::max<uint64_t>(1, count_.load(std::memory_order_relaxed));
+    stats.MaxUsec = max_.load(std::memory_order_relaxed);
+
+    struct Quantile {
+        uint64_t PerMille;
+        uint64_t* Value;
+    };
+    const Quantile quantiles[] = {
+        { 500, &stats.P50Usec },
+        { 900, &stats.P90Usec },
+        { 990, &stats.P99Usec },
+        { 999, &stats.P999Usec },
+    };
+
+    uint64_t seen = 0;
+    int next = 0;
+    for (int i = 0; i < kBucketCount && next < 4; ++i) {
+        seen += counts[i];
+        while (next < 4 && seen * 1000 >= quantiles[next].PerMille * total) {
+            // The bucket bound can exceed the largest sample recorded
+            *quantiles[next].Value = std::min(BucketValue(i), stats.MaxUsec);
+            ++next;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// PathLatencyTracker
+
+RequestLatency* PathLatencyTracker::ForPath(std::string_view path)
+{
+    std::string key(path);
+
+    std::lock_guard<std::mutex> locker(mutex_);
+
+    auto it = paths_.find(key);
+    if (it != paths_.end()) {
+        return it->second.get();
+    }
+
+    if (paths_.size() >= LATENCY_MAX_PATHS) {
+        key = LATENCY_OTHER_PATH;
+        it = paths_.find(key);
+        if (it != paths_.end()) {
+            return it->second.get();
+        }
+    }
+
+    auto& latency = paths_[key];
+    latency = std::make_unique<RequestLatency>();
+    return latency.get();
+}
+
+std::vector<PathLatencyStats> PathLatencyTracker::GetStats()
+{
+    std::vector<PathLatencyStats> result;
+
+    std::lock_guard<std::mutex> locker(mutex_);
+
+    result.resize(paths_.size());
+    size_t i = 0;
+    for (const auto& entry : paths_) {
+        result[i].Path = entry.first;
+        entry.second->GetStats(result[i].Latency);
+        ++i;
+    }
+
+    std::sort(result.begin(), result.end(), [](const PathLatencyStats& a, const PathLatencyStats& b) {
+        return a.Path < b.Path;
+    });
+    return result;
+}
@@ -0,0 +1,243 @@
+#include <quicsend_metrics.hpp>
+#include <quicsend_alloc.hpp>
+#include <quicsend_tools.hpp>
+
+#include <sstream>
+
+using boost::asio::ip::tcp;
+
+
+//------------------------------------------------------------------------------
+// Metric Table
+
+struct MetricInfo {
+    const char* Name;
+    const char* Help;
+    bool Gauge;
+};
+
+static const MetricInfo kMetricInfo[] = {
+    { "quicsend_packets_in_total", "UDP datagrams received", false },
+    { "quicsend_packets_out_total", "UDP datagrams sent", false },
+    { "quicsend_bytes_in_total", "UDP payload bytes received", false },
+    { "quicsend_bytes_out_total", "UDP payload bytes sent", false },
+    { "quicsend_send_errors_total", "UDP sends that failed", false },
+    { "quicsend_recv_errors_total", "Datagrams rejected by quiche_conn_recv", false },
+    { "quicsend_invalid_packets_total", "Datagrams with an unparseable QUIC header", false },
+    { "quicsend_retries_sent_total", "Stateless retry packets sent", false },
+    { "quicsend_version_negotiations_total", "Version negotiation packets sent", false },
+    { "quicsend_connections_opened_total", "Connections created", false },
+    { "quicsend_connections_closed_total", "Connections destroyed", false },
+    { "quicsend_requests_sent_total", "Requests sent by clients", false },
+    { "quicsend_responses_sent_total", "Responses sent by servers", false },
+
+    { "quicsend_connections_active", "Connections currently open", true },
+    { "quicsend_incoming_streams", "Incoming streams being received", true },
+    { "quicsend_outgoing_streams_queued", "Outgoing streams with body left to write", true },
+    { "quicsend_cached_responses", "Responses held for retransmission on reconnect", true },
+    { "quicsend_mailbox_depth", "Events posted and not yet polled", true },
+};
+
+static_assert(sizeof(kMetricInfo) / sizeof(kMetricInfo[0]) == static_cast<size_t>(Metric::Count),
+    "kMetricInfo must have one entry per Metric");
+
+
+//------------------------------------------------------------------------------
+// Prometheus Export
+
+static void write_metric(std::ostringstream& oss, const char* name,
+    const char* help, bool gauge, uint64_t value)
+{
+    oss << "# HELP " << name << " " << help << "\n";
+    oss << "# TYPE " << name << (gauge ? " gauge\n" : " counter\n");
+    oss << name << " " << value << "\n";
+}
+
+std::string Metrics::ExportPrometheus()
+{
+    std::ostringstream oss;
+
+    for (int i = 0; i < static_cast<int>(Metric::Count); ++i) {
+        const MetricInfo& info = kMetricInfo[i];
+        int64_t value = slots_[i].Value.load(std::memory_order_relaxed);
+
+        // Gauges are updated from several threads without ordering, so one
+        // can briefly read below zero
+        if (value < 0) {
+            value = 0;
+        }
+
+        write_metric(oss, info.Name, info.Help, info.Gauge, static_cast<uint64_t>(value));
+    }
+
+    SendAllocatorStats send = SendAllocator::GetStats();
+    write_metric(oss, "quicsend_send_allocator_hits_total",
+        "Packet buffers served from a free list", false, send.Hits);
+    write_metric(oss, "quicsend_send_allocator_misses_total",
+        "Packet buffers that needed a new slab or the heap", false, send.Misses);
+    write_metric(oss, "quicsend_send_allocator_overflows_total",
+        "Packet buffers allocated from the heap past the pool limit", false, send.Overflows);
+    write_metric(oss, "quicsend_send_allocator_outstanding",
+        "Packet buffers currently handed out", true, send.Outstanding);
+
+    BodyPoolStats body = PooledBuffer::GetPoolStats();
+    write_metric(oss, "quicsend_body_pool_hits_total",
+        "Body buffers served from a recycled region", false, body.Hits);
+    write_metric(oss, "quicsend_body_pool_misses_total",
+        "Body buffers that needed a new region", false, body.Misses);
+    write_metric(oss, "quicsend_body_pool_cached_bytes",
+        "Idle body pool bytes held for reuse", true, body.CachedBytes);
+
+    return oss.str();
+}
+
+
+//------------------------------------------------------------------------------
+// HTTP Endpoint
+
+// Largest request head read before answering.  Scrapers send a short GET
+#define METRICS_HTTP_MAX_REQUEST 4096
+
+// Sessions that have not read a request and written the response by then
+// are closed, so idle clients cannot hold sockets open
+#define METRICS_HTTP_TIMEOUT_MSEC 5000
+
+struct MetricsHttpServer {
+    boost::asio::io_context Context;
+    tcp::acceptor Acceptor{Context};
+    std::shared_ptr<std::thread> Thread;
+
+    // Also runs at exit if StopHttpServer() was never called, since a
+    // thread that is still joinable would terminate the process
+    ~MetricsHttpServer() {
+        Context.stop();
+        JoinThread(Thread);
+    }
+
+    void Accept();
+};
+
+struct MetricsHttpSession : std::enable_shared_from_this<MetricsHttpSession> {
+    MetricsHttpSession(boost::asio::io_context& context, tcp::socket socket)
+        : Socket(std::move(socket))
+        , Timer(context)
+    {
+    }
+
+    tcp::socket Socket;
+    boost::asio::deadline_timer Timer;
+    boost::asio::streambuf Request{METRICS_HTTP_MAX_REQUEST};
+    std::string Response;
+
+    void Start() {
+        auto self = shared_from_this();
+
+        Timer.expires_from_now(boost::posix_time::milliseconds(METRICS_HTTP_TIMEOUT_MSEC));
+        Timer.async_wait([self](const boost::system::error_code& ec) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            // Cancels the pending read or write
+            boost::system::error_code ignored;
+            self->Socket.close(ignored);
+        });
+
+        boost::asio::async_read_until(Socket, Request, "\r\n\r\n",
+            [self](const boost::system::error_code& ec, std::size_t /*bytes*/) {
+                if (ec) {
+                    self->Timer.cancel();
+                    return;
+                }
+                self->Respond();
+            });
+    }
+
+    void Respond() {
+        // Every path returns the metrics, which is all a scraper needs
+        std::string body = Metrics::ExportPrometheus();
+
+        std::ostringstream oss;
+        oss << "HTTP/1.0 200 OK\r\n";
+        oss << "Content-Type: text/plain; version=0.0.4\r\n";
+        oss << "Content-Length: " << body.size() << "\r\n";
+        oss << "Connection: close\r\n\r\n";
+        oss << body;
+        Response = oss.str();
+
+        auto self = shared_from_this();
+        boost::asio::async_write(Socket, boost::asio::buffer(Response),
+            [self](const boost::system::error_code& /*ec*/, std::size_t /*bytes*/) {
+                self->Timer.cancel();
+                boost::system::error_code ignored;
+                self->Socket.shutdown(tcp::socket::shutdown_both, ignored);
+            });
+    }
+};
+
+void MetricsHttpServer::Accept()
+{
+    Acceptor.async_accept(
+        [this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec) {
+                if (ec != boost::asio::error::operation_aborted) {
+                    LOG_WARN() << "Metrics accept failed: " << ec.message();
+                }
+                return;
+            }
+            std::make_shared<MetricsHttpSession>(Context, std::move(socket))->Start();
+            Accept();
+        });
+}
+
+static std::mutex metrics_http_lock;
+static std::unique_ptr<MetricsHttpServer> metrics_http;
+
+bool Metrics::StartHttpServer(uint16_t port)
+{
+    std::lock_guard<std::mutex> locker(metrics_http_lock);
+    if (metrics_http) {
+        LOG_WARN() << "Metrics HTTP server already running";
+        return false;
+    }
+
+    auto server = std::make_unique<MetricsHttpServer>();
+
+    boost::system::error_code ec;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    server->Acceptor.open(endpoint.protocol(), ec);
+    if (!ec) {
+        server->Acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+    }
+    if (!ec) {
+        server->Acceptor.bind(endpoint, ec);
+    }
+    if (!ec) {
+        server->Acceptor.listen(boost::asio::socket_base::max_listen_connections, ec);
+    }
+    if (ec) {
+        LOG_ERROR() << "Metrics HTTP server failed to listen on port " << port << ": " << ec.message();
+        return false;
+    }
+
+    server->Accept();
+
+    MetricsHttpServer* raw = server.get();
+    server->Thread = std::make_shared<std::thread>([raw]() {
+        raw->Context.run();
+    });
+
+    LOG_INFO() << "Metrics HTTP server listening on 127.0.0.1:" << port;
+    metrics_http = std::move(server);
+    return true;
+}
+
+void Metrics::StopHttpServer()
+{
+    std::unique_ptr<MetricsHttpServer> server;
+    {
+        std::lock_guard<std::mutex> locker(metrics_http_lock);
+        server = std::move(metrics_http);
+    }
+    // The destructor stops the context and joins the thread
+    server.reset();
+}
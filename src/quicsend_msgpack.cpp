@@ -0,0 +1,362 @@
+#include <quicsend_msgpack.hpp>
+#include <quicsend_tools.hpp>
+
+#include <cstring>
+
+
+//------------------------------------------------------------------------------
+// MsgpackWriter
+
+void MsgpackWriter::WriteTagged8(uint8_t tag, uint8_t value) {
+    uint8_t buffer[2] = { tag, value };
+    out_.insert(out_.end(), buffer, buffer + sizeof(buffer));
+}
+
+void MsgpackWriter::WriteTagged16(uint8_t tag, uint16_t value) {
+    uint8_t buffer[3] = { tag };
+    write_uint16_be(buffer + 1, value);
+    out_.insert(out_.end(), buffer, buffer + sizeof(buffer));
+}
+
+void MsgpackWriter::WriteTagged32(uint8_t tag, uint32_t value) {
+    uint8_t buffer[5] = { tag };
+    write_uint32_be(buffer + 1, value);
+    out_.insert(out_.end(), buffer, buffer + sizeof(buffer));
+}
+
+void MsgpackWriter::WriteTagged64(uint8_t tag, uint64_t value) {
+    uint8_t buffer[9] = { tag };
+    write_uint64_be(buffer + 1, value);
+    out_.insert(out_.end(), buffer, buffer + sizeof(buffer));
+}
+
+void MsgpackWriter::WriteNil() {
+    WriteByte(0xc0);
+}
+
+void MsgpackWriter::WriteBool(bool value) {
+    WriteByte(value ? 0xc3 : 0xc2);
+}
+
+void MsgpackWriter::WriteInt(int64_t value) {
+    if (value >= 0) {
+        WriteUInt(static_cast<uint64_t>(value));
+    } else if (value >= -32) {
+        WriteByte(static_cast<uint8_t>(value)); // negative fixint
+    } else if (value >= INT8_MIN) {
+        WriteTagged8(0xd0, static_cast<uint8_t>(value));
+    } else if (value >= INT16_MIN) {
+        WriteTagged16(0xd1, static_cast<uint16_t>(value));
+    } else if (value >= INT32_MIN) {
+        WriteTagged32(0xd2, static_cast<uint32_t>(value));
+    } else {
+        WriteTagged64(0xd3, static_cast<uint64_t>(value));
+    }
+}
+
+void MsgpackWriter::WriteUInt(uint64_t value) {
+    if (value < 0x80) {
+        WriteByte(static_cast<uint8_t>(value)); // positive fixint
+    } else if (value <= UINT8_MAX) {
+        WriteTagged8(0xcc, static_cast<uint8_t>(value));
+    } else if (value <= UINT16_MAX) {
+        WriteTagged16(0xcd, static_cast<uint16_t>(value));
+    } else if (value <= UINT32_MAX) {
+        WriteTagged32(0xce, static_cast<uint32_t>(value));
+    } else {
+        WriteTagged64(0xcf, value);
+    }
+}
+
+void MsgpackWriter::WriteFloat(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    WriteTagged64(0xcb, bits);
+}
+
+void MsgpackWriter::WriteStr(const char* data, size_t bytes) {
+    if (bytes < 32) {
+        WriteByte(static_cast<uint8_t>(0xa0 | bytes));
+    } else if (bytes <= UINT8_MAX) {
+        WriteTagged8(0xd9, static_cast<uint8_t>(bytes));
+    } else if (bytes <= UINT16_MAX) {
+        WriteTagged16(0xda, static_cast<uint16_t>(bytes));
+    } else {
+        WriteTagged32(0xdb, static_cast<uint32_t>(bytes));
+    }
+    out_.insert(out_.end(), data, data + bytes);
+}
+
+void MsgpackWriter::WriteBinHeader(size_t bytes) {
+    if (bytes <= UINT8_MAX) {
+        WriteTagged8(0xc4, static_cast<uint8_t>(bytes));
+    } else if (bytes <= UINT16_MAX) {
+        WriteTagged16(0xc5, static_cast<uint16_t>(bytes));
+    } else {
+        WriteTagged32(0xc6, static_cast<uint32_t>(bytes));
+    }
+}
+
+void MsgpackWriter::WriteBin(const void* data, size_t bytes) {
+    WriteBinHeader(bytes);
+    const uint8_t* data8 = static_cast<const uint8_t*>(data);
+    out_.insert(out_.end(), data8, data8 + bytes);
+}
+
+void MsgpackWriter::WriteArrayHeader(size_t count) {
+    if (count < 16) {
+        WriteByte(static_cast<uint8_t>(0x90 | count));
+    } else if (count <= UINT16_MAX) {
+        WriteTagged16(0xdc, static_cast<uint16_t>(count));
+    } else {
+        WriteTagged32(0xdd, static_cast<uint32_t>(count));
+    }
+}
+
+void MsgpackWriter::WriteMapHeader(size_t count) {
+    if (count < 16) {
+        WriteByte(static_cast<uint8_t>(0x80 | count));
+    } else if (count <= UINT16_MAX) {
+        WriteTagged16(0xde, static_cast<uint16_t>(count));
+    } else {
+        WriteTagged32(0xdf, static_cast<uint32_t>(count));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// MsgpackParse
+
+namespace {
+
+class MsgpackReader {
+public:
+    MsgpackReader(const uint8_t* data, size_t bytes)
+        : data_(data)
+        , bytes_(bytes)
+    {
+    }
+
+    size_t Remaining() const {
+        return bytes_ - offset_;
+    }
+
+    bool ReadToken(MsgpackToken& token);
+
+protected:
+    const uint8_t* data_;
+    size_t bytes_;
+    size_t offset_ = 0;
+
+    const uint8_t* Take(size_t bytes) {
+        if (Remaining() < bytes) {
+            return nullptr;
+        }
+        const uint8_t* ptr = data_ + offset_;
+        offset_ += bytes;
+        return ptr;
+    }
+
+    bool ReadLength(int width, uint64_t& length) {
+        const uint8_t* ptr = Take(width);
+        if (!ptr) {
+            return false;
+        }
+        if (width == 1) {
+            length = ptr[0];
+        } else if (width == 2) {
+            length = read_uint16_be(ptr);
+        } else {
+            length = read_uint32_be(ptr);
+        }
+        return true;
+    }
+
+    bool ReadBytes(MsgpackToken& token, MsgpackToken::Type kind, uint64_t length) {
+        token.Kind = kind;
+        token.Length = length;
+        token.Data = Take(length);
+        return token.Data != nullptr;
+    }
+
+    bool ReadContainer(MsgpackToken& token, MsgpackToken::Type kind, uint64_t count) {
+        token.Kind = kind;
+        token.Length = count;
+
+        // Every element takes at least one byte, which bounds bogus counts
+        uint64_t elements = (kind == MsgpackToken::Type::Map) ? count * 2 : count;
+        return elements <= Remaining();
+    }
+};
+
+bool MsgpackReader::ReadToken(MsgpackToken& token) {
+    const uint8_t* tag_ptr = Take(1);
+    if (!tag_ptr) {
+        return false;
+    }
+    const uint8_t tag = *tag_ptr;
+    token = MsgpackToken();
+
+    if (tag < 0x80) {
+        token.Kind = MsgpackToken::Type::UInt;
+        token.UInt = tag;
+        return true;
+    }
+    if (tag >= 0xe0) {
+        token.Kind = MsgpackToken::Type::Int;
+        token.Int = static_cast<int8_t>(tag);
+        return true;
+    }
+    if ((tag & 0xf0) == 0x80) {
+        return ReadContainer(token, MsgpackToken::Type::Map, tag & 0x0f);
+    }
+    if ((tag & 0xf0) == 0x90) {
+        return ReadContainer(token, MsgpackToken::Type::Array, tag & 0x0f);
+    }
+    if ((tag & 0xe0) == 0xa0) {
+        return ReadBytes(token, MsgpackToken::Type::Str, tag & 0x1f);
+    }
+
+    uint64_t length = 0;
+    const uint8_t* ptr = nullptr;
+
+    switch (tag) {
+    case 0xc0:
+        token.Kind = MsgpackToken::Type::Nil;
+        return true;
+    case 0xc2:
+    case 0xc3:
+        token.Kind = MsgpackToken::Type::Bool;
+        token.Bool = (tag == 0xc3);
+        return true;
+
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+        return ReadLength(1 << (tag - 0xc4), length) &&
+               ReadBytes(token, MsgpackToken::Type::Bin, length);
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+        return ReadLength(1 << (tag - 0xd9), length) &&
+               ReadBytes(token, MsgpackToken::Type::Str, length);
+    case 0xdc:
+    case 0xdd:
+        return ReadLength(2 << (tag - 0xdc), length) &&
+               ReadContainer(token, MsgpackToken::Type::Array, length);
+    case 0xde:
+    case 0xdf:
+        return ReadLength(2 << (tag - 0xde), length) &&
+               ReadContainer(token, MsgpackToken::Type::Map, length);
+
+    case 0xca: {
+        if (!(ptr = Take(4))) {
+            return false;
+        }
+        uint32_t bits = read_uint32_be(ptr);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        token.Kind = MsgpackToken::Type::Float;
+        token.Float = value;
+        return true;
+    }
+    case 0xcb: {
+        if (!(ptr = Take(8))) {
+            return false;
+        }
+        uint64_t bits = read_uint64_be(ptr);
+        token.Kind = MsgpackToken::Type::Float;
+        std::memcpy(&token.Float, &bits, sizeof(token.Float));
+        return true;
+    }
+
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf: {
+        const int width = 1 << (tag - 0xcc);
+        if (!(ptr = Take(width))) {
+            return false;
+        }
+        token.Kind = MsgpackToken::Type::UInt;
+        if (width == 1) {
+            token.UInt = ptr[0];
+        } else if (width == 2) {
+            token.UInt = read_uint16_be(ptr);
+        } else if (width == 4) {
+            token.UInt = read_uint32_be(ptr);
+        } else {
+            token.UInt = read_uint64_be(ptr);
+        }
+        return true;
+    }
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3: {
+        const int width = 1 << (tag - 0xd0);
+        if (!(ptr = Take(width))) {
+            return false;
+        }
+        token.Kind = MsgpackToken::Type::Int;
+        if (width == 1) {
+            token.Int = static_cast<int8_t>(ptr[0]);
+        } else if (width == 2) {
+            token.Int = static_cast<int16_t>(read_uint16_be(ptr));
+        } else if (width == 4) {
+            token.Int = static_cast<int32_t>(read_uint32_be(ptr));
+        } else {
+            token.Int = static_cast<int64_t>(read_uint64_be(ptr));
+        }
+        return true;
+    }
+
+    default:
+        // Extension types and reserved tags are not supported
+        return false;
+    }
+}
+
+} // namespace
+
+bool MsgpackParse(
+    const uint8_t* data,
+    size_t bytes,
+    std::vector<MsgpackToken>& tokens)
+{
+    tokens.clear();
+
+    MsgpackReader reader(data, bytes);
+
+    // Number of values still expected by each open container
+    std::vector<uint64_t> pending;
+    pending.reserve(16);
+    pending.push_back(1);
+
+    while (!pending.empty()) {
+        if (pending.back() == 0) {
+            pending.pop_back();
+            continue;
+        }
+        pending.back()--;
+
+        MsgpackToken token;
+        if (!reader.ReadToken(token)) {
+            return false;
+        }
+        tokens.push_back(token);
+
+        if (token.Length > 0) {
+            if (token.Kind == MsgpackToken::Type::Array) {
+                pending.push_back(token.Length);
+            } else if (token.Kind == MsgpackToken::Type::Map) {
+                pending.push_back(token.Length * 2);
+            }
+            if (pending.size() > MSGPACK_MAX_DEPTH) {
+                return false;
+            }
+        }
+    }
+
+    return reader.Remaining() == 0;
+}
@@ -1,4 +1,5 @@
 #include <quicsend_python.h>
+#include <quicsend_msgpack.hpp>
 
 
 //------------------------------------------------------------------------------
@@ -6,12 +7,122 @@
 
 PyObject* create_python_view_object(void* data, Py_ssize_t len) {
     if (!data || len <= 0) {
-        return Py_None;
+        // Callers release the result, so None needs a reference too
+        Py_RETURN_NONE;
     }
 
     return PyMemoryView_FromMemory((char*)data, len, PyBUF_WRITE);
 }
 
+// Buffer views whose body was dropped on a thread without the GIL, such as
+// the sender after the last byte was accepted.  Released by the next call
+// from Python instead, so sending never waits for the GIL
+static std::mutex g_released_views_lock;
+static std::vector<std::vector<Py_buffer>> g_released_views;
+
+static void release_deferred_views()
+{
+    std::vector<std::vector<Py_buffer>> released;
+    {
+        std::lock_guard<std::mutex> locker(g_released_views_lock);
+        if (g_released_views.empty()) {
+            return;
+        }
+        released.swap(g_released_views);
+    }
+
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    for (auto& views : released) {
+        for (auto& view : views) {
+            PyBuffer_Release(&view);
+        }
+    }
+    PyGILState_Release(gstate);
+}
+
+// Holds buffer views of a PythonBody until every byte has been accepted by
+// quiche, so the exporting objects stay alive and are sent without a copy.
+// ctypes releases the GIL around our C API calls, so it is reacquired
+// only while touching Python objects.
+class PythonBodyView {
+public:
+    // Returns false if a part does not support the buffer protocol.
+    // Nothing is sent in that case rather than a truncated body
+    static bool Create(const PythonBody& body, BodyData& out) {
+        if (!body.Data) {
+            return true;
+        }
+
+        release_deferred_views();
+
+        auto owner = std::make_shared<PythonBodyView>();
+
+        PyGILState_STATE gstate = PyGILState_Ensure();
+        bool success = true;
+        if (PyList_Check(body.Data) || PyTuple_Check(body.Data)) {
+            Py_ssize_t count = PySequence_Fast_GET_SIZE(body.Data);
+            PyObject** items = PySequence_Fast_ITEMS(body.Data);
+            owner->views_.reserve(count);
+            for (Py_ssize_t i = 0; i < count && success; ++i) {
+                success = owner->AddView(items[i]);
+            }
+        } else {
+            success = owner->AddView(body.Data);
+        }
+        if (!success) {
+            for (auto& view : owner->views_) {
+                PyBuffer_Release(&view);
+            }
+            owner->views_.clear();
+        }
+        PyGILState_Release(gstate);
+
+        if (!success) {
+            LOG_ERROR() << "Body part does not support the buffer protocol";
+            return false;
+        }
+        if (owner->views_.empty()) {
+            return true;
+        }
+
+        // Always scatter-gather, which carries 64-bit lengths
+        out.ContentType = body.ContentType ? body.ContentType : "";
+        out.Segments.reserve(owner->views_.size());
+        for (const auto& view : owner->views_) {
+            BodySegment segment;
+            segment.Data = static_cast<const uint8_t*>(view.buf);
+            segment.Length = view.len;
+            out.Segments.push_back(segment);
+        }
+        out.Owner = std::move(owner);
+        return true;
+    }
+
+    ~PythonBodyView() {
+        if (views_.empty()) {
+            return;
+        }
+
+        // May run on any thread, so hand the views to the next Python call
+        std::lock_guard<std::mutex> locker(g_released_views_lock);
+        g_released_views.push_back(std::move(views_));
+    }
+
+private:
+    std::vector<Py_buffer> views_;
+
+    // Called with the GIL held
+    bool AddView(PyObject* obj) {
+        Py_buffer view{};
+        if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+            PyErr_Clear();
+            return false;
+        }
+        views_.push_back(view);
+        return true;
+    }
+};
+
 static void route_event(
     const QuicheMailbox::Event& event,
     connect_callback on_connect,
@@ -69,6 +180,366 @@ static void route_event(
     }
 }
 
+
+
+//------------------------------------------------------------------------------
+// msgpack
+
+// Binary fields at least this large are sent in place instead of being copied
+#define MSGPACK_ZERO_COPY_MIN_BYTES (16 * 1024)
+
+class PythonMsgpackEncoder {
+public:
+    ~PythonMsgpackEncoder() {
+        for (auto& external : externals_) {
+            Py_DECREF(external.View);
+        }
+    }
+
+    bool Encode(PyObject* obj, int depth = 0);
+
+    // Returns a new reference: bytes, or a tuple of scatter-gather buffers
+    PyObject* Finish();
+
+protected:
+    std::vector<uint8_t> buffer_;
+    MsgpackWriter writer_{buffer_};
+
+    // Binary payloads referenced in place, following buffer_[0, Offset)
+    struct External {
+        size_t Offset;
+        PyObject* View;
+    };
+    std::vector<External> externals_;
+
+    bool EncodeBin(PyObject* obj);
+};
+
+bool PythonMsgpackEncoder::Encode(PyObject* obj, int depth)
+{
+    if (depth > MSGPACK_MAX_DEPTH) {
+        PyErr_SetString(PyExc_ValueError, "msgpack: Object nested too deeply");
+        return false;
+    }
+
+    if (obj == Py_None) {
+        writer_.WriteNil();
+    } else if (PyBool_Check(obj)) {
+        writer_.WriteBool(obj == Py_True);
+    } else if (PyLong_Check(obj)) {
+        int overflow = 0;
+        long long value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow > 0) {
+            unsigned long long uvalue = PyLong_AsUnsignedLongLong(obj);
+            if (PyErr_Occurred()) {
+                return false;
+            }
+            writer_.WriteUInt(uvalue);
+        } else if (overflow < 0) {
+            PyErr_SetString(PyExc_OverflowError, "msgpack: Integer too small");
+            return false;
+        } else {
+            writer_.WriteInt(value);
+        }
+    } else if (PyFloat_Check(obj)) {
+        writer_.WriteFloat(PyFloat_AS_DOUBLE(obj));
+    } else if (PyUnicode_Check(obj)) {
+        Py_ssize_t bytes = 0;
+        const char* utf8 = PyUnicode_AsUTF8AndSize(obj, &bytes);
+        if (!utf8) {
+            return false;
+        }
+        writer_.WriteStr(utf8, bytes);
+    } else if (PyList_Check(obj) || PyTuple_Check(obj)) {
+        Py_ssize_t count = PySequence_Fast_GET_SIZE(obj);
+        PyObject** items = PySequence_Fast_ITEMS(obj);
+        writer_.WriteArrayHeader(count);
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            if (!Encode(items[i], depth + 1)) {
+                return false;
+            }
+        }
+    } else if (PyDict_Check(obj)) {
+        writer_.WriteMapHeader(PyDict_Size(obj));
+        PyObject* key = nullptr;
+        PyObject* value = nullptr;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(obj, &pos, &key, &value)) {
+            if (!Encode(key, depth + 1) || !Encode(value, depth + 1)) {
+                return false;
+            }
+        }
+    } else if (PyObject_CheckBuffer(obj)) {
+        return EncodeBin(obj);
+    } else {
+        PyErr_Format(PyExc_TypeError, "msgpack: Cannot serialize %s", Py_TYPE(obj)->tp_name);
+        return false;
+    }
+
+    return true;
+}
+
+bool PythonMsgpackEncoder::EncodeBin(PyObject* obj)
+{
+    Py_buffer view{};
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+        return false;
+    }
+    CallbackScope view_scope([&view]() { PyBuffer_Release(&view); });
+
+    if (view.len < MSGPACK_ZERO_COPY_MIN_BYTES) {
+        writer_.WriteBin(view.buf, view.len);
+        return true;
+    }
+
+    PyObject* ref = PyMemoryView_FromObject(obj);
+    if (!ref) {
+        return false;
+    }
+    writer_.WriteBinHeader(view.len);
+    externals_.push_back({buffer_.size(), ref});
+    return true;
+}
+
+PyObject* PythonMsgpackEncoder::Finish()
+{
+    if (externals_.empty()) {
+        return PyBytes_FromStringAndSize(
+            reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+    }
+
+    PyObject* parts = PyList_New(0);
+    if (!parts) {
+        return nullptr;
+    }
+
+    size_t offset = 0;
+    auto add_part = [parts](PyObject* part) -> bool {
+        if (!part) {
+            return false;
+        }
+        int r = PyList_Append(parts, part);
+        Py_DECREF(part);
+        return r == 0;
+    };
+
+    for (auto& external : externals_) {
+        if (external.Offset > offset) {
+            if (!add_part(PyBytes_FromStringAndSize(
+                reinterpret_cast<const char*>(buffer_.data()) + offset,
+                external.Offset - offset))) {
+                Py_DECREF(parts);
+                return nullptr;
+            }
+            offset = external.Offset;
+        }
+        Py_INCREF(external.View);
+        if (!add_part(external.View)) {
+            Py_DECREF(parts);
+            return nullptr;
+        }
+    }
+    if (buffer_.size() > offset) {
+        if (!add_part(PyBytes_FromStringAndSize(
+            reinterpret_cast<const char*>(buffer_.data()) + offset,
+            buffer_.size() - offset))) {
+            Py_DECREF(parts);
+            return nullptr;
+        }
+    }
+
+    PyObject* result = PyList_AsTuple(parts);
+    Py_DECREF(parts);
+    return result;
+}
+
+// Builds the Python object for tokens[index], advancing index past its children.
+// Binary fields are sliced out of base_view without copying.
+static PyObject* build_msgpack_object(
+    const std::vector<MsgpackToken>& tokens,
+    size_t& index,
+    PyObject* base_view,
+    const uint8_t* base)
+{
+    const MsgpackToken& token = tokens[index++];
+
+    switch (token.Kind) {
+    case MsgpackToken::Type::Nil:
+        Py_RETURN_NONE;
+    case MsgpackToken::Type::Bool:
+        return PyBool_FromLong(token.Bool);
+    case MsgpackToken::Type::Int:
+        return PyLong_FromLongLong(token.Int);
+    case MsgpackToken::Type::UInt:
+        return PyLong_FromUnsignedLongLong(token.UInt);
+    case MsgpackToken::Type::Float:
+        return PyFloat_FromDouble(token.Float);
+    case MsgpackToken::Type::Str:
+        return PyUnicode_DecodeUTF8(
+            reinterpret_cast<const char*>(token.Data), token.Length, "strict");
+    case MsgpackToken::Type::Bin: {
+        Py_ssize_t offset = token.Data - base;
+        return PySequence_GetSlice(base_view, offset, offset + token.Length);
+    }
+    case MsgpackToken::Type::Array: {
+        PyObject* list = PyList_New(token.Length);
+        if (!list) {
+            return nullptr;
+        }
+        for (uint64_t i = 0; i < token.Length; ++i) {
+            PyObject* item = build_msgpack_object(tokens, index, base_view, base);
+            if (!item) {
+                Py_DECREF(list);
+                return nullptr;
+            }
+            PyList_SET_ITEM(list, i, item);
+        }
+        return list;
+    }
+    case MsgpackToken::Type::Map: {
+        PyObject* dict = PyDict_New();
+        if (!dict) {
+            return nullptr;
+        }
+        for (uint64_t i = 0; i < token.Length; ++i) {
+            PyObject* key = build_msgpack_object(tokens, index, base_view, base);
+            PyObject* value = key ? build_msgpack_object(tokens, index, base_view, base) : nullptr;
+            int r = value ? PyDict_SetItem(dict, key, value) : -1;
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+            if (r != 0) {
+                Py_DECREF(dict);
+                return nullptr;
+            }
+        }
+        return dict;
+    }
+    }
+
+    PyErr_SetString(PyExc_ValueError, "msgpack: Unexpected token");
+    return nullptr;
+}
+
+static void to_python_metrics(const MailboxMetrics& metrics, PythonMailboxMetrics* out)
+{
+    out->Polls = metrics.Polls;
+    out->Events = metrics.Events;
+    out->Immediate = metrics.Immediate;
+    out->SpinHits = metrics.SpinHits;
+    out->SpinMisses = metrics.SpinMisses;
+    out->Parks = metrics.Parks;
+    out->SpinBudgetUsec = metrics.SpinBudgetUsec;
+    out->InterArrivalUsec = metrics.InterArrivalUsec;
+}
+
+static int32_t to_python_stats(
+    const ConnectionStats& stats,
+    PythonConnectionStats* out,
+    PythonStreamStats* streams,
+    int32_t max_streams)
+{
+    out->ConnectionId = stats.ConnectionId;
+    out->PacketsSent = stats.PacketsSent;
+    out->PacketsReceived = stats.PacketsReceived;
+    out->PacketsLost = stats.PacketsLost;
+    out->PacketsRetransmitted = stats.PacketsRetransmitted;
+    out->BytesSent = stats.BytesSent;
+    out->BytesReceived = stats.BytesReceived;
+    out->BytesAcked = stats.BytesAcked;
+    out->BytesLost = stats.BytesLost;
+    out->BytesRetransmitted = stats.BytesRetransmitted;
+    out->BytesInFlight = stats.BytesInFlight;
+    out->SmoothedRttUsec = stats.SmoothedRttUsec;
+    out->CongestionWindow = stats.CongestionWindow;
+    out->DeliveryRate = stats.DeliveryRate;
+    out->PathMtu = stats.PathMtu;
+    out->PacingRate = stats.PacingRate;
+    out->QueuedBytes = stats.QueuedBytes;
+    out->StreamCount = static_cast<int32_t>(stats.Streams.size());
+
+    int32_t count = 0;
+    if (streams) {
+        for (const auto& stream : stats.Streams) {
+            if (count >= max_streams) {
+                break;
+            }
+            PythonStreamStats& stream_out = streams[count++];
+            stream_out.StreamId = stream.StreamId;
+            stream_out.QueuedBytes = stream.QueuedBytes;
+            stream_out.WrittenBytes = stream.WrittenBytes;
+            stream_out.Urgency = stream.Urgency;
+        }
+    }
+    return count;
+}
+
+static void to_python_latency(const LatencyStats& stats, PythonLatencyStats* out)
+{
+    out->Count = stats.Count;
+    out->MeanUsec = stats.MeanUsec;
+    out->P50Usec = stats.P50Usec;
+    out->P90Usec = stats.P90Usec;
+    out->P99Usec = stats.P99Usec;
+    out->P999Usec = stats.P999Usec;
+    out->MaxUsec = stats.MaxUsec;
+}
+
+static int32_t to_python_path_latency(
+    const std::vector<PathLatencyStats>& stats,
+    PythonPathLatency* paths,
+    int32_t max_paths)
+{
+    if (paths) {
+        int32_t count = 0;
+        for (const auto& path : stats) {
+            if (count >= max_paths) {
+                break;
+            }
+            PythonPathLatency& out = paths[count++];
+            size_t length = std::min(path.Path.size(), sizeof(out.Path) - 1);
+            std::memcpy(out.Path, path.Path.data(), length);
+            out.Path[length] = '\0';
+            to_python_latency(path.Latency.FirstByte, &out.FirstByte);
+            to_python_latency(path.Latency.LastByte, &out.LastByte);
+        }
+    }
+    return static_cast<int32_t>(stats.size());
+}
+
+// Copies as much as fits, nul-terminated.  Returns the full length
+static int32_t to_python_text(const std::string& text, char* buffer, int32_t bytes)
+{
+    if (buffer && bytes > 0) {
+        size_t copied = std::min(text.size(), static_cast<size_t>(bytes - 1));
+        std::memcpy(buffer, text.data(), copied);
+        buffer[copied] = '\0';
+    }
+    return static_cast<int32_t>(text.size());
+}
+
+// Same fields in the client and server settings
+template<class PythonSettings>
+static void to_flight_settings(const PythonSettings* settings, FlightRecorderSettings& out)
+{
+    if (settings->FlightEvents < 0) {
+        out.Events = 0;
+    } else if (settings->FlightEvents > 0) {
+        out.Events = static_cast<uint32_t>(settings->FlightEvents);
+    }
+    out.DumpDirectory = settings->FlightDumpDir ? settings->FlightDumpDir : "";
+    out.DumpOnSignal = settings->FlightDumpOnSignal != 0;
+}
+
+static StreamPriority to_stream_priority(int32_t urgency, int32_t incremental)
+{
+    StreamPriority priority;
+    if (urgency >= 0) {
+        priority.Urgency = static_cast<uint8_t>(std::min<int32_t>(urgency, STREAM_MAX_URGENCY));
+    }
+    priority.Incremental = incremental != 0;
+    return priority;
+}
+
 extern "C" {
 
 
@@ -82,6 +553,11 @@ QuicSendClient* quicsend_client_create(const PythonQuicSendClientSettings* setti
     cs.Host = settings->Host ? settings->Host : "";
     cs.Port = settings->Port;
     cs.CertPath = settings->CertPath ? settings->CertPath : "";
+    cs.WaitPolicy.MaxSpinUsec = settings->MailboxSpinUsec;
+    cs.Qlog.Directory = settings->QlogDir ? settings->QlogDir : "";
+    cs.Qlog.SampleRate = settings->QlogSampleRate > 0 ? settings->QlogSampleRate : 1;
+    cs.Qlog.MaxTotalBytes = settings->QlogMaxBytes;
+    to_flight_settings(settings, cs.FlightRecorder);
 
     if (cs.Host.empty() || cs.Port == 0 || cs.CertPath.empty()) {
         LOG_ERROR() << "quicsend_client_create: Invalid input";
@@ -95,36 +571,45 @@ void quicsend_client_destroy(QuicSendClient *client) {
     if (client != NULL) {
         delete client;
     }
+    release_deferred_views();
 }
 
 int64_t quicsend_client_request(
     QuicSendClient *client,
     const char* path,
     const char* header_info,
-    PythonBody body)
+    PythonBody body,
+    int32_t urgency,
+    int32_t incremental)
 {
     if (client == NULL) {
         return -1;
     }
 
     // Convert Python body to C++ body
-    BodyData bd;
-    Py_buffer view{};
-    if (body.Data && PyObject_GetBuffer(body.Data, &view, PyBUF_SIMPLE) == 0) {
-        bd.ContentType = body.ContentType ? body.ContentType : "";
-        bd.Data = static_cast<const uint8_t*>(view.buf);
-        bd.Length = static_cast<int32_t>(view.len);
+    BodyData cpp_body;
+    if (!PythonBodyView::Create(body, cpp_body)) {
+        return -1;
     }
-    CallbackScope cbs([&]() {
-        if (bd.Data) {
-            PyBuffer_Release(&view);
-        }
-    });
 
     return client->Request(
         path ? path : "",
         header_info ? header_info : "",
-        bd);
+        cpp_body,
+        to_stream_priority(urgency, incremental));
+}
+
+int32_t quicsend_client_update_priority(
+    QuicSendClient *client,
+    int64_t request_id,
+    int32_t urgency,
+    int32_t incremental)
+{
+    if (client == NULL) {
+        return 0;
+    }
+
+    return client->UpdatePriority(request_id, to_stream_priority(urgency, incremental)) ? 1 : 0;
 }
 
 int32_t quicsend_client_poll(
@@ -138,6 +623,8 @@ int32_t quicsend_client_poll(
         return 0;
     }
 
+    release_deferred_views();
+
     auto fn_event = [&](const QuicheMailbox::Event& event) {
         route_event(event, on_connect, on_timeout, nullptr, on_response);
     };
@@ -146,6 +633,69 @@ int32_t quicsend_client_poll(
     return 1;
 }
 
+void quicsend_client_mailbox_metrics(
+    QuicSendClient* client,
+    PythonMailboxMetrics* metrics)
+{
+    if (client == NULL || metrics == NULL) {
+        return;
+    }
+
+    to_python_metrics(client->GetMailboxMetrics(), metrics);
+}
+
+int32_t quicsend_client_stats(
+    QuicSendClient* client,
+    PythonConnectionStats* stats,
+    PythonStreamStats* streams,
+    int32_t max_streams)
+{
+    if (client == NULL || stats == NULL) {
+        return 0;
+    }
+
+    ConnectionStats connection_stats;
+    client->GetStats(connection_stats);
+    return to_python_stats(connection_stats, stats, streams, max_streams);
+}
+
+void quicsend_client_latency(
+    QuicSendClient* client,
+    PythonLatencyStats* first_byte,
+    PythonLatencyStats* last_byte)
+{
+    if (client == NULL || first_byte == NULL || last_byte == NULL) {
+        return;
+    }
+
+    RequestLatencyStats stats;
+    client->GetLatency(stats);
+    to_python_latency(stats.FirstByte, first_byte);
+    to_python_latency(stats.LastByte, last_byte);
+}
+
+int32_t quicsend_client_path_latency(
+    QuicSendClient* client,
+    PythonPathLatency* paths,
+    int32_t max_paths)
+{
+    if (client == NULL) {
+        return 0;
+    }
+    return to_python_path_latency(client->GetPathLatency(), paths, max_paths);
+}
+
+int32_t quicsend_client_flight_recorder(
+    QuicSendClient* client,
+    char* buffer,
+    int32_t bytes)
+{
+    if (client == NULL) {
+        return 0;
+    }
+    return to_python_text(client->GetFlightRecorder(), buffer, bytes);
+}
+
 
 //------------------------------------------------------------------------------
 // C API : QuicSendServer
@@ -157,6 +707,12 @@ QuicSendServer* quicsend_server_create(const PythonQuicSendServerSettings* setti
     ss.Port = settings->Port;
     ss.KeyPath = settings->KeyPath ? settings->KeyPath : "";
     ss.CertPath = settings->CertPath ? settings->CertPath : "";
+    ss.WaitPolicy.MaxSpinUsec = settings->MailboxSpinUsec;
+    ss.DispatchShards = settings->DispatchShards;
+    ss.Qlog.Directory = settings->QlogDir ? settings->QlogDir : "";
+    ss.Qlog.SampleRate = settings->QlogSampleRate > 0 ? settings->QlogSampleRate : 1;
+    ss.Qlog.MaxTotalBytes = settings->QlogMaxBytes;
+    to_flight_settings(settings, ss.FlightRecorder);
 
     if (ss.Port == 0 || ss.KeyPath.empty() || ss.CertPath.empty()) {
         LOG_ERROR() << "quicsend_server_create: Invalid input";
@@ -170,6 +726,7 @@ void quicsend_server_destroy(QuicSendServer *server) {
     if (server != NULL) {
         delete server;
     }
+    release_deferred_views();
 }
 
 int32_t quicsend_server_poll(
@@ -183,6 +740,8 @@ int32_t quicsend_server_poll(
         return 0;
     }
 
+    release_deferred_views();
+
     auto fn_event = [&](const QuicheMailbox::Event& event) {
         route_event(event, on_connect, on_timeout, on_request, nullptr);
     };
@@ -191,38 +750,36 @@ int32_t quicsend_server_poll(
     return 1;
 }
 
-void quicsend_server_respond(
+int32_t quicsend_server_respond(
     QuicSendServer* server,
     uint64_t connection_id,
     int64_t request_id,
     int32_t status,
     const char* header_info,
-    PythonBody body)
+    PythonBody body,
+    int32_t urgency,
+    int32_t incremental)
 {
     if (server == NULL) {
-        return;
+        return 0;
     }
 
     // Convert Python body to C++ body
-    BodyData bd;
-    Py_buffer view{};
-    if (body.Data && PyObject_GetBuffer(body.Data, &view, PyBUF_SIMPLE) == 0) {
-        bd.ContentType = body.ContentType ? body.ContentType : "";
-        bd.Data = static_cast<const uint8_t*>(view.buf);
-        bd.Length = static_cast<int32_t>(view.len);
+    BodyData cpp_body;
+    if (!PythonBodyView::Create(body, cpp_body)) {
+        return 0;
     }
-    CallbackScope cbs([&]() {
-        if (bd.Data) {
-            PyBuffer_Release(&view);
-        }
-    });
+
+    StreamPriority priority = to_stream_priority(urgency, incremental);
 
     server->Respond(
         connection_id,
         request_id,
         status,
         header_info ? header_info : "",
-        bd);
+        cpp_body,
+        urgency < 0 ? nullptr : &priority);
+    return 1;
 }
 
 void quicsend_server_close(
@@ -236,5 +793,165 @@ void quicsend_server_close(
     server->Close(connection_id);
 }
 
+void quicsend_server_set_connection_weight(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    uint32_t weight)
+{
+    if (server == NULL) {
+        return;
+    }
+
+    server->SetConnectionWeight(connection_id, weight);
+}
+
+void quicsend_server_mailbox_metrics(
+    QuicSendServer* server,
+    PythonMailboxMetrics* metrics)
+{
+    if (server == NULL || metrics == NULL) {
+        return;
+    }
+
+    to_python_metrics(server->GetMailboxMetrics(), metrics);
+}
+
+int32_t quicsend_server_stats(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    PythonConnectionStats* stats,
+    PythonStreamStats* streams,
+    int32_t max_streams)
+{
+    if (server == NULL || stats == NULL) {
+        return -1;
+    }
+
+    ConnectionStats connection_stats;
+    if (!server->GetStats(connection_id, connection_stats)) {
+        return -1;
+    }
+    return to_python_stats(connection_stats, stats, streams, max_streams);
+}
+
+int32_t quicsend_server_latency(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    PythonLatencyStats* first_byte,
+    PythonLatencyStats* last_byte)
+{
+    if (server == NULL || first_byte == NULL || last_byte == NULL) {
+        return 0;
+    }
+
+    RequestLatencyStats stats;
+    if (!server->GetLatency(connection_id, stats)) {
+        return 0;
+    }
+    to_python_latency(stats.FirstByte, first_byte);
+    to_python_latency(stats.LastByte, last_byte);
+    return 1;
+}
+
+int32_t quicsend_server_path_latency(
+    QuicSendServer* server,
+    PythonPathLatency* paths,
+    int32_t max_paths)
+{
+    if (server == NULL) {
+        return 0;
+    }
+    return to_python_path_latency(server->GetPathLatency(), paths, max_paths);
+}
+
+int32_t quicsend_server_flight_recorder(
+    QuicSendServer* server,
+    uint64_t connection_id,
+    char* buffer,
+    int32_t bytes)
+{
+    if (server == NULL) {
+        return -1;
+    }
+
+    std::string text;
+    if (!server->GetFlightRecorder(connection_id, text)) {
+        return -1;
+    }
+    return to_python_text(text, buffer, bytes);
+}
+
+
+//------------------------------------------------------------------------------
+// C API : Metrics
+
+int32_t quicsend_metrics_prometheus(char* buffer, int32_t bytes)
+{
+    return to_python_text(Metrics::ExportPrometheus(), buffer, bytes);
+}
+
+int32_t quicsend_metrics_start_http(uint16_t port)
+{
+    return Metrics::StartHttpServer(port) ? 1 : 0;
+}
+
+void quicsend_metrics_stop_http()
+{
+    Metrics::StopHttpServer();
+}
+
+
+
+//------------------------------------------------------------------------------
+// C API : msgpack
+
+PyObject* quicsend_msgpack_pack(PyObject* obj)
+{
+    PythonMsgpackEncoder encoder;
+    if (!encoder.Encode(obj)) {
+        return nullptr;
+    }
+    return encoder.Finish();
+}
+
+PyObject* quicsend_msgpack_unpack(PyObject* data)
+{
+    PyObject* view = PyMemoryView_FromObject(data);
+    if (!view) {
+        return nullptr;
+    }
+
+    // Slicing below needs a flat byte view
+    Py_buffer* buffer = PyMemoryView_GET_BUFFER(view);
+    if (buffer->ndim != 1 || buffer->itemsize != 1) {
+        PyObject* flat = PyObject_CallMethod(view, "cast", "s", "B");
+        Py_DECREF(view);
+        if (!flat) {
+            return nullptr;
+        }
+        view = flat;
+        buffer = PyMemoryView_GET_BUFFER(view);
+    }
+    CallbackScope view_scope([view]() { Py_DECREF(view); });
+
+    const uint8_t* base = static_cast<const uint8_t*>(buffer->buf);
+    const size_t bytes = static_cast<size_t>(buffer->len);
+
+    std::vector<MsgpackToken> tokens;
+    bool valid = false;
+
+    Py_BEGIN_ALLOW_THREADS
+    valid = MsgpackParse(base, bytes, tokens);
+    Py_END_ALLOW_THREADS
+
+    if (!valid || tokens.empty()) {
+        PyErr_SetString(PyExc_ValueError, "msgpack: Invalid data");
+        return nullptr;
+    }
+
+    size_t index = 0;
+    return build_msgpack_object(tokens, index, view, base);
+}
+
 
 } // extern "C"
@@ -0,0 +1,227 @@
+#include <quicsend_qlog.hpp>
+#include <quicsend_tools.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+#define QLOG_FILE_EXTENSION ".sqlog"
+
+// Interval between MaxTotalBytes checks of the qlog directory
+#define QLOG_ENFORCE_INTERVAL_MSEC 10000
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+// Address and port with characters that are awkward in file names replaced
+static std::string endpoint_file_name(const boost::asio::ip::udp::endpoint& endpoint)
+{
+    std::string name = endpoint.address().to_string();
+    for (char& c : name) {
+        if (c == ':' || c == '%') {
+            c = '-';
+        }
+    }
+    return name + "_" + std::to_string(endpoint.port());
+}
+
+
+//------------------------------------------------------------------------------
+// QlogTracer
+
+QlogTracer::QlogTracer(const QlogSettings& settings)
+    : settings_(settings)
+{
+    if (settings_.Directory.empty() || settings_.SampleRate == 0) {
+        return;
+    }
+
+#ifndef QUICSEND_ENABLE_QLOG
+    LOG_WARN() << "qlog requested but quiche was built without the qlog feature";
+    return;
+#else
+    std::error_code ec;
+    fs::create_directories(settings_.Directory, ec);
+    if (ec) {
+        LOG_ERROR() << "qlog: Failed to create directory " << settings_.Directory << ": " << ec.message();
+        return;
+    }
+
+    enabled_ = true;
+    LOG_INFO() << "qlog: Tracing 1 in " << settings_.SampleRate << " connections to " << settings_.Directory;
+
+    if (settings_.MaxTotalBytes > 0) {
+        enforce_thread_ = std::make_shared<std::thread>(&QlogTracer::EnforceLoop, this);
+    }
+#endif
+}
+
+QlogTracer::~QlogTracer()
+{
+    {
+        std::lock_guard<std::mutex> locker(enforce_mutex_);
+        terminated_ = true;
+    }
+    enforce_cv_.notify_all();
+    JoinThread(enforce_thread_);
+}
+
+void QlogTracer::EnforceLoop()
+{
+    std::unique_lock<std::mutex> locker(enforce_mutex_);
+    while (!terminated_) {
+        enforce_cv_.wait_for(locker, std::chrono::milliseconds(QLOG_ENFORCE_INTERVAL_MSEC),
+            [this] { return terminated_ || enforce_requested_; });
+        if (terminated_) {
+            break;
+        }
+        enforce_requested_ = false;
+
+        locker.unlock();
+        EnforceSizeCap();
+        locker.lock();
+    }
+}
+
+void QlogTracer::RequestEnforce()
+{
+    if (!enforce_thread_) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(enforce_mutex_);
+        enforce_requested_ = true;
+    }
+    enforce_cv_.notify_one();
+}
+
+bool QlogTracer::Attach(
+    quiche_conn* conn,
+    uint64_t assigned_id,
+    const boost::asio::ip::udp::endpoint& peer_endpoint,
+    bool is_server)
+{
+    if (!enabled_) {
+        return false;
+    }
+
+    const uint64_t count = connection_count_.fetch_add(1, std::memory_order_relaxed);
+    if (count % settings_.SampleRate != 0) {
+        return false;
+    }
+
+    RequestEnforce();
+
+    const int64_t start_usec = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    const std::string name = std::to_string(assigned_id) + "_" +
+        endpoint_file_name(peer_endpoint) + "_" + std::to_string(start_usec);
+    const std::string path = (fs::path(settings_.Directory) / (name + QLOG_FILE_EXTENSION)).string();
+
+#ifdef QUICSEND_ENABLE_QLOG
+    // Registered before quiche creates the file so a concurrent scan skips it
+    {
+        std::lock_guard<std::mutex> locker(active_mutex_);
+        active_paths_[conn] = path;
+    }
+
+    if (!quiche_conn_set_qlog_path(conn, path.c_str(),
+            is_server ? "quicsend server" : "quicsend client", name.c_str())) {
+        LOG_WARN() << "qlog: Failed to open " << path;
+        Detach(conn);
+        return false;
+    }
+    return true;
+#else
+    (void)conn;
+    (void)is_server;
+    return false;
+#endif
+}
+
+void QlogTracer::Detach(quiche_conn* conn)
+{
+    {
+        std::lock_guard<std::mutex> locker(active_mutex_);
+        if (active_paths_.erase(conn) == 0) {
+            return;
+        }
+    }
+
+    // The finished trace now has its final size
+    RequestEnforce();
+}
+
+void QlogTracer::EnforceSizeCap()
+{
+    struct TraceFile {
+        fs::path Path;
+        fs::file_time_type Modified;
+        uint64_t Bytes;
+        bool Active;
+    };
+    std::vector<TraceFile> files;
+    uint64_t total_bytes = 0;
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(settings_.Directory, ec)) {
+        if (entry.path().extension() != QLOG_FILE_EXTENSION) {
+            continue;
+        }
+
+        std::error_code file_ec;
+        const uint64_t bytes = entry.file_size(file_ec);
+        const auto modified = entry.last_write_time(file_ec);
+        if (file_ec) {
+            continue;
+        }
+
+        files.push_back({ entry.path(), modified, bytes, false });
+        total_bytes += bytes;
+    }
+    if (ec) {
+        LOG_WARN() << "qlog: Failed to scan " << settings_.Directory << ": " << ec.message();
+        return;
+    }
+
+    if (total_bytes < settings_.MaxTotalBytes) {
+        return;
+    }
+
+    // Paths are registered before quiche creates the file and are never
+    // reused, so any scanned file that is still being written is in this copy
+    std::vector<fs::path> active_paths;
+    {
+        std::lock_guard<std::mutex> locker(active_mutex_);
+        for (const auto& pair : active_paths_) {
+            active_paths.push_back(pair.second);
+        }
+    }
+    for (TraceFile& file : files) {
+        file.Active = std::find(active_paths.begin(), active_paths.end(), file.Path) != active_paths.end();
+    }
+
+    std::sort(files.begin(), files.end(), [](const TraceFile& a, const TraceFile& b) {
+        return a.Modified < b.Modified;
+    });
+
+    // Traces of open connections still count towards the total but are kept,
+    // since quiche would keep writing to the unlinked file
+    for (const TraceFile& file : files) {
+        if (total_bytes < settings_.MaxTotalBytes) {
+            break;
+        }
+        if (file.Active) {
+            continue;
+        }
+        if (fs::remove(file.Path, ec)) {
+            total_bytes -= file.Bytes;
+        }
+    }
+}
@@ -1,7 +1,9 @@
 #include "quicsend_quiche.hpp"
 #include "quicsend_tools.hpp"
+#include "quicsend_trace.hpp"
 
 #include <iomanip>
+#include <charconv>
 
 
 //------------------------------------------------------------------------------
@@ -206,32 +208,25 @@ std::pair<sockaddr_storage, socklen_t> to_sockaddr(const boost::asio::ip::udp::e
     return {storage, size};
 }
 
-boost::asio::ip::udp::endpoint sockaddr_to_endpoint(const sockaddr* addr, socklen_t len) {
+bool sockaddr_to_endpoint(const sockaddr* addr, socklen_t len, boost::asio::ip::udp::endpoint& endpoint) {
     if (addr->sa_family == AF_INET) {
-        // IPv4
-        const sockaddr_in* addr_in = reinterpret_cast<const sockaddr_in*>(addr);
         if (len < sizeof(sockaddr_in)) {
-            throw std::runtime_error("Invalid length for IPv4 address");
+            return false;
         }
-        return boost::asio::ip::udp::endpoint(
-            boost::asio::ip::address_v4(addr_in->sin_addr.s_addr),
-            ntohs(addr_in->sin_port)
-        );
+        len = sizeof(sockaddr_in);
     } else if (addr->sa_family == AF_INET6) {
-        // IPv6
-        const sockaddr_in6* addr_in6 = reinterpret_cast<const sockaddr_in6*>(addr);
         if (len < sizeof(sockaddr_in6)) {
-            throw std::runtime_error("Invalid length for IPv6 address");
-        }
-        boost::asio::ip::address_v6::bytes_type bytes;
-        std::memcpy(bytes.data(), addr_in6->sin6_addr.s6_addr, bytes.size());
-        return boost::asio::ip::udp::endpoint(
-            boost::asio::ip::address_v6(bytes),
-            ntohs(addr_in6->sin6_port)
-        );
+            return false;
+        }
+        len = sizeof(sockaddr_in6);
     } else {
-        throw std::runtime_error("Unsupported address family");
+        return false;
     }
+
+    // The endpoint stores a sockaddr, so this is a plain copy
+    std::memcpy(endpoint.data(), addr, len);
+    endpoint.resize(len);
+    return true;
 }
 
 
@@ -371,49 +366,16 @@ const char* quiche_error_to_string(int error) {
 }
 
 
-//------------------------------------------------------------------------------
-// SendAllocator
-
-std::shared_ptr<SendBuffer> SendAllocator::Allocate()
-{
-    std::shared_ptr<SendBuffer> buffer;
-
-    if (free_buffers_count_ > 0) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!free_buffers_.empty()) {
-            buffer = free_buffers_.back();
-            free_buffers_.pop_back();
-            free_buffers_count_--;
-        }
-    }
-
-    if (!buffer) {
-        buffer = std::make_shared<SendBuffer>();
-    }
-
-    return buffer;
-}
-
-void SendAllocator::Free(std::shared_ptr<SendBuffer> buffer)
-{
-    std::lock_guard<std::mutex> lock(mutex_);
-    free_buffers_.push_back(buffer);
-    free_buffers_count_++;
-}
-
-
 //------------------------------------------------------------------------------
 // QuicheSocket
 
 QuicheSocket::QuicheSocket(
     boost::asio::io_context& io_context,
-    DatagramCallback on_datagram,
     uint16_t port,
     const std::string& cert_path,
     const std::string& key_path)
 {
     io_context_ = &io_context;
-    on_datagram_ = on_datagram;
 
     socket_ = std::make_shared<boost::asio::ip::udp::socket>(
         io_context,
@@ -423,6 +385,12 @@ QuicheSocket::QuicheSocket(
     socket_->set_option(boost::asio::socket_base::send_buffer_size(QUIC_SEND_BUFFER_SIZE));
     socket_->set_option(boost::asio::socket_base::reuse_address(true));
 
+    // Lets DrainReceive() read queued datagrams without blocking.
+    // Asynchronous operations are unaffected
+    socket_->non_blocking(true);
+
+    local_endpoint_ = socket_->local_endpoint();
+
     config_ = CreateQuicheConfig(cert_path, key_path);
 
     if (std::getenv("SSLKEYLOGFILE")) {
@@ -444,22 +412,17 @@ QuicheSocket::~QuicheSocket() {
     }
 }
 
-void QuicheSocket::StartReceive() {
-    auto fn = [this](boost::system::error_code ec, std::size_t bytes) {
-        if (!ec && bytes > 0) {
-            on_datagram_(recv_buf_.data(), bytes, sender_endpoint_);
-        }
-        StartReceive();
-    };
-
-    socket_->async_receive_from(
-        boost::asio::buffer(recv_buf_),
-        sender_endpoint_,
-        fn);
+void QuicheSocket::FinishBurst() {
+    // Swap out the list since OnBurstEnd() may lead to new datagrams
+    burst_scratch_.swap(burst_connections_);
+    for (auto& connection : burst_scratch_) {
+        connection->OnBurstEnd();
+    }
+    burst_scratch_.clear();
 }
 
 void QuicheSocket::Send(
-    std::shared_ptr<SendBuffer> buffer,
+    SendBufferPtr buffer,
     const boost::asio::ip::udp::endpoint& dest_endpoint)
 {
     // FIXME: Use sendmsg() for packet pacing here
@@ -469,44 +432,341 @@ void QuicheSocket::Send(
         std::size_t bytes_transferred)
     {
         if (error) {
+            Metrics::Add(Metric::SendErrors);
             LOG_WARN() << "async_send_to failed: " << error.message();
-        } else if (bytes_transferred != static_cast<size_t>(buffer->Length)) {
+            return;
+        }
+        Metrics::Add(Metric::PacketsOut);
+        Metrics::Add(Metric::BytesOut, bytes_transferred);
+        if (bytes_transferred != static_cast<size_t>(buffer->Length)) {
             LOG_WARN() << "async_send_to failed: only " << bytes_transferred << " of " << buffer->Length << " bytes sent";
         }
-        allocator_.Free(buffer);
     };
 
+    std::lock_guard<std::mutex> lock(send_mutex_);
     socket_->async_send_to(
         boost::asio::buffer(buffer->Payload, buffer->Length),
         dest_endpoint,
         fn);
 }
 
+void QuicheSocket::WakeSender()
+{
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    wake_requested_ = true;
+    wake_cv_.notify_one();
+}
+
+void QuicheSocket::WaitForSender(int timeout_msec)
+{
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_cv_.wait_for(lock, std::chrono::milliseconds(timeout_msec), [this] {
+        return wake_requested_;
+    });
+    wake_requested_ = false;
+}
+
+
+//------------------------------------------------------------------------------
+// Stream Priority
+
+StreamPriority ParsePriorityHeader(std::string_view value)
+{
+    StreamPriority priority;
+
+    // Structured field dictionary: Members are separated by commas and each
+    // is a key with an optional "=value" and optional ";parameters"
+    while (!value.empty()) {
+        size_t end = value.find(',');
+        std::string_view member = value.substr(0, end);
+        value = (end == std::string_view::npos) ? std::string_view() : value.substr(end + 1);
+
+        member = member.substr(0, member.find(';'));
+        while (!member.empty() && (member.front() == ' ' || member.front() == '\t')) {
+            member.remove_prefix(1);
+        }
+        while (!member.empty() && (member.back() == ' ' || member.back() == '\t')) {
+            member.remove_suffix(1);
+        }
+
+        const size_t eq = member.find('=');
+        const std::string_view key = member.substr(0, eq);
+        const std::string_view item = (eq == std::string_view::npos) ? std::string_view() : member.substr(eq + 1);
+
+        if (key == "u") {
+            unsigned urgency = 0;
+            auto result = std::from_chars(item.data(), item.data() + item.size(), urgency);
+            if (result.ec == std::errc() && result.ptr == item.data() + item.size() &&
+                urgency <= STREAM_MAX_URGENCY)
+            {
+                priority.Urgency = static_cast<uint8_t>(urgency);
+            }
+        } else if (key == "i") {
+            if (item.empty() || item == "?1") {
+                priority.Incremental = true;
+            } else if (item == "?0") {
+                priority.Incremental = false;
+            }
+        }
+    }
+
+    return priority;
+}
+
+size_t FormatPriorityHeader(const StreamPriority& priority, char* out)
+{
+    size_t length = 0;
+    out[length++] = 'u';
+    out[length++] = '=';
+    out[length++] = static_cast<char>('0' + std::min<int>(priority.Urgency, STREAM_MAX_URGENCY));
+    if (priority.Incremental) {
+        out[length++] = ',';
+        out[length++] = ' ';
+        out[length++] = 'i';
+    }
+    return length;
+}
+
 
 //------------------------------------------------------------------------------
 // IncomingStream
 
-void IncomingStream::OnHeader(const std::string& name, const std::string& value)
+static inline bool header_equals(std::string_view name, const char* expected)
 {
-    if (name == ":method") {
-        Method = value;
-    } else if (name == ":path") {
-        Path = value;
-    } else if (name == ":status") {
-        Status = value;
-    } else if (name == "Authorization") {
-        Authorization = value;
-    } else if (name == "content-type") {
-        ContentType = value;
-    } else if (name == QUICSEND_HEADER_INFO) {
-        HeaderInfo = value;
+    // Caller has already matched the length
+    return std::memcmp(name.data(), expected, name.size()) == 0;
+}
+
+void IncomingStream::OnHeader(std::string_view name, std::string_view value)
+{
+    // Dispatch on the name length first so most headers cost one compare
+    switch (name.size()) {
+    case 5:
+        if (header_equals(name, ":path")) {
+            Path.assign(value.data(), value.size());
+        }
+        break;
+    case 7:
+        if (header_equals(name, ":method")) {
+            Method.assign(value.data(), value.size());
+        } else if (header_equals(name, ":status")) {
+            Status.assign(value.data(), value.size());
+        }
+        break;
+    case 8:
+        if (header_equals(name, "priority")) {
+            Priority = ParsePriorityHeader(value);
+        }
+        break;
+    case 12:
+        if (header_equals(name, "content-type")) {
+            ContentType.assign(value.data(), value.size());
+        }
+        break;
+    case 13:
+        if (header_equals(name, "Authorization")) {
+            Authorization.assign(value.data(), value.size());
+        }
+        break;
+    case 14:
+        if (header_equals(name, "content-length")) {
+            // Size the body buffer up front so small bodies fill without
+            // regrowing.  The peer controls this value and has not been
+            // authorized yet, so the reservation is capped
+            uint64_t length = 0;
+            std::from_chars(value.data(), value.data() + value.size(), length);
+            const uint64_t max_reserve = MAX_CONTENT_LENGTH_RESERVE;
+            Buffer.reserve(static_cast<size_t>(std::min(length, max_reserve)));
+        }
+        break;
+    case sizeof(QUICSEND_HEADER_INFO) - 1:
+        if (header_equals(name, QUICSEND_HEADER_INFO)) {
+            HeaderInfo.assign(value.data(), value.size());
+        }
+        break;
+    default:
+        break;
     }
 }
 
 void IncomingStream::OnData(const void* data, size_t bytes)
 {
-    const uint8_t* data8 = reinterpret_cast<const uint8_t*>(data);
-    Buffer.insert(Buffer.end(), data8, data8 + bytes);
+    Buffer.append(data, bytes);
+}
+
+void IncomingStream::Reset()
+{
+    Id = 0;
+    Method.clear();
+    Path.clear();
+    Status.clear();
+    Authorization.clear();
+    ContentType.clear();
+    HeaderInfo.clear();
+    Priority = StreamPriority();
+    Buffer.Release();
+}
+
+void intrusive_ptr_add_ref(IncomingStream* stream)
+{
+    stream->RefCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(IncomingStream* stream)
+{
+    if (stream->RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        Metrics::Sub(Metric::IncomingStreams);
+        ObjectPool<IncomingStream>::Recycle(stream);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// QueuedBody
+
+void QueuedBody::Assign(
+    const BodySegment* segments,
+    int segment_count,
+    int64_t offset,
+    const std::shared_ptr<void>& owner)
+{
+    Release();
+
+    if (owner) {
+        Owner = owner;
+        Segments.reserve(segment_count);
+        for (int i = 0; i < segment_count; ++i) {
+            if (segments[i].Length > 0) {
+                Segments.push_back(segments[i]);
+            }
+        }
+        if (!Segments.empty()) {
+            Offset = offset;
+        }
+        return;
+    }
+
+    // The caller's memory is gone after the call returns, so copy it
+    int64_t total = -offset;
+    for (int i = 0; i < segment_count; ++i) {
+        total += segments[i].Length;
+    }
+    if (total <= 0) {
+        return;
+    }
+    Copy.reserve(total);
+    for (int i = 0; i < segment_count; ++i) {
+        if (segments[i].Length <= offset) {
+            offset -= std::max<int64_t>(segments[i].Length, 0);
+            continue;
+        }
+        Copy.append(segments[i].Data + offset, segments[i].Length - offset);
+        offset = 0;
+    }
+
+    BodySegment segment;
+    segment.Data = Copy.data();
+    segment.Length = Copy.size();
+    Segments.push_back(segment);
+}
+
+int64_t QueuedBody::Remaining() const
+{
+    int64_t remaining = -Offset;
+    for (size_t i = Index; i < Segments.size(); ++i) {
+        remaining += Segments[i].Length;
+    }
+    return std::max<int64_t>(remaining, 0);
+}
+
+void QueuedBody::Consume(int64_t bytes)
+{
+    while (bytes > 0 && Index < Segments.size()) {
+        const int64_t left = Segments[Index].Length - Offset;
+        if (bytes < left) {
+            Offset += bytes;
+            return;
+        }
+        bytes -= left;
+        ++Index;
+        Offset = 0;
+    }
+}
+
+void QueuedBody::Release()
+{
+    Segments.clear();
+    Index = 0;
+    Offset = 0;
+    Owner.reset();
+    Copy.Release();
+}
+
+
+//------------------------------------------------------------------------------
+// OutgoingStream
+
+void OutgoingStream::Reset()
+{
+    Id = 0;
+    Urgency = STREAM_DEFAULT_URGENCY;
+    WrittenBytes = 0;
+    Body.Release();
+}
+
+
+//------------------------------------------------------------------------------
+// Header Templates
+
+int HeaderTemplate::Add(const char* name, const std::string& value)
+{
+    values_.push_back(std::make_unique<std::string>(value));
+    const std::string& stored = *values_.back();
+
+    quiche_h3_header header;
+    header.name = reinterpret_cast<const uint8_t*>(name);
+    header.name_len = std::strlen(name);
+    header.value = reinterpret_cast<const uint8_t*>(stored.data());
+    header.value_len = stored.size();
+    headers_.push_back(header);
+
+    if (headers_.size() > MAX_TEMPLATE_HEADERS) {
+        throw std::runtime_error("HeaderTemplate: Too many headers");
+    }
+    return static_cast<int>(headers_.size() - 1);
+}
+
+HeaderBlock::HeaderBlock(const HeaderTemplate& header_template)
+{
+    count_ = header_template.size();
+    std::copy(header_template.data(), header_template.data() + count_, headers_.begin());
+}
+
+void HeaderBlock::Set(int index, const char* value, size_t length)
+{
+    headers_[index].value = reinterpret_cast<const uint8_t*>(value);
+    headers_[index].value_len = length;
+}
+
+bool HeaderBlock::Append(const char* name, const char* value, size_t length)
+{
+    if (count_ >= headers_.size()) {
+        LOG_ERROR() << "HeaderBlock: Too many headers to add " << name;
+        return false;
+    }
+
+    quiche_h3_header& header = headers_[count_++];
+    header.name = reinterpret_cast<const uint8_t*>(name);
+    header.name_len = std::strlen(name);
+    header.value = reinterpret_cast<const uint8_t*>(value);
+    header.value_len = length;
+    return true;
+}
+
+void HeaderBlock::SetInt(int index, int64_t value)
+{
+    auto result = std::to_chars(number_, number_ + sizeof(number_), value);
+    Set(index, number_, result.ptr - number_);
 }
 
 
@@ -521,10 +781,29 @@ void QuicheConnection::Initialize(const QCSettings& settings)
         *settings.qs->io_context_);
     quiche_timer_ = std::make_shared<boost::asio::deadline_timer>(
         *settings.qs->io_context_);
+
+    flight_.Initialize(settings.flight.Events);
+
+    Metrics::Add(Metric::ConnectionsOpened);
+    Metrics::Add(Metric::ConnectionsActive);
 }
 
 QuicheConnection::~QuicheConnection() {
+    outgoing_streams_.ForEach([](OutgoingStream* stream) {
+        Metrics::Sub(Metric::OutgoingStreamsQueued);
+        ObjectPool<OutgoingStream>::Recycle(stream);
+    });
+    Metrics::Sub(Metric::CachedResponses, response_cache_.size());
+
+    if (settings_.qs) {
+        Metrics::Add(Metric::ConnectionsClosed);
+        Metrics::Sub(Metric::ConnectionsActive);
+    }
+
     if (conn_) {
+        if (settings_.qlog) {
+            settings_.qlog->Detach(conn_);
+        }
         quiche_conn_free(conn_);
     }
     if (http3_) {
@@ -539,19 +818,24 @@ bool QuicheConnection::Accept(
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
-    auto [local_addr, local_size] = to_sockaddr(settings_.qs->socket_->local_endpoint());
-    auto [peer_addr, peer_size] = to_sockaddr(client_endpoint);
+    is_server_ = true;
+    local_endpoint_ = settings_.qs->local_endpoint_;
+    peer_endpoint_ = client_endpoint;
 
     conn_ = quiche_accept(
         dcid.data(), dcid.Length,
         odcid.data(), odcid.Length,
-        reinterpret_cast<struct sockaddr *>(&local_addr), local_size,
-        reinterpret_cast<struct sockaddr *>(&peer_addr), peer_size,
+        local_endpoint_.data(), local_endpoint_.size(),
+        peer_endpoint_.data(), peer_endpoint_.size(),
         settings_.qs->config_); 
     if (!conn_) {
         LOG_ERROR() << "quiche_accept: Failed to create connection";
         return false;
     }
+
+    if (settings_.qlog) {
+        settings_.qlog->Attach(conn_, settings_.AssignedId, peer_endpoint_, true);
+    }
     return true;
 }
 
@@ -559,28 +843,37 @@ bool QuicheConnection::Connect(boost::asio::ip::udp::endpoint server_endpoint)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
+    local_endpoint_ = settings_.qs->local_endpoint_;
     peer_endpoint_ = server_endpoint;
 
-    ConnectionId scid;
-    scid.Randomize();
-
-    auto [local_addr, local_size] = to_sockaddr(settings_.qs->socket_->local_endpoint());
-    auto [peer_addr, peer_size] = to_sockaddr(server_endpoint);
+    // A retry replaces the connection that never finished its handshake
+    if (conn_) {
+        if (settings_.qlog) {
+            settings_.qlog->Detach(conn_);
+        }
+        quiche_conn_free(conn_);
+        conn_ = nullptr;
+    }
 
-    sockaddr* local_sa = reinterpret_cast<sockaddr*>(&local_addr);
-    sockaddr* peer_sa = reinterpret_cast<sockaddr*>(&peer_addr);
+    // Packets from the server carry our source id as their destination,
+    // so the id the sender knows us by is also the one we advertise
+    const ConnectionId& scid = settings_.dcid;
 
     conn_ = quiche_connect(
         QUIC_TLS_CNAME,
         scid.data(), scid.Length,
-        local_sa, local_size,
-        peer_sa, peer_size,
+        local_endpoint_.data(), local_endpoint_.size(),
+        peer_endpoint_.data(), peer_endpoint_.size(),
         settings_.qs->config_);
     if (!conn_) {
         LOG_ERROR() << "quiche_connect: Failed to create connection";
         return false;
     }
 
+    if (settings_.qlog) {
+        settings_.qlog->Attach(conn_, settings_.AssignedId, peer_endpoint_, false);
+    }
+
     connection_timer_->expires_from_now(boost::posix_time::milliseconds(QUIC_CONNECT_TIMEOUT_MSEC));
     connection_timer_->async_wait([this, server_endpoint](const boost::system::error_code& ec) {
         if (ec) {
@@ -594,6 +887,7 @@ bool QuicheConnection::Connect(boost::asio::ip::udp::endpoint server_endpoint)
         }
 
         LOG_INFO() << "Connection timed out: Retrying";
+        flight_.Record(FlightEvent::ConnectRetry);
 
         Connect(server_endpoint);
     });
@@ -603,18 +897,18 @@ bool QuicheConnection::Connect(boost::asio::ip::udp::endpoint server_endpoint)
 void QuicheConnection::OnDatagram(
     uint8_t* data,
     std::size_t bytes,
-    boost::asio::ip::udp::endpoint peer_endpoint)
+    const boost::asio::ip::udp::endpoint& peer_endpoint)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
-    peer_endpoint_ = peer_endpoint;
-
-    auto [peer_addr, peer_size] = to_sockaddr(peer_endpoint);
-    auto [local_addr, local_size] = to_sockaddr(settings_.qs->socket_->local_endpoint());
+    // Only copies if the peer migrated
+    if (peer_endpoint != peer_endpoint_) {
+        peer_endpoint_ = peer_endpoint;
+    }
 
     quiche_recv_info recv_info = {
-        reinterpret_cast<struct sockaddr *>(&peer_addr), peer_size,
-        reinterpret_cast<struct sockaddr *>(&local_addr), local_size,
+        peer_endpoint_.data(), static_cast<socklen_t>(peer_endpoint_.size()),
+        local_endpoint_.data(), static_cast<socklen_t>(local_endpoint_.size()),
     };
 
     ssize_t done = quiche_conn_recv(
@@ -623,9 +917,33 @@ void QuicheConnection::OnDatagram(
         bytes,
         &recv_info);
     if (done < 0) {
+        flight_.Record(FlightEvent::RecvError, static_cast<uint64_t>(-done));
+        Metrics::Add(Metric::RecvErrors);
         LOG_ERROR() << "quiche_conn_recv failed to process packet: " << done << " " << quiche_error_to_string(done);
         return;
     }
+    QS_TRACE2(packet_recv, settings_.AssignedId, bytes);
+    flight_.Record(FlightEvent::PacketRecv, bytes);
+
+    if (!burst_pending_) {
+        burst_pending_ = true;
+        settings_.qs->burst_connections_.push_back(shared_from_this());
+    }
+}
+
+void QuicheConnection::OnBurstEnd()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    ProcessBurst();
+    DispatchSignals();
+}
+
+void QuicheConnection::ProcessBurst()
+{
+    // Called from function with lock held
+
+    burst_pending_ = false;
 
     if (quiche_conn_is_established(conn_)) {
         if (!http3_) {
@@ -635,7 +953,9 @@ void QuicheConnection::OnDatagram(
                 return;
             }
 
-            settings_.on_connect(settings_.AssignedId, peer_endpoint_);
+            flight_.Record(FlightEvent::Established);
+            signals_.Connected = true;
+            signals_pending_ = true;
         }
 
         ProcessH3Events();
@@ -643,13 +963,34 @@ void QuicheConnection::OnDatagram(
 
     if (!timeout_) {
         if (quiche_conn_is_closed(conn_)) {
-            settings_.on_timeout(settings_.AssignedId);
-            timeout_ = true;
+            OnClosed();
             return;
         }
     }
 
-    FlushEgress();
+    // ACKs and the data they unblock go out now, up to one turn
+    SendBufferPtr buffer;
+    const int64_t sent = WriteEgress(buffer, QUIC_SEND_TURN_BYTES);
+    unscheduled_bytes_.fetch_add(sent, std::memory_order_relaxed);
+    if (sent >= QUIC_SEND_TURN_BYTES) {
+        settings_.qs->WakeSender();
+    }
+}
+
+void QuicheConnection::RunSignalDispatch()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    // Signals raised by the handler are picked up by the running loop
+    if (dispatching_ || !signal_dispatch_) {
+        return;
+    }
+    dispatching_ = true;
+    CallbackScope dispatch_scope([this]() { dispatching_ = false; });
+
+    while (signals_pending_.exchange(false)) {
+        signal_dispatch_(this);
+    }
 }
 
 void QuicheConnection::Close(const char* reason) {
@@ -668,14 +1009,44 @@ void QuicheConnection::Close(const char* reason) {
     }
 }
 
+void QuicheConnection::OnClosed() {
+    // Called from function with lock held
+
+    if (timeout_) {
+        return;
+    }
+    signals_.TimedOut = true;
+    signals_pending_ = true;
+    timeout_ = true;
+
+    bool is_app = false;
+    uint64_t error_code = 0;
+    const uint8_t* reason = nullptr;
+    size_t reason_len = 0;
+    if (!quiche_conn_peer_error(conn_, &is_app, &error_code, &reason, &reason_len)) {
+        quiche_conn_local_error(conn_, &is_app, &error_code, &reason, &reason_len);
+    }
+
+    const bool timed_out = quiche_conn_is_timed_out(conn_);
+    flight_.Record(FlightEvent::Closed, timed_out ? 1 : 0, error_code);
+
+    // Idle connections timing out are expected and not worth a dump
+    const bool in_flight = outgoing_streams_.Count() > 0 ||
+        incoming_streams_.Count() > 0 ||
+        !response_cache_.empty();
+    if (timed_out &&
+        in_flight &&
+        settings_.flight.DumpOnTimeout)
+    {
+        DumpFlightRecorder("timeout");
+    }
+}
+
 void QuicheConnection::TickTimeout() {
     // Called from function with lock held
 
     if (quiche_conn_is_closed(conn_)) {
-        if (!timeout_) {
-            settings_.on_timeout(settings_.AssignedId);
-        }
-        timeout_ = true;
+        OnClosed();
         return;
     }
 
@@ -703,20 +1074,46 @@ void QuicheConnection::TickTimeout() {
 
         std::lock_guard<std::recursive_mutex> lock(mutex_);
 
+        flight_.Record(FlightEvent::TimerFired);
         quiche_conn_on_timeout(conn_);
         FlushEgress(); // Flush egress to ensure that disconnection message is sent
     });
 }
 
-bool QuicheConnection::FlushEgress(std::shared_ptr<SendBuffer>& buffer) {
+bool QuicheConnection::FlushEgress(SendBufferPtr& buffer) {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
+    int64_t sent = WriteEgress(buffer, QUIC_SEND_TURN_BYTES);
+    unscheduled_bytes_.fetch_add(sent, std::memory_order_relaxed);
+    if (sent >= QUIC_SEND_TURN_BYTES) {
+        settings_.qs->WakeSender();
+    }
+    DispatchSignals();
+    return sent > 0;
+}
+
+int64_t QuicheConnection::FlushEgress(SendBufferPtr& buffer, int64_t max_bytes) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    int64_t sent = WriteEgress(buffer, max_bytes);
+    DispatchSignals();
+    return sent;
+}
+
+int64_t QuicheConnection::WriteEgress(SendBufferPtr& buffer, int64_t max_bytes) {
+    // Called from function with lock held
+
     FlushCachedResponses();
     FlushTransfers();
 
-    bool sent = false;
+    int64_t sent = 0;
 
-    for (;;) {
+    // Packets quiche releases in the future are being paced
+    const int64_t now_nsec = GetNsec();
+    int64_t paced_bytes = 0;
+    int64_t paced_until_nsec = now_nsec;
+
+    while (sent < max_bytes) {
         if (!buffer) {
             buffer = settings_.qs->allocator_.Allocate();
         }
@@ -735,17 +1132,41 @@ bool QuicheConnection::FlushEgress(std::shared_ptr<SendBuffer>& buffer) {
             return sent;
         }
         buffer->Length = written;
+        QS_TRACE2(packet_send, settings_.AssignedId, written);
 
-        auto dest_endpoint = sockaddr_to_endpoint(
-            reinterpret_cast<struct sockaddr *>(&send_info.to),
-            send_info.to_len); 
+        const sockaddr* to = reinterpret_cast<const sockaddr*>(&send_info.to);
+        if (send_info.to_len == peer_endpoint_.size() &&
+            std::memcmp(to, peer_endpoint_.data(), send_info.to_len) == 0)
+        {
+            // Common case: Sending to the current peer address
+            settings_.qs->Send(buffer, peer_endpoint_);
+        } else {
+            boost::asio::ip::udp::endpoint dest_endpoint;
+            if (!sockaddr_to_endpoint(to, send_info.to_len, dest_endpoint)) {
+                LOG_ERROR() << "quiche_conn_send: Unsupported destination address family " << to->sa_family;
+                continue;
+            }
+            settings_.qs->Send(buffer, dest_endpoint);
+        }
+        sent += written;
 
-        settings_.qs->Send(buffer, dest_endpoint);
-        sent = true;
+        const int64_t at_nsec = send_info.at.tv_sec * 1000000000LL + send_info.at.tv_nsec;
+        if (at_nsec > now_nsec) {
+            paced_bytes += written;
+            paced_until_nsec = std::max(paced_until_nsec, at_nsec);
+        }
+        flight_.Record(FlightEvent::PacketSend, written,
+            at_nsec > now_nsec ? (at_nsec - now_nsec) / 1000 : 0);
 
         buffer = settings_.qs->allocator_.Allocate();
     }
 
+    if (paced_bytes > 0 && paced_until_nsec > now_nsec) {
+        // Exponential moving average with weight 1/8
+        const uint64_t rate = paced_bytes * 1000000000ULL / (paced_until_nsec - now_nsec);
+        pacing_rate_ = (pacing_rate_ == 0) ? rate : pacing_rate_ - pacing_rate_ / 8 + rate / 8;
+    }
+
     TickTimeout();
 
     return sent;
@@ -766,30 +1187,40 @@ void QuicheConnection::ProcessH3Events() {
         CallbackScope ev_scope([ev]() { quiche_h3_event_free(ev); });
 
         auto event_type = quiche_h3_event_type(ev);
+        QS_TRACE3(h3_event, settings_.AssignedId, stream_id, static_cast<int>(event_type));
+
         switch (event_type) {
             case QUICHE_H3_EVENT_HEADERS: {
                 //LOG_INFO() << "Received headers: stream_id=" << stream_id;
                 auto stream = GetIncomingStream(stream_id);
 
-                using cb_t = std::function<bool(const std::string&, const std::string&)>;
-                cb_t cb = [this, stream](const std::string& name, const std::string& value) -> bool {
-                    stream->OnHeader(name, value);
-                    //LOG_INFO() << "Header: " << name << ": " << value;
-                    return true; // Return false to stop iterating
-                };
-
-                // C++ adapter for C callback
+                // Header name and value point into the event, so no copies are made
                 auto ccb = [](uint8_t* name, size_t name_len,
                                     uint8_t* value, size_t value_len,
                                     void* argp) -> int {
-                    cb_t* cb = reinterpret_cast<cb_t*>(argp);
-                    if (!(*cb)(std::string(reinterpret_cast<char*>(name), name_len),
-                                std::string(reinterpret_cast<char*>(value), value_len))) {
-                        return -1;
-                    }
-                    return 0;
+                    IncomingStream* stream = reinterpret_cast<IncomingStream*>(argp);
+                    stream->OnHeader(
+                        std::string_view(reinterpret_cast<const char*>(name), name_len),
+                        std::string_view(reinterpret_cast<const char*>(value), value_len));
+                    return 0; // Return non-zero to stop iterating
                 };
-                quiche_h3_event_for_each_header(ev, ccb, &cb);
+                quiche_h3_event_for_each_header(ev, ccb, stream);
+                flight_.Record(FlightEvent::StreamHeaders, stream_id);
+
+                const int64_t now_nsec = GetNsec();
+                RequestTiming* timing = request_timings_.Find(stream_id);
+                if (is_server_) {
+                    if (!timing) {
+                        RequestTiming& request = request_timings_.Insert(stream_id, RequestTiming());
+                        request.StartNsec = now_nsec;
+                        if (settings_.latency) {
+                            request.PathLatency = settings_.latency->ForPath(stream->Path);
+                        }
+                    }
+                } else if (timing && timing->PeerHeadersNsec == 0) {
+                    timing->PeerHeadersNsec = now_nsec;
+                    RecordLatency(*timing, now_nsec, false);
+                }
                 break;
             }
 
@@ -809,6 +1240,7 @@ void QuicheConnection::ProcessH3Events() {
                     }
                     if (len > 0) {
                         stream->OnData(buffer.data(), len);
+                        flight_.Record(FlightEvent::StreamData, stream_id, stream->Buffer.size());
                     } else {
                         LOG_ERROR() << "*** quiche_h3_recv_body failed: " << len << " " << quiche_error_to_string(len);
                     }
@@ -818,45 +1250,57 @@ void QuicheConnection::ProcessH3Events() {
 
             case QUICHE_H3_EVENT_FINISHED: {
                 //LOG_INFO() << "QUICHE_H3_EVENT_FINISHED: stream_id=" << stream_id;
-                std::shared_ptr<IncomingStream> stream;
-
-                auto it = incoming_streams_by_id_.find(stream_id);
-                if (it != incoming_streams_by_id_.end()) {
-                    stream = it->second;
-                } else {
+                IncomingStreamPtr stream;
+                if (!incoming_streams_.Erase(stream_id, &stream)) {
                     break; // Ignore FINISHED events for streams that have been destroyed
                 }
-                incoming_streams_by_id_.erase(it);
 
-                QuicheMailbox::Event event;
-                event.Type = QuicheMailbox::EventType::Data;
-                event.PeerEndpoint = peer_endpoint_;
-                event.ConnectionAssignedId = settings_.AssignedId;
-                event.Stream = stream;
-
-                settings_.on_data(event);
+                if (!stream->Priority.IsDefault()) {
+                    requested_priorities_.emplace_back(stream_id, stream->Priority);
+                }
 
-                // After client gets a response, destroy the stream
-                if (!settings_.IsServer) {
-                    DestroyStream(stream_id);
+                RequestTiming* timing = request_timings_.Find(stream_id);
+                if (timing) {
+                    timing->FinishedNsec = GetNsec();
+                    if (!is_server_) {
+                        FinishRequestTiming(stream_id, timing->FinishedNsec);
+                    }
                 }
+
+                QS_TRACE3(stream_finish, settings_.AssignedId, stream_id, stream->Buffer.size());
+                flight_.Record(FlightEvent::StreamFinished, stream_id, stream->Buffer.size());
+                signals_.Finished.push_back(std::move(stream));
+                signals_pending_ = true;
                 break;
             }
 
             case QUICHE_H3_EVENT_RESET: {
                 //LOG_INFO() << "QUICHE_H3_EVENT_RESET: stream_id=" << stream_id;
+                flight_.Record(FlightEvent::StreamReset, stream_id);
                 DestroyStream(stream_id);
                 break;
             }
 
-            case QUICHE_H3_EVENT_PRIORITY_UPDATE:
+            case QUICHE_H3_EVENT_PRIORITY_UPDATE: {
+                // The stream id is the request the client reprioritized
+                StreamPriority priority;
+                auto pcb = [](uint8_t* value, uint64_t value_len, void* argp) -> int {
+                    *reinterpret_cast<StreamPriority*>(argp) = ParsePriorityHeader(
+                        std::string_view(reinterpret_cast<const char*>(value), value_len));
+                    return 0;
+                };
+                if (quiche_h3_take_last_priority_update(http3_, stream_id, pcb, &priority) == 0) {
+                    OnPriorityUpdate(stream_id, priority);
+                }
                 break;
+            }
 
             case QUICHE_H3_EVENT_GOAWAY: {
                 // Note: stream_id is invalid here:
                 // The event GoAway returns an ID that depends on the connection role. A client receives the largest processed stream ID. A server receives the the largest permitted push ID.
                 const char* reason = "Received GOAWAY";
                 LOG_INFO() << "Connection aborted: " << reason;
+                flight_.Record(FlightEvent::GoAway);
                 quiche_conn_close(conn_, true, 0, (const uint8_t*)reason, strlen(reason));
                 // FIXME: Better way to do this?
                 break;
@@ -869,78 +1313,252 @@ void QuicheConnection::ProcessH3Events() {
     }
 }
 
-std::shared_ptr<IncomingStream> QuicheConnection::GetIncomingStream(uint64_t stream_id, bool create) {
+IncomingStream* QuicheConnection::GetIncomingStream(uint64_t stream_id, bool create) {
     // Called from function with lock held
 
-    auto it = incoming_streams_by_id_.find(stream_id);
-    if (it != incoming_streams_by_id_.end()) {
-        return it->second;
+    IncomingStreamPtr* found = incoming_streams_.Find(stream_id);
+    if (found) {
+        return found->get();
     }
 
     if (!create) {
         return nullptr;
     }
 
-    auto stream = std::make_shared<IncomingStream>();
+    IncomingStreamPtr stream(ObjectPool<IncomingStream>::Acquire());
     stream->Id = stream_id;
-    incoming_streams_by_id_[stream_id] = stream;
-    return stream;
+    Metrics::Add(Metric::IncomingStreams);
+    QS_TRACE3(stream_open, settings_.AssignedId, stream_id, 0);
+    return incoming_streams_.Insert(stream_id, std::move(stream)).get();
 }
 
-std::shared_ptr<OutgoingStream> QuicheConnection::GetOutgoingStream(uint64_t stream_id, bool create) {
+OutgoingStream* QuicheConnection::GetOutgoingStream(uint64_t stream_id, uint8_t urgency) {
     // Called from function with lock held
 
-    auto it = outgoing_streams_by_id_.find(stream_id);
-    if (it != outgoing_streams_by_id_.end()) {
-        return it->second;
-    }
-
-    if (!create) {
-        return nullptr;
+    OutgoingStream** found = outgoing_streams_.Find(stream_id);
+    if (found) {
+        return *found;
     }
 
-    auto stream = std::make_shared<OutgoingStream>();
+    OutgoingStream* stream = ObjectPool<OutgoingStream>::Acquire();
     stream->Id = stream_id;
-    outgoing_streams_by_id_[stream_id] = stream;
+    stream->Urgency = urgency;
+    outgoing_streams_.Insert(stream_id, stream);
+    Metrics::Add(Metric::OutgoingStreamsQueued);
+
+    // Behind streams of the same or higher priority, ahead of the rest
+    auto it = std::upper_bound(active_outgoing_.begin(), active_outgoing_.end(), urgency,
+        [](uint8_t value, const OutgoingStream* other) { return value < other->Urgency; });
+    active_outgoing_.insert(it, stream);
     return stream;
 }
 
-void QuicheConnection::DestroyStream(uint64_t stream_id) {
+StreamPriority QuicheConnection::TakeRequestedPriority(uint64_t stream_id) {
     // Called from function with lock held
 
-    quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_READ, 0);
-    quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_WRITE, 0);
-
-    auto it = incoming_streams_by_id_.find(stream_id);
-    if (it != incoming_streams_by_id_.end()) {
-        incoming_streams_by_id_.erase(it);
-    }
-
-    auto ot = outgoing_streams_by_id_.find(stream_id);
-    if (ot != outgoing_streams_by_id_.end()) {
-        outgoing_streams_by_id_.erase(ot);
+    for (auto it = requested_priorities_.begin(); it != requested_priorities_.end(); ++it) {
+        if (it->first == stream_id) {
+            StreamPriority priority = it->second;
+            requested_priorities_.erase(it);
+            return priority;
+        }
     }
+    return StreamPriority();
 }
 
-int64_t QuicheConnection::SendRequest(
-    const std::vector<std::pair<std::string, std::string>>& headers,
-    const void* data,
-    int bytes)
-{
-    if (timeout_) {
-        return -1;
+void QuicheConnection::OnPriorityUpdate(uint64_t stream_id, const StreamPriority& priority) {
+    // Called from function with lock held
+
+    // Requests have a timing from their headers until the response finishes
+    RequestTiming* timing = request_timings_.Find(stream_id);
+    if (!timing) {
+        return;
     }
 
-    std::vector<quiche_h3_header> h3_headers;
-    for (const auto& header : headers) {
-        h3_headers.push_back(quiche_h3_header{
-            reinterpret_cast<const uint8_t*>(header.first.c_str()),
-            header.first.length(),
-            reinterpret_cast<const uint8_t*>(header.second.c_str()),
-            header.second.length()
-        });
+    if (timing->HeadersSentNsec != 0) {
+        ReprioritizeStream(stream_id, priority);
+        return;
     }
 
+    for (auto& cached_response : response_cache_) {
+        if (cached_response->stream_id == stream_id) {
+            cached_response->priority = priority;
+            return;
+        }
+    }
+
+    IncomingStreamPtr* incoming = incoming_streams_.Find(stream_id);
+    if (incoming) {
+        (*incoming)->Priority = priority;
+        return;
+    }
+
+    // The request finished and is waiting for its response
+    TakeRequestedPriority(stream_id);
+    if (!priority.IsDefault()) {
+        requested_priorities_.emplace_back(stream_id, priority);
+    }
+}
+
+void QuicheConnection::ReprioritizeStream(uint64_t stream_id, const StreamPriority& priority) {
+    // Called from function with lock held
+
+    quiche_conn_stream_priority(conn_, stream_id, priority.Urgency, priority.Incremental);
+
+    OutgoingStream** found = outgoing_streams_.Find(stream_id);
+    if (!found) {
+        return;
+    }
+    OutgoingStream* stream = *found;
+    stream->Urgency = priority.Urgency;
+
+    auto it = std::find(active_outgoing_.begin(), active_outgoing_.end(), stream);
+    if (it == active_outgoing_.end()) {
+        return;
+    }
+    active_outgoing_.erase(it);
+
+    // Same position rule as GetOutgoingStream()
+    it = std::upper_bound(active_outgoing_.begin(), active_outgoing_.end(), stream->Urgency,
+        [](uint8_t value, const OutgoingStream* other) { return value < other->Urgency; });
+    active_outgoing_.insert(it, stream);
+}
+
+void QuicheConnection::DestroyOutgoingStream(uint64_t stream_id) {
+    // Called from function with lock held
+
+    OutgoingStream* stream = nullptr;
+    if (!outgoing_streams_.Erase(stream_id, &stream)) {
+        return;
+    }
+
+    auto it = std::find(active_outgoing_.begin(), active_outgoing_.end(), stream);
+    if (it != active_outgoing_.end()) {
+        active_outgoing_.erase(it);
+    }
+    Metrics::Sub(Metric::OutgoingStreamsQueued);
+    ObjectPool<OutgoingStream>::Recycle(stream);
+}
+
+void QuicheConnection::DestroyStream(uint64_t stream_id) {
+    // Called from function with lock held
+
+    quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_READ, 0);
+    quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_WRITE, 0);
+
+    incoming_streams_.Erase(stream_id);
+    request_timings_.Erase(stream_id);
+    DestroyOutgoingStream(stream_id);
+    if (!requested_priorities_.empty()) {
+        TakeRequestedPriority(stream_id);
+    }
+}
+
+void QuicheConnection::OnBodySent(uint64_t stream_id) {
+    // Called from function with lock held
+
+    RequestTiming* timing = request_timings_.Find(stream_id);
+    if (timing && timing->BodySentNsec == 0) {
+        timing->BodySentNsec = GetNsec();
+    }
+}
+
+void QuicheConnection::OnResponseHeadersSent(uint64_t stream_id) {
+    // Called from function with lock held
+
+    if (!is_server_) {
+        return;
+    }
+    RequestTiming* timing = request_timings_.Find(stream_id);
+    if (timing && timing->HeadersSentNsec == 0) {
+        timing->HeadersSentNsec = GetNsec();
+        RecordLatency(*timing, timing->HeadersSentNsec, false);
+    }
+}
+
+void QuicheConnection::OnLocalFinished(uint64_t stream_id) {
+    // Called from function with lock held
+
+    // The client is done when the response finishes, not its request
+    if (is_server_) {
+        FinishRequestTiming(stream_id, GetNsec());
+    }
+}
+
+void QuicheConnection::RecordLatency(const RequestTiming& timing, int64_t now_nsec, bool last_byte) {
+    const int64_t usec = (now_nsec - timing.StartNsec) / 1000;
+
+    if (last_byte) {
+        latency_.LastByte.Record(usec);
+        if (timing.PathLatency) {
+            timing.PathLatency->LastByte.Record(usec);
+        }
+    } else {
+        latency_.FirstByte.Record(usec);
+        if (timing.PathLatency) {
+            timing.PathLatency->FirstByte.Record(usec);
+        }
+    }
+}
+
+void QuicheConnection::FinishRequestTiming(uint64_t stream_id, int64_t now_nsec) {
+    // Called from function with lock held
+
+    RequestTiming timing;
+    if (!request_timings_.Erase(stream_id, &timing)) {
+        return;
+    }
+    RecordLatency(timing, now_nsec, true);
+
+    auto since_start = [&timing](int64_t nsec) -> int64_t {
+        return nsec ? (nsec - timing.StartNsec) / 1000 : -1;
+    };
+    LOG_DEBUG() << "Request timing (usec): stream=" << stream_id
+        << " headers_sent=" << since_start(timing.HeadersSentNsec)
+        << " body_sent=" << since_start(timing.BodySentNsec)
+        << " peer_headers=" << since_start(timing.PeerHeadersNsec)
+        << " peer_finished=" << since_start(timing.FinishedNsec)
+        << " done=" << since_start(now_nsec);
+}
+
+static int64_t segments_length(const BodySegment* segments, int segment_count)
+{
+    int64_t total = 0;
+    for (int i = 0; i < segment_count; ++i) {
+        total += segments[i].Length;
+    }
+    return total;
+}
+
+int64_t QuicheConnection::SendRequest(
+    const quiche_h3_header* headers,
+    size_t header_count,
+    const BodySegment* segments,
+    int segment_count,
+    const std::shared_ptr<void>& owner,
+    const StreamPriority& priority)
+{
+    if (timeout_) {
+        return -1;
+    }
+
+    const int64_t submit_nsec = GetNsec();
+    const int64_t bytes = segments_length(segments, segment_count);
+
+    RequestLatency* path_latency = nullptr;
+    if (settings_.latency) {
+        for (size_t i = 0; i < header_count; ++i) {
+            if (std::string_view(reinterpret_cast<const char*>(headers[i].name), headers[i].name_len) == ":path") {
+                path_latency = settings_.latency->ForPath(
+                    std::string_view(reinterpret_cast<const char*>(headers[i].value), headers[i].value_len));
+                break;
+            }
+        }
+    }
+
+    // Set while flow control holds the request back
+    int64_t blocked_nsec = 0;
+
     while (!timeout_) {
         // Hold lock while sending request
         {
@@ -949,8 +1567,8 @@ int64_t QuicheConnection::SendRequest(
             int64_t stream_id = quiche_h3_send_request(
                 http3_,
                 conn_,
-                h3_headers.data(),
-                h3_headers.size(),
+                headers,
+                header_count,
                 (bytes <= 0)/*fin*/);
 
             // If request is blocked by flow control:
@@ -958,13 +1576,33 @@ int64_t QuicheConnection::SendRequest(
                 && quiche_conn_is_established(conn_)) { 
                 // Sleep for a while to allow flow control to drain and retry (below)
                 //LOG_INFO() << "Request blocked by flow control, retrying";
+                if (blocked_nsec == 0) {
+                    blocked_nsec = GetNsec();
+                    QS_TRACE2(request_blocked, settings_.AssignedId, stream_id);
+                    flight_.Record(FlightEvent::RequestBlocked, static_cast<uint64_t>(-stream_id));
+                }
             } else {
                 if (stream_id < 0) {
                     LOG_ERROR() << "failed to send request: " << stream_id << " " << quiche_h3_error_to_string(stream_id);
                     return -1;
                 }
 
-                SendBody(stream_id, data, bytes);
+                if (!priority.IsDefault()) {
+                    quiche_conn_stream_priority(conn_, stream_id, priority.Urgency, priority.Incremental);
+                }
+
+                RequestTiming& timing = request_timings_.Insert(stream_id, RequestTiming());
+                timing.StartNsec = submit_nsec;
+                timing.HeadersSentNsec = GetNsec();
+                timing.PathLatency = path_latency;
+
+                flight_.Record(FlightEvent::RequestSent, stream_id, bytes);
+                QS_TRACE3(stream_open, settings_.AssignedId, stream_id, 1);
+                QS_TRACE3(request_sent, settings_.AssignedId, stream_id,
+                    blocked_nsec == 0 ? 0 : (timing.HeadersSentNsec - blocked_nsec) / 1000);
+
+                Metrics::Add(Metric::RequestsSent);
+                SendBody(stream_id, segments, segment_count, owner, priority.Urgency);
                 return stream_id;
             }
         }
@@ -978,9 +1616,12 @@ int64_t QuicheConnection::SendRequest(
 
 bool QuicheConnection::SendResponse(
     uint64_t stream_id,
-    const std::vector<std::pair<std::string, std::string>>& headers,
-    const void* data,
-    int bytes)
+    const quiche_h3_header* headers,
+    size_t header_count,
+    const BodySegment* segments,
+    int segment_count,
+    const std::shared_ptr<void>& owner,
+    const StreamPriority* priority)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
@@ -988,59 +1629,131 @@ bool QuicheConnection::SendResponse(
         return false;
     }
 
-    // Convert headers to quiche_h3_header format
-    std::vector<quiche_h3_header> h3_headers;
-    for (const auto& header : headers) {
-        h3_headers.emplace_back(quiche_h3_header{
-            reinterpret_cast<const uint8_t*>(header.first.c_str()),
-            header.first.length(),
-            reinterpret_cast<const uint8_t*>(header.second.c_str()),
-            header.second.length()
-        });
+    const int64_t bytes = segments_length(segments, segment_count);
+
+    StreamPriority response_priority = TakeRequestedPriority(stream_id);
+    if (priority) {
+        response_priority = *priority;
     }
+    quiche_h3_priority h3_priority = { response_priority.Urgency, response_priority.Incremental };
 
     // Attempt to send the response headers
-    int r = quiche_h3_send_response(
+    int r = quiche_h3_send_response_with_priority(
         http3_, conn_,
         stream_id,
-        h3_headers.data(), h3_headers.size(),
+        headers, header_count,
+        &h3_priority,
         (bytes <= 0) /* fin */);
 
     if (r == QUICHE_H3_ERR_STREAM_BLOCKED && quiche_conn_is_established(conn_)) {
         // Flow control is blocking the send, cache the response
         auto cached_response = std::make_shared<CachedResponse>();
         cached_response->stream_id = stream_id;
-        cached_response->headers = std::move(h3_headers);
-        if (bytes > 0 && data != nullptr) {
-            // Copy the body data into a shared_ptr vector
-            cached_response->data = std::make_shared<std::vector<uint8_t>>(
-                reinterpret_cast<const uint8_t*>(data),
-                reinterpret_cast<const uint8_t*>(data) + bytes
-            );
+
+        // Copy the headers since they point at the caller's memory
+        size_t storage_bytes = 0;
+        for (size_t i = 0; i < header_count; ++i) {
+            storage_bytes += headers[i].name_len + headers[i].value_len;
+        }
+        cached_response->header_storage.reserve(storage_bytes);
+        cached_response->headers.resize(header_count);
+        for (size_t i = 0; i < header_count; ++i) {
+            cached_response->header_storage.append(reinterpret_cast<const char*>(headers[i].name), headers[i].name_len);
+            cached_response->header_storage.append(reinterpret_cast<const char*>(headers[i].value), headers[i].value_len);
+        }
+        const uint8_t* storage = reinterpret_cast<const uint8_t*>(cached_response->header_storage.data());
+        for (size_t i = 0; i < header_count; ++i) {
+            quiche_h3_header& header = cached_response->headers[i];
+            header.name = storage;
+            header.name_len = headers[i].name_len;
+            storage += header.name_len;
+            header.value = storage;
+            header.value_len = headers[i].value_len;
+            storage += header.value_len;
+        }
+
+        if (bytes > 0) {
+            // Copied only if the caller did not hand over the memory
+            cached_response->body.Assign(segments, segment_count, 0, owner);
         }
         cached_response->bytes_left = bytes;
+        cached_response->priority = response_priority;
 
         // Add the cached response to the cache
         response_cache_.push_back(cached_response);
+        Metrics::Add(Metric::CachedResponses);
+        Metrics::Add(Metric::ResponsesSent);
+        flight_.Record(FlightEvent::ResponseCached, stream_id, bytes);
         return false; // Indicate that the response was cached
     } else if (r < 0) {
         LOG_ERROR() << "Failed to send response headers: " << r << " " << quiche_h3_error_to_string(r);
         return false;
     }
 
+    Metrics::Add(Metric::ResponsesSent);
+    flight_.Record(FlightEvent::ResponseSent, stream_id, bytes);
+    OnResponseHeadersSent(stream_id);
+    if (bytes <= 0) {
+        OnLocalFinished(stream_id);
+    }
+
     // Headers sent successfully, now send the body
-    return SendBody(stream_id, data, bytes);
+    return SendBody(stream_id, segments, segment_count, owner, response_priority.Urgency);
 }
 
-bool QuicheConnection::SendBody(uint64_t stream_id, const void* vdata, int bytes) {
+bool QuicheConnection::UpdateRequestPriority(uint64_t stream_id, const StreamPriority& priority)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    if (timeout_ || !request_timings_.Find(stream_id)) {
+        return false;
+    }
+
+    quiche_h3_priority h3_priority = { priority.Urgency, priority.Incremental };
+    int r = quiche_h3_send_priority_update_for_request(http3_, conn_, stream_id, &h3_priority);
+    if (r < 0) {
+        LOG_ERROR() << "Failed to send priority update: " << r << " " << quiche_h3_error_to_string(r);
+        return false;
+    }
+
+    ReprioritizeStream(stream_id, priority);
+    FlushEgress();
+    return true;
+}
+
+bool QuicheConnection::SendBody(uint64_t stream_id, const BodySegment* segments, int segment_count,
+    const std::shared_ptr<void>& owner, uint8_t urgency)
+{
+    // Called from function with lock held
+
+    bool success = WriteBody(stream_id, segments, segment_count, owner, urgency);
+
+    FlushEgress();
+    return success;
+}
+
+bool QuicheConnection::WriteBody(uint64_t stream_id, const BodySegment* segments, int segment_count,
+    const std::shared_ptr<void>& owner, uint8_t urgency)
+{
     // Called from function with lock held
 
+    const int64_t bytes = segments_length(segments, segment_count);
     if (bytes <= 0) {
         //quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_WRITE, 0);
-    } else {
-        const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
-        ssize_t rc = quiche_h3_send_body(http3_, conn_, stream_id, 
-                                 data, bytes,
+        return true;
+    }
+
+    // Feed quiche directly from each segment until it stops accepting data
+    int64_t written = 0;
+    for (int i = 0; i < segment_count; ++i) {
+        const uint8_t* data = segments[i].Data;
+        const int64_t length = segments[i].Length;
+        if (length <= 0) {
+            continue;
+        }
+
+        ssize_t rc = quiche_h3_send_body(http3_, conn_, stream_id,
+                                 data, length,
                                  false/*fin*/);
         if (rc < 0) {
             // Failures here mean there is no room for more data.
@@ -1048,22 +1761,32 @@ bool QuicheConnection::SendBody(uint64_t stream_id, const void* vdata, int bytes
             rc = 0;
         }
 
-        if (rc < bytes) {
-            auto stream = GetOutgoingStream(stream_id);
-            stream->SendOffset = 0;
-            stream->Buffer.assign(data + rc, data + bytes);
-        } else {
-            rc = quiche_h3_send_body(http3_, conn_, stream_id,
-                                    nullptr, 0/*empty*/,
-                                    true/*fin*/);
-            if (rc < 0) {
-                LOG_ERROR() << "Failed to send body(0): " << rc;
-                return false;
-            }
+        written += rc;
+        if (rc > 0 && written == rc) {
+            OnBodySent(stream_id);
+        }
+
+        if (rc < length) {
+            flight_.Record(FlightEvent::BodyBlocked, stream_id, bytes - written);
+
+            // Queue the remainder of this segment and all following segments.
+            // FlushTransfers() writes them in place while the owner holds them
+            auto stream = GetOutgoingStream(stream_id, urgency);
+            stream->WrittenBytes = written;
+            stream->Body.Assign(segments + i, segment_count - i, rc, owner);
+            return true;
         }
     }
 
-    FlushEgress();
+    ssize_t rc = quiche_h3_send_body(http3_, conn_, stream_id,
+                            nullptr, 0/*empty*/,
+                            true/*fin*/);
+    if (rc < 0) {
+        // Retry sending the FIN from FlushTransfers()
+        GetOutgoingStream(stream_id, urgency);
+    } else {
+        OnLocalFinished(stream_id);
+    }
     return true;
 }
 
@@ -1075,10 +1798,14 @@ void QuicheConnection::FlushCachedResponses() {
         auto cached_response = *it;
 
         // Attempt to resend the response headers
-        int r = quiche_h3_send_response(
+        quiche_h3_priority h3_priority = {
+            cached_response->priority.Urgency, cached_response->priority.Incremental
+        };
+        int r = quiche_h3_send_response_with_priority(
             http3_, conn_,
             cached_response->stream_id,
             cached_response->headers.data(), cached_response->headers.size(),
+            &h3_priority,
             cached_response->bytes_left <= 0 /* fin */);
 
         if (r == QUICHE_H3_ERR_STREAM_BLOCKED && quiche_conn_is_established(conn_)) {
@@ -1089,114 +1816,192 @@ void QuicheConnection::FlushCachedResponses() {
             LOG_ERROR() << "Failed to resend cached response headers: " << r << " " << quiche_h3_error_to_string(r);
             // Remove the failed cached response
             it = response_cache_.erase(it);
+            Metrics::Sub(Metric::CachedResponses);
             continue;
         }
 
-        // If there is body data to send
-        if (cached_response->data && cached_response->bytes_left > 0) {
-            ssize_t sent = quiche_h3_send_body(
-                http3_, conn_,
-                cached_response->stream_id,
-                cached_response->data->data(),
-                cached_response->bytes_left,
-                (cached_response->bytes_left <= 0) /* fin */);
-            if (sent == QUICHE_H3_ERR_DONE) {
-                it = response_cache_.erase(it);
-                continue;
-            }
-
-            if (sent == QUICHE_H3_ERR_STREAM_BLOCKED) {
-                // Still blocked, cannot send now
-                ++it;
-                continue;
-            } else if (sent < 0) {
-                LOG_ERROR() << "Failed to resend cached response body: " << sent << " " << quiche_h3_error_to_string(sent);
-                // Remove the failed cached response
-                it = response_cache_.erase(it);
-                continue;
-            }
-
-            // Update the bytes left to send
-            cached_response->bytes_left -= sent;
+        flight_.Record(FlightEvent::CachedResponseSent, cached_response->stream_id);
+        OnResponseHeadersSent(cached_response->stream_id);
+        if (cached_response->bytes_left <= 0) {
+            OnLocalFinished(cached_response->stream_id);
+        }
 
-            if (cached_response->bytes_left <= 0) {
-                // All data sent, remove from cache
-                it = response_cache_.erase(it);
-            } else {
-                ++it;
-            }
-        } else {
-            // No body to send, remove from cache
-            it = response_cache_.erase(it);
+        // Headers are out: move the held body into the stream transfer
+        // queue, which FlushTransfers() sends along with the FIN
+        if (cached_response->bytes_left > 0) {
+            auto stream = GetOutgoingStream(cached_response->stream_id, cached_response->priority.Urgency);
+            stream->Body = std::move(cached_response->body);
         }
+        it = response_cache_.erase(it);
+        Metrics::Sub(Metric::CachedResponses);
     }
 }
 
 void QuicheConnection::FlushTransfers() {
     // Called from function with lock held
 
-    std::vector<uint64_t> completed_stream_ids;
+    // Streams are visited in urgency order, so urgent streams claim
+    // connection credit first.  A stream that is blocked does not stop the
+    // streams behind it.
+    bool completed = false;
 
-    for (auto& stream_pair : outgoing_streams_by_id_) {
-        auto& stream = stream_pair.second;
-        const int send_offset = stream->SendOffset;
-        const int remaining = stream->Buffer.size() - send_offset;
+    for (OutgoingStream*& stream : active_outgoing_) {
+        QueuedBody& body = stream->Body;
+
+        // Write segments in place until quiche stops accepting data.
+        // Failures here mean there is no room for more data.
+        // Other streams may still have stream credit left
+        bool blocked = false;
+        while (!body.Empty()) {
+            const BodySegment& segment = body.Segments[body.Index];
+            const int64_t remaining = segment.Length - body.Offset;
 
-        // If we are retrying to send the FIN:
-        if (remaining <= 0) {
             ssize_t r = quiche_h3_send_body(http3_, conn_, stream->Id,
-                                    nullptr, 0/*empty*/,
-                                    true/*fin*/);
+                                     segment.Data + body.Offset,
+                                     remaining,
+                                     false/*fin*/);
             if (r < 0) {
-                // Failures here mean there is no room for more data
+                blocked = true;
                 break;
             }
 
-            completed_stream_ids.push_back(stream->Id);
-            continue;
-        }
+            if (stream->WrittenBytes == 0 && r > 0) {
+                OnBodySent(stream->Id);
+            }
+            stream->WrittenBytes += r;
+            body.Consume(r);
 
-        ssize_t r = quiche_h3_send_body(http3_, conn_, stream->Id,
-                                 stream->Buffer.data() + send_offset,
-                                 remaining,
-                                 false/*fin*/);
-        if (r < 0) {
-            // Failures here mean there is no room for more data
-            break;
+            if (r < remaining) {
+                blocked = true;
+                break;
+            }
         }
-
-        if (r < remaining) {
-            stream->SendOffset += r;
+        if (blocked) {
             continue;
         }
 
-        // No more data to send
-        stream->Buffer.clear();
-        stream->SendOffset = 0;
+        // No more data to send, so let the owner go now
+        body.Release();
 
         // Try to send FIN
-        r = quiche_h3_send_body(http3_, conn_, stream->Id,
+        ssize_t r = quiche_h3_send_body(http3_, conn_, stream->Id,
                                 nullptr, 0/*empty*/,
                                 true/*fin*/);
         if (r < 0) {
-            // Failures here mean there is no room for more data
-            break;
+            continue;
         }
 
-        completed_stream_ids.push_back(stream->Id);
+        OnLocalFinished(stream->Id);
+        outgoing_streams_.Erase(stream->Id);
+        Metrics::Sub(Metric::OutgoingStreamsQueued);
+        ObjectPool<OutgoingStream>::Recycle(stream);
+        stream = nullptr;
+        completed = true;
 
         //quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_WRITE, 0);
     }
 
-    // Erase completed streams
-    for (auto stream_id : completed_stream_ids) {
-        auto it = outgoing_streams_by_id_.find(stream_id);
-        if (it != outgoing_streams_by_id_.end()) {
-            outgoing_streams_by_id_.erase(it);
+    // Compact the active list, dropping the recycled streams
+    if (completed) {
+        active_outgoing_.erase(
+            std::remove(active_outgoing_.begin(), active_outgoing_.end(), nullptr),
+            active_outgoing_.end());
+    }
+}
+
+void QuicheConnection::GetStats(ConnectionStats& stats)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    stats = ConnectionStats();
+    stats.ConnectionId = settings_.AssignedId;
+
+    // The client connection exists before the handshake starts
+    if (!conn_) {
+        return;
+    }
+
+    quiche_stats conn_stats = {};
+    quiche_conn_stats(conn_, &conn_stats);
+    stats.PacketsSent = conn_stats.sent;
+    stats.PacketsReceived = conn_stats.recv;
+    stats.PacketsLost = conn_stats.lost;
+    stats.PacketsRetransmitted = conn_stats.retrans;
+    stats.BytesSent = conn_stats.sent_bytes;
+    stats.BytesReceived = conn_stats.recv_bytes;
+    stats.BytesAcked = conn_stats.acked_bytes;
+    stats.BytesLost = conn_stats.lost_bytes;
+    stats.BytesRetransmitted = conn_stats.stream_retrans_bytes;
+
+    const uint64_t settled = conn_stats.acked_bytes + conn_stats.lost_bytes;
+    stats.BytesInFlight = (conn_stats.sent_bytes > settled) ? conn_stats.sent_bytes - settled : 0;
+
+    for (size_t i = 0; i < conn_stats.paths_count; ++i) {
+        quiche_path_stats path_stats = {};
+        if (quiche_conn_path_stats(conn_, i, &path_stats) < 0 || !path_stats.active) {
+            continue;
         }
+        stats.SmoothedRttUsec = path_stats.rtt / 1000;
+        stats.CongestionWindow = path_stats.cwnd;
+        stats.DeliveryRate = path_stats.delivery_rate;
+        stats.PathMtu = path_stats.pmtu;
+        break;
+    }
+
+    stats.PacingRate = pacing_rate_;
+
+    stats.Streams.reserve(active_outgoing_.size());
+    for (const OutgoingStream* stream : active_outgoing_) {
+        StreamStats stream_stats;
+        stream_stats.StreamId = stream->Id;
+        stream_stats.Urgency = stream->Urgency;
+        stream_stats.QueuedBytes = stream->Body.Remaining();
+        stream_stats.WrittenBytes = stream->WrittenBytes;
+        stats.QueuedBytes += stream_stats.QueuedBytes;
+        stats.Streams.push_back(stream_stats);
     }
 }
 
+std::string QuicheConnection::FormatFlightRecorder(const char* reason, size_t max_events)
+{
+    ConnectionStats stats;
+    GetStats(stats);
+
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    std::ostringstream header;
+    header << "Flight recorder: connection " << settings_.AssignedId
+        << (is_server_ ? " from client " : " to server ") << peer_endpoint_
+        << " (" << reason << ")\n"
+        << "  rtt_usec=" << stats.SmoothedRttUsec
+        << " cwnd=" << stats.CongestionWindow
+        << " in_flight=" << stats.BytesInFlight
+        << " delivery_rate=" << stats.DeliveryRate
+        << " pacing_rate=" << stats.PacingRate
+        << " queued=" << stats.QueuedBytes
+        << " streams=" << stats.Streams.size()
+        << " cached_responses=" << response_cache_.size() << "\n"
+        << "  packets sent=" << stats.PacketsSent
+        << " received=" << stats.PacketsReceived
+        << " lost=" << stats.PacketsLost
+        << " retransmitted=" << stats.PacketsRetransmitted << "\n";
+
+    return header.str() + flight_.Format(GetNsec(), max_events);
+}
+
+void QuicheConnection::DumpFlightRecorder(const char* reason)
+{
+    const std::string& directory = settings_.flight.DumpDirectory;
+    if (directory.empty()) {
+        FlightRecorder::QueueDump(std::string(), FormatFlightRecorder(reason, FLIGHT_RECORDER_LOG_EVENTS));
+        return;
+    }
+
+    std::string path = directory + "/flight_" + std::to_string(settings_.AssignedId) +
+        "_" + std::to_string(GetNsec() / 1000) + ".txt";
+    FlightRecorder::QueueDump(std::move(path), FormatFlightRecorder(reason));
+}
+
 bool QuicheConnection::ComparePeerCertificate(const void* cert_cer_data, int bytes) {
     std::lock_guard<std::recursive_mutex> locker(mutex_);
 
@@ -1224,6 +2029,7 @@ bool QuicheConnection::ComparePeerCertificate(const void* cert_cer_data, int byt
 
 QuicheSender::QuicheSender(std::shared_ptr<QuicheSocket> qs) {
     qs_ = qs;
+    flight_signals_ = FlightRecorder::SignalCount();
 
     send_thread_ = std::make_shared<std::thread>([this]() {
         Loop();
@@ -1232,6 +2038,7 @@ QuicheSender::QuicheSender(std::shared_ptr<QuicheSocket> qs) {
 
 QuicheSender::~QuicheSender() {
     terminated_ = true;
+    qs_->WakeSender();
     JoinThread(send_thread_);
 }
 
@@ -1241,34 +2048,102 @@ void QuicheSender::Loop() {
     int interval_msec = QUIC_SEND_SLOW_INTERVAL_MSEC;
 
     while (!terminated_) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(interval_msec));
+        qs_->WaitForSender(interval_msec);
 
         std::vector<std::shared_ptr<QuicheConnection>> freed_connections;
 
         {
             std::lock_guard<std::mutex> lock(mutex_);
 
-            bool send_fast = false;
+            auto is_closed = [this, &freed_connections](const ScheduledConnection& entry) {
+                auto& connection = entry.Connection;
+                if (!connection->IsClosed()) {
+                    return false;
+                }
+                freed_connections.push_back(connection);
 
-            auto it = connections_.begin();
-            while (it != connections_.end()) {
-                auto& connection = it->second;
-                if (connection->IsClosed()) {
-                    freed_connections.push_back(connection);
+                auto dcid_it = connections_.find(connection->settings_.dcid);
+                if (dcid_it != connections_.end() && dcid_it->second == connection) {
+                    connections_.erase(dcid_it);
+                }
+                auto id_it = connections_by_id_.find(connection->settings_.AssignedId);
+                if (id_it != connections_by_id_.end() && id_it->second == connection) {
+                    connections_by_id_.erase(id_it);
+                }
+                return true;
+            };
+            schedule_.erase(
+                std::remove_if(schedule_.begin(), schedule_.end(), is_closed),
+                schedule_.end());
 
-                    // Remove from connections_
-                    it = connections_.erase(it);
+            bool send_fast = false;
+            const size_t count = schedule_.size();
+
+            // Bytes sent outside the loop count against the connection's share.
+            // Those sends are capped at a turn each, so at most one turn of debt
+            // is kept, which is paid off within a round
+            for (auto& entry : schedule_) {
+                const int64_t turn = (int64_t)QUIC_SEND_TURN_BYTES * entry.Weight;
+                entry.Deficit = std::max(entry.Deficit - entry.Connection->TakeUnscheduledBytes(), -turn);
+            }
 
-                    // Remove from connections_by_id_
-                    auto conn_it = connections_by_id_.find(connection->settings_.AssignedId);
-                    if (conn_it != connections_by_id_.end()) {
-                        connections_by_id_.erase(conn_it);
+            // Rounds continue while any connection used up its credit, until
+            // the pass budget runs out
+            int64_t budget = QUIC_SEND_PASS_BYTES;
+            size_t stopped_at = count;
+            bool backlogged = count > 0;
+            while (backlogged && stopped_at == count) {
+                backlogged = false;
+
+                for (size_t i = 0; i < count; ++i) {
+                    const size_t index = (next_start_ + i) % count;
+                    auto& entry = schedule_[index];
+
+                    entry.Deficit += (int64_t)QUIC_SEND_TURN_BYTES * entry.Weight;
+                    if (entry.Deficit <= 0) {
+                        backlogged = true; // Still paying off sends made outside the loop
+                        continue;
                     }
-                } else {
-                    if (connection->FlushEgress(buffer)) {
+
+                    const int64_t credit = std::min(entry.Deficit, budget);
+                    const int64_t sent = entry.Connection->FlushEgress(buffer, credit);
+                    budget -= sent;
+                    if (sent > 0) {
                         send_fast = true;
                     }
-                    it++;
+
+                    if (sent >= credit) {
+                        entry.Deficit -= sent;
+                        backlogged = true;
+                    } else {
+                        // Nothing left to send, so unused credit does not carry over
+                        entry.Deficit = 0;
+                    }
+
+                    if (budget <= 0) {
+                        stopped_at = index;
+                        break;
+                    }
+                }
+            }
+
+            if (stopped_at != count) {
+                // Connections after the one that used up the budget go first
+                // next pass.  All of them keep their deficits
+                next_start_ = (stopped_at + 1) % count;
+            } else if (count > 0) {
+                // Rotate who goes first so ties do not always favor the same connection
+                next_start_ = (next_start_ + 1) % count;
+            }
+
+            // SIGUSR2 asks for a flight recorder dump of every connection
+            const uint32_t flight_signals = FlightRecorder::SignalCount();
+            if (flight_signals != flight_signals_) {
+                flight_signals_ = flight_signals;
+                for (auto& entry : schedule_) {
+                    if (entry.Connection->settings_.flight.DumpOnSignal) {
+                        entry.Connection->DumpFlightRecorder("signal");
+                    }
                 }
             }
 
@@ -1293,6 +2168,24 @@ void QuicheSender::Add(std::shared_ptr<QuicheConnection> qc) {
 
     connections_[dcid] = qc;
     connections_by_id_[connection_id] = qc;
+
+    ScheduledConnection entry;
+    entry.Connection = qc;
+    schedule_.push_back(entry);
+}
+
+bool QuicheSender::SetWeight(uint64_t connection_id, uint32_t weight) {
+    weight = std::min<uint32_t>(std::max<uint32_t>(weight, 1), QUIC_SEND_MAX_WEIGHT);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto& entry : schedule_) {
+        if (entry.Connection->settings_.AssignedId == connection_id) {
+            entry.Weight = weight;
+            return true;
+        }
+    }
+    return false;
 }
 
 std::shared_ptr<QuicheConnection> QuicheSender::Find(const ConnectionId& dcid) {
@@ -1319,44 +2212,248 @@ std::shared_ptr<QuicheConnection> QuicheSender::Find(uint64_t connection_id) {
 //------------------------------------------------------------------------------
 // QuicheMailbox
 
+QuicheMailbox::QuicheMailbox()
+{
+    shards_.resize(1);
+}
+
+void QuicheMailbox::SetShardCount(int shard_count)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    shards_.clear();
+    shards_.resize(std::max(shard_count, 1));
+    connection_shards_.clear();
+    next_shard_ = 0;
+}
+
+size_t QuicheMailbox::AssignShard(const Event& event)
+{
+    // Called from function with lock held
+
+    if (shards_.size() == 1) {
+        return 0;
+    }
+
+    size_t index = 0;
+    auto it = connection_shards_.find(event.ConnectionAssignedId);
+    if (it != connection_shards_.end()) {
+        index = it->second;
+    } else {
+        for (size_t i = 1; i < shards_.size(); ++i) {
+            if (shards_[i].Connections < shards_[index].Connections) {
+                index = i;
+            }
+        }
+        shards_[index].Connections++;
+        it = connection_shards_.emplace(event.ConnectionAssignedId, index).first;
+    }
+
+    // Timeout is the last event of a connection
+    if (event.Type == EventType::Timeout) {
+        shards_[index].Connections--;
+        connection_shards_.erase(it);
+    }
+    return index;
+}
+
+int QuicheMailbox::FindReadyShard() const
+{
+    const size_t count = shards_.size();
+    for (size_t i = 0; i < count; ++i) {
+        const size_t index = (next_shard_ + i) % count;
+        const Shard& shard = shards_[index];
+        if (!shard.Busy && !shard.Events.empty()) {
+            return static_cast<int>(index);
+        }
+    }
+    return -1;
+}
+
+bool QuicheMailbox::AnyEvents() const
+{
+    for (const Shard& shard : shards_) {
+        if (!shard.Events.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void QuicheMailbox::SetWaitPolicy(const MailboxWaitPolicy& policy)
+{
+    int max_spin_usec = std::max(policy.MaxSpinUsec, 0);
+
+    // With a single CPU the spinning thread would only delay the poster
+    if (std::thread::hardware_concurrency() == 1) {
+        max_spin_usec = 0;
+    }
+
+    max_spin_usec_ = max_spin_usec;
+    adaptive_spin_ = policy.Adaptive;
+}
+
+MailboxMetrics QuicheMailbox::GetMetrics() const
+{
+    MailboxMetrics metrics;
+    metrics.Polls = polls_.load(std::memory_order_relaxed);
+    metrics.Events = events_delivered_.load(std::memory_order_relaxed);
+    metrics.Immediate = immediate_.load(std::memory_order_relaxed);
+    metrics.SpinHits = spin_hits_.load(std::memory_order_relaxed);
+    metrics.SpinMisses = spin_misses_.load(std::memory_order_relaxed);
+    metrics.Parks = parks_.load(std::memory_order_relaxed);
+    metrics.SpinBudgetUsec = SpinBudgetUsec();
+    metrics.InterArrivalUsec = interarrival_nsec_.load(std::memory_order_relaxed) / 1000;
+    return metrics;
+}
+
+int64_t QuicheMailbox::SpinBudgetUsec() const
+{
+    const int64_t max_spin_usec = max_spin_usec_.load(std::memory_order_relaxed);
+    if (max_spin_usec <= 0 || !adaptive_spin_.load(std::memory_order_relaxed)) {
+        return max_spin_usec;
+    }
+
+    const int64_t interarrival_nsec = interarrival_nsec_.load(std::memory_order_relaxed);
+    if (interarrival_nsec <= 0) {
+        return max_spin_usec; // No history yet
+    }
+
+    // Events arrive too far apart for a spin to catch them: Park right away
+    if (interarrival_nsec > max_spin_usec * 1000) {
+        return 0;
+    }
+
+    // Spin for about twice the typical gap between events
+    return std::min(max_spin_usec, (interarrival_nsec * 2 + 999) / 1000);
+}
+
+bool QuicheMailbox::SpinWait(int64_t spin_usec)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spin_usec);
+
+    for (;;) {
+        // Check the clock only every few iterations since it costs more than the pause
+        for (int i = 0; i < 64; ++i) {
+            if (has_events_.load(std::memory_order_acquire) || terminated_) {
+                return true;
+            }
+            CpuPause();
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+    }
+}
+
 void QuicheMailbox::Shutdown()
 {
     std::unique_lock<std::mutex> lock(mutex_);
     terminated_ = true;
-    cv_.notify_one();
+    cv_.notify_all();
 }
 
-void QuicheMailbox::Poll(MailboxCallback callback, int timeout_msec)
+int QuicheMailbox::AcquireShard(std::vector<Event>& events, int timeout_msec)
 {
-    std::vector<Event> events;
+    polls_.fetch_add(1, std::memory_order_relaxed);
+
+    if (has_events_.load(std::memory_order_acquire)) {
+        immediate_.fetch_add(1, std::memory_order_relaxed);
+    } else if (timeout_msec != 0) {
+        int64_t spin_usec = SpinBudgetUsec();
+        if (timeout_msec > 0) {
+            spin_usec = std::min<int64_t>(spin_usec, timeout_msec * 1000LL);
+        }
+        if (spin_usec > 0) {
+            if (SpinWait(spin_usec)) {
+                spin_hits_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                spin_misses_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    int shard_index = -1;
     {
         std::unique_lock<std::mutex> lock(mutex_);
 
+        if (timeout_msec != 0 && !terminated_ && FindReadyShard() < 0) {
+            parks_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto ready = [this, &shard_index] {
+            if (terminated_) {
+                return true;
+            }
+            shard_index = FindReadyShard();
+            return shard_index >= 0;
+        };
+
         if (timeout_msec < 0) {
-            cv_.wait(lock, 
-                [this] { return terminated_ || !events_.empty(); });
+            cv_.wait(lock, ready);
         } else {
-            cv_.wait_for(lock, std::chrono::milliseconds(timeout_msec),
-                [this] { return terminated_ || !events_.empty(); });
+            cv_.wait_for(lock, std::chrono::milliseconds(timeout_msec), ready);
         }
 
-        if (terminated_ || events_.empty()) {
-            return;
+        if (terminated_ || shard_index < 0) {
+            return -1;
         }
 
-        std::swap(events, events_);
+        Shard& shard = shards_[shard_index];
+        shard.Busy = true;
+        std::swap(events, shard.Events);
+        next_shard_ = (shard_index + 1) % shards_.size();
+        has_events_.store(AnyEvents(), std::memory_order_relaxed);
+
+        // Let another poller pick up the remaining shards
+        if (FindReadyShard() >= 0) {
+            cv_.notify_one();
+        }
     }
 
-    // Process events without lock held to avoid deadlock and blocking IO thread
-    for (const auto& event : events) {
-        callback(event);
+    events_delivered_.fetch_add(events.size(), std::memory_order_relaxed);
+    Metrics::Sub(Metric::MailboxDepth, events.size());
+    QS_TRACE2(mailbox_poll, shard_index, events.size());
+    return shard_index;
+}
+
+void QuicheMailbox::ReleaseShard(int shard_index, std::vector<Event>& events)
+{
+    events.clear();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    Shard& shard = shards_[shard_index];
+    shard.Busy = false;
+    if (!shard.Events.empty()) {
+        cv_.notify_one();
+    } else {
+        // Hand the capacity back so Post() does not reallocate
+        std::swap(events, shard.Events);
     }
 }
 
 void QuicheMailbox::Post(const Event& event)
 {
+    // Read the clock before locking so other posters do not wait on it
+    const int64_t now_nsec = GetNsec();
+
     std::unique_lock<std::mutex> lock(mutex_);
 
-    events_.push_back(event);
+    // Concurrent posters may take the lock out of timestamp order
+    if (now_nsec > last_post_nsec_) {
+        if (last_post_nsec_ != 0) {
+            // Exponential moving average with weight 1/8
+            const int64_t gap_nsec = now_nsec - last_post_nsec_;
+            const int64_t avg_nsec = interarrival_nsec_.load(std::memory_order_relaxed);
+            interarrival_nsec_.store(
+                avg_nsec == 0 ? gap_nsec : avg_nsec + (gap_nsec - avg_nsec) / 8,
+                std::memory_order_relaxed);
+        }
+        last_post_nsec_ = now_nsec;
+    }
+
+    shards_[AssignShard(event)].Events.push_back(event);
+    Metrics::Add(Metric::MailboxDepth);
+    QS_TRACE2(mailbox_post, event.ConnectionAssignedId, static_cast<int>(event.Type));
+    has_events_.store(true, std::memory_order_release);
     cv_.notify_one();
 }
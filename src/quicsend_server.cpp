@@ -1,34 +1,47 @@
 #include <quicsend_server.hpp>
 
+#include <charconv>
+
 
 //------------------------------------------------------------------------------
 // HTTP/3 Server
 
 QuicSendServer::QuicSendServer(const QuicSendServerSettings& settings)
 {
-    DatagramCallback datagram_callback = [this](
-        uint8_t* data,
-        std::size_t bytes,
-        const boost::asio::ip::udp::endpoint& peer_endpoint)
-    {
-        OnDatagram(data, bytes, peer_endpoint);
-    };
+    settings_ = settings;
+
+    mailbox_.SetWaitPolicy(settings_.WaitPolicy);
+    mailbox_.SetShardCount(settings_.DispatchShards);
+
+    status_header_ = response_headers_.Add(":status");
+    response_headers_.Add("server", QUICSEND_SERVER_AGENT);
+    info_header_ = response_headers_.Add(QUICSEND_HEADER_INFO);
+    content_type_header_ = response_headers_.Add("content-type");
+    content_length_header_ = response_headers_.Add("content-length");
 
     qs_ = std::make_shared<QuicheSocket>(
         io_context_,
-        datagram_callback,
         settings.Port,
         settings.CertPath,
         settings.KeyPath);
 
     sender_ = std::make_shared<QuicheSender>(qs_);
 
+    if (!settings_.Qlog.Directory.empty()) {
+        qlog_ = std::make_shared<QlogTracer>(settings_.Qlog);
+    }
+    latency_ = std::make_shared<PathLatencyTracker>();
+
+    if (settings_.FlightRecorder.DumpOnSignal) {
+        FlightRecorder::InstallSignalHandler();
+    }
+
     loop_thread_ = std::make_shared<std::thread>([this]() {
         io_context_.run();
         closed_ = true;
     });
 
-    qs_->StartReceive();
+    qs_->StartReceive(this);
 }
 
 QuicSendServer::~QuicSendServer() {
@@ -44,12 +57,47 @@ void QuicSendServer::Close(uint64_t connection_id) {
     }
 }
 
+bool QuicSendServer::GetStats(uint64_t connection_id, ConnectionStats& stats) {
+    auto conn = sender_->Find(connection_id);
+    if (!conn) {
+        return false;
+    }
+
+    conn->GetStats(stats);
+    return true;
+}
+
+bool QuicSendServer::GetLatency(uint64_t connection_id, RequestLatencyStats& stats) {
+    auto conn = sender_->Find(connection_id);
+    if (!conn) {
+        return false;
+    }
+
+    conn->GetLatency(stats);
+    return true;
+}
+
+bool QuicSendServer::GetFlightRecorder(uint64_t connection_id, std::string& text) {
+    auto conn = sender_->Find(connection_id);
+    if (!conn) {
+        return false;
+    }
+
+    text = conn->FormatFlightRecorder("requested");
+    return true;
+}
+
+void QuicSendServer::SetConnectionWeight(uint64_t connection_id, uint32_t weight) {
+    sender_->SetWeight(connection_id, weight);
+}
+
 void QuicSendServer::Respond(
     uint64_t connection_id,
     int64_t request_id,
     int32_t status,
     const std::string& header_info,
-    BodyData body)
+    BodyData body,
+    const StreamPriority* priority)
 {
     if (closed_) {
         return;
@@ -60,33 +108,33 @@ void QuicSendServer::Respond(
         return;
     }
 
+    HeaderBlock headers(response_headers_);
+    headers.Set(info_header_, header_info);
+
+    char status_text[12];
+    auto status_end = std::to_chars(status_text, status_text + sizeof(status_text), status).ptr;
+    headers.Set(status_header_, status_text, status_end - status_text);
+
     if (body.Empty()) {
-        const std::vector<std::pair<std::string, std::string>> headers = {
-            {":status", std::to_string(status)},
-            {"server", QUICSEND_SERVER_AGENT},
-            {QUICSEND_HEADER_INFO, header_info},
-        };
+        headers.Truncate(content_type_header_);
 
-        conn->SendResponse(request_id, headers);
+        conn->SendResponse(request_id, headers.data(), headers.size(), nullptr, 0, nullptr, priority);
         return;
     }
 
-    std::vector<std::pair<std::string, std::string>> headers = {
-        {":status", std::to_string(status)},
-        {"server", QUICSEND_SERVER_AGENT},
-        {QUICSEND_HEADER_INFO, header_info},
-        {"content-type", body.ContentType},
-        {"content-length", std::to_string(body.Length)},
-    };
+    headers.Set(content_type_header_, body.ContentType, std::strlen(body.ContentType));
+    headers.SetInt(content_length_header_, body.TotalLength());
 
-    conn->SendResponse(request_id, headers, body.Data, body.Length);
-}
+    if (!body.Segments.empty()) {
+        conn->SendResponse(request_id, headers.data(), headers.size(),
+            body.Segments.data(), body.Segments.size(), body.Owner, priority);
+        return;
+    }
 
-void QuicSendServer::Poll(
-    OnDataCallback on_event,
-    int timeout_msec)
-{
-    mailbox_.Poll(on_event, timeout_msec);
+    BodySegment segment;
+    segment.Data = body.Data;
+    segment.Length = body.Length;
+    conn->SendResponse(request_id, headers.data(), headers.size(), &segment, 1, body.Owner, priority);
 }
 
 void QuicSendServer::OnDatagram(
@@ -107,6 +155,7 @@ void QuicSendServer::OnDatagram(
                                 dcid.data(), &dcid.Length,
                                 token, &token_len);
     if (rc < 0) {
+        Metrics::Add(Metric::InvalidPackets);
         LOG_ERROR() << "Failed to parse header: " << rc << " " << quiche_error_to_string(rc);
         return;
     }
@@ -159,6 +208,7 @@ void QuicSendServer::SendVersionNegotiation(
     }
     buffer->Length = written;
 
+    Metrics::Add(Metric::VersionNegotiations);
     qs_->Send(buffer, peer_endpoint);
 }
 
@@ -189,6 +239,7 @@ void QuicSendServer::SendRetry(
     }
     buffer->Length = written;
 
+    Metrics::Add(Metric::RetriesSent);
     qs_->Send(buffer, peer_endpoint);
 }
 
@@ -197,46 +248,16 @@ std::shared_ptr<QuicheConnection> QuicSendServer::CreateConnection(
     const ConnectionId& odcid,
     const boost::asio::ip::udp::endpoint& peer_endpoint)
 {
-    std::shared_ptr<QuicheConnection> qc = std::make_shared<QuicheConnection>();
+    std::shared_ptr<QuicheConnection> qc =
+        std::make_shared<QuicheRoleConnection<QuicSendServer>>(this);
 
     QCSettings qcs;
-    qcs.IsServer = true;
     qcs.AssignedId = ++next_assigned_id_;
     qcs.qs = qs_;
     qcs.dcid = dcid;
-    qcs.on_timeout = [this, dcid](uint64_t connection_id) {
-        LOG_INFO() << "*** Link timeout: " << connection_id;
-
-        // Queue timeout event
-        QuicheMailbox::Event event;
-        event.Type = QuicheMailbox::EventType::Timeout;
-        event.ConnectionAssignedId = connection_id;
-        mailbox_.Post(event);
-    };
-    qcs.on_connect = [this](uint64_t connection_id, const boost::asio::ip::udp::endpoint& peer_endpoint) {
-        LOG_INFO() << "*** Link established: " << connection_id << " " << EndpointToString(peer_endpoint);
-    };
-    QuicheConnection* qc_weak = qc.get();
-    qcs.on_data = [this, qc_weak](const QuicheMailbox::Event& event) {
-        if (!qc_weak->IsConnected()) {
-            if (event.Stream->Authorization != settings_.Authorization) {
-                LOG_WARN() << "*** Link closed: Invalid auth token";
-                qc_weak->Close("invalid auth token");
-                return;
-            }
-
-            qc_weak->MarkClientConnected();
-
-            // Queue connect event
-            QuicheMailbox::Event event;
-            event.Type = QuicheMailbox::EventType::Connect;
-            event.ConnectionAssignedId = event.ConnectionAssignedId;
-            event.PeerEndpoint = event.PeerEndpoint;
-            mailbox_.Post(event);
-        }
-
-        mailbox_.Post(event);
-    };
+    qcs.qlog = qlog_;
+    qcs.latency = latency_;
+    qcs.flight = settings_.FlightRecorder;
 
     qc->Initialize(qcs);
     if (!qc->Accept(peer_endpoint, dcid, odcid)) {
@@ -246,3 +267,45 @@ std::shared_ptr<QuicheConnection> QuicSendServer::CreateConnection(
     sender_->Add(qc);
     return qc;
 }
+
+void QuicSendServer::OnConnect(
+    QuicheConnection& connection,
+    const boost::asio::ip::udp::endpoint& peer_endpoint)
+{
+    LOG_INFO() << "*** Link established: " << connection.settings_.AssignedId << " " << EndpointToString(peer_endpoint);
+}
+
+void QuicSendServer::OnTimeout(QuicheConnection& connection) {
+    const uint64_t connection_id = connection.settings_.AssignedId;
+    LOG_INFO() << "*** Link timeout: " << connection_id;
+
+    // Queue timeout event
+    QuicheMailbox::Event event;
+    event.Type = QuicheMailbox::EventType::Timeout;
+    event.ConnectionAssignedId = connection_id;
+    mailbox_.Post(event);
+}
+
+void QuicSendServer::OnData(
+    QuicheConnection& connection,
+    const QuicheMailbox::Event& event)
+{
+    if (!connection.IsConnected()) {
+        if (event.Stream->Authorization != settings_.Authorization) {
+            LOG_WARN() << "*** Link closed: Invalid auth token";
+            connection.Close("invalid auth token");
+            return;
+        }
+
+        connection.MarkClientConnected();
+
+        // Queue connect event
+        QuicheMailbox::Event connect_event;
+        connect_event.Type = QuicheMailbox::EventType::Connect;
+        connect_event.ConnectionAssignedId = event.ConnectionAssignedId;
+        connect_event.PeerEndpoint = event.PeerEndpoint;
+        mailbox_.Post(connect_event);
+    }
+
+    mailbox_.Post(event);
+}
@@ -4,6 +4,7 @@
 #include <pthread.h>
 
 #include <cstring>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <iomanip>
@@ -18,6 +19,150 @@
 // Initialize static members
 std::unique_ptr<Logger> Logger::Instance;
 std::once_flag Logger::InitInstanceFlag;
+std::atomic<uint32_t> Logger::RateLimit = ATOMIC_VAR_INIT(LOG_DEFAULT_RATE_LIMIT);
+std::atomic<LogCallSite*> LogCallSite::SuppressingSites = ATOMIC_VAR_INIT(nullptr);
+
+struct Logger::LogRing {
+    struct Slot {
+        LogLevel Level;
+        uint32_t Length;
+        char Text[LOG_MESSAGE_MAX];
+    };
+    Slot Slots[LOG_RING_SLOTS];
+
+    // Written by the owning thread
+    alignas(64) std::atomic<uint32_t> Head = ATOMIC_VAR_INIT(0);
+
+    // Written by the logger thread
+    alignas(64) std::atomic<uint32_t> Tail = ATOMIC_VAR_INIT(0);
+
+    // Messages lost because the ring was full
+    std::atomic<uint64_t> Dropped = ATOMIC_VAR_INIT(0);
+
+    // Set when the owning thread exits
+    std::atomic<bool> Orphaned = ATOMIC_VAR_INIT(false);
+};
+
+// Formats messages into a fixed buffer, truncating at LOG_MESSAGE_MAX
+struct Logger::LogFormatter : public std::streambuf {
+    char Data[LOG_MESSAGE_MAX];
+    std::ostream Stream;
+    bool Busy = false;
+
+    LogFormatter()
+        : Stream(this)
+    {
+        setp(Data, Data + sizeof(Data));
+    }
+
+    size_t Length() const {
+        return pptr() - pbase();
+    }
+
+    void Reset() {
+        setp(Data, Data + sizeof(Data));
+        Stream.clear();
+        Stream.flags(std::ios_base::dec | std::ios_base::skipws);
+        Stream.precision(6);
+        Stream.width(0);
+        Stream.fill(' ');
+    }
+
+protected:
+    int_type overflow(int_type /*ch*/) override {
+        return traits_type::eof();
+    }
+};
+
+namespace {
+
+struct ThreadLogRing {
+    std::shared_ptr<Logger::LogRing> Ring;
+
+    ~ThreadLogRing() {
+        if (Ring) {
+            Ring->Orphaned.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadLogRing tls_log_ring;
+thread_local Logger::LogFormatter tls_log_formatter;
+
+// Rate limit windows only need one-second resolution, so use the cheap clock
+int64_t coarse_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+const char* file_basename(const char* path) {
+    const char* slash = std::strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+} // namespace
+
+bool LogCallSite::Allow() {
+    const uint32_t limit = Logger::GetRateLimit();
+    if (limit == 0) {
+        return true;
+    }
+
+    // Approximate under races, which only shifts a few messages between windows
+    const int64_t now_sec = coarse_sec();
+    if (WindowSec.load(std::memory_order_relaxed) != now_sec) {
+        WindowSec.store(now_sec, std::memory_order_relaxed);
+        WindowCount.store(0, std::memory_order_relaxed);
+    }
+    if (WindowCount.fetch_add(1, std::memory_order_relaxed) < limit) {
+        return true;
+    }
+
+    Suppressed.fetch_add(1, std::memory_order_relaxed);
+
+    if (!Listed.load(std::memory_order_relaxed) && !Listed.exchange(true)) {
+        LogCallSite* head = SuppressingSites.load(std::memory_order_relaxed);
+        do {
+            Next = head;
+        } while (!SuppressingSites.compare_exchange_weak(head, this,
+            std::memory_order_release, std::memory_order_relaxed));
+    }
+    return false;
+}
+
+Logger::LogStream::LogStream(LogLevel level, LogCallSite& site)
+    : level_(level)
+    , site_(site)
+{
+    LogFormatter& formatter = tls_log_formatter;
+    if (!formatter.Busy) {
+        formatter.Busy = true;
+        formatter_ = &formatter;
+        os_ = &formatter.Stream;
+    } else {
+        // An argument of this message is logging on the same thread
+        fallback_.reset(new std::ostringstream);
+        os_ = fallback_.get();
+    }
+}
+
+Logger::LogStream::~LogStream() {
+    const uint32_t suppressed = site_.TakeSuppressed();
+    if (suppressed > 0) {
+        *os_ << " (suppressed " << suppressed << " similar messages)";
+    }
+
+    Logger& logger = Logger::getInstance();
+    if (formatter_) {
+        logger.Log(level_, formatter_->Data, formatter_->Length());
+        formatter_->Reset();
+        formatter_->Busy = false;
+    } else {
+        const std::string message = fallback_->str();
+        logger.Log(level_, message.data(), std::min<size_t>(message.size(), LOG_MESSAGE_MAX));
+    }
+}
 
 Logger& Logger::getInstance() {
     std::call_once(InitInstanceFlag, []() {
@@ -37,8 +182,7 @@ Logger::~Logger() {
     }
 
     // Process any remaining logs
-    LogsToProcess.swap(LogQueue);
-    ProcessLogQueue();
+    DrainRings();
 }
 
 void Logger::SetLogLevel(LogLevel level) {
@@ -49,62 +193,182 @@ void Logger::SetCallback(std::function<void(LogLevel, const std::string&)> callb
     Callback = callback;
 }
 
-void Logger::Log(LogLevel level, std::ostringstream&& message) {
-    std::lock_guard<std::mutex> lock(LogQueueMutex);
-    LogQueue.push_back({level, message.str()});
-    LogQueueCV.notify_one();
+void Logger::SetRateLimit(uint32_t messages_per_second) {
+    RateLimit = messages_per_second;
+}
+
+Logger::LogRing* Logger::GetThreadRing() {
+    LogRing* ring = tls_log_ring.Ring.get();
+    if (ring) {
+        return ring;
+    }
+
+    auto new_ring = std::make_shared<LogRing>();
+    {
+        std::lock_guard<std::mutex> lock(RingsMutex);
+        Rings.push_back(new_ring);
+    }
+    tls_log_ring.Ring = new_ring;
+    return new_ring.get();
+}
+
+void Logger::Log(LogLevel level, const char* message, size_t length) {
+    LogRing* ring = GetThreadRing();
+
+    const uint32_t head = ring->Head.load(std::memory_order_relaxed);
+    const uint32_t tail = ring->Tail.load(std::memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+        ring->Dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRing::Slot& slot = ring->Slots[head % LOG_RING_SLOTS];
+    slot.Level = level;
+    slot.Length = static_cast<uint32_t>(length);
+    std::memcpy(slot.Text, message, length);
+
+    ring->Head.store(head + 1, std::memory_order_release);
+}
+
+void Logger::LogLines(LogLevel level, const std::string& text) {
+    if (!IsEnabled(level)) {
+        return;
+    }
+
+    LogRing* ring = GetThreadRing();
+
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+
+        while (!Terminated) {
+            const uint32_t head = ring->Head.load(std::memory_order_relaxed);
+            const uint32_t tail = ring->Tail.load(std::memory_order_acquire);
+            if (head - tail < LOG_RING_SLOTS) {
+                break;
+            }
+            LogCV.notify_one();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        Log(level, text.data() + start, std::min<size_t>(end - start, LOG_MESSAGE_MAX));
+        start = end + 1;
+    }
 }
 
 void Logger::Terminate() {
     Terminated = true;
-    LogQueueCV.notify_one();
+    LogCV.notify_one();
 }
 
 void Logger::RunLogger() {
+    // Register up front so a callback that logs never waits on RingsMutex
+    GetThreadRing();
+
     while (!Terminated) {
-        {
-            std::unique_lock<std::mutex> lock(LogQueueMutex);
-            LogQueueCV.wait(lock, [this] { return !LogQueue.empty() || Terminated; });
-            LogsToProcess.swap(LogQueue);
+        if (DrainRings()) {
+            continue;
         }
 
-        ProcessLogQueue();
+        ReportSuppressed();
 
-        if (Terminated) {
-            break;
+        std::unique_lock<std::mutex> lock(RingsMutex);
+        LogCV.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MSEC),
+            [this] { return Terminated.load(); });
+    }
+}
+
+bool Logger::DrainRings() {
+    {
+        std::lock_guard<std::mutex> lock(RingsMutex);
+
+        // Forget rings of exited threads once they are empty
+        auto is_finished = [](const std::shared_ptr<LogRing>& ring) {
+            return ring->Orphaned.load(std::memory_order_acquire) &&
+                ring->Head.load(std::memory_order_acquire) == ring->Tail.load(std::memory_order_relaxed);
+        };
+        Rings.erase(std::remove_if(Rings.begin(), Rings.end(), is_finished), Rings.end());
+
+        DrainList = Rings;
+    }
+
+    bool drained = false;
+
+    for (const auto& ring : DrainList) {
+        const uint64_t dropped = ring->Dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            Write(LogLevel::WARN, "Logger: Dropped " + std::to_string(dropped) + " messages");
+        }
+
+        uint32_t tail = ring->Tail.load(std::memory_order_relaxed);
+        const uint32_t head = ring->Head.load(std::memory_order_acquire);
+        while (tail != head) {
+            const LogRing::Slot& slot = ring->Slots[tail % LOG_RING_SLOTS];
+            LineScratch.assign(slot.Text, slot.Length);
+            const LogLevel level = slot.Level;
+
+            ++tail;
+            ring->Tail.store(tail, std::memory_order_release);
+
+            Write(level, LineScratch);
+            drained = true;
         }
     }
+
+    DrainList.clear();
+    return drained;
 }
 
-void Logger::ProcessLogQueue() {
-    if (LogsToProcess.empty()) {
+void Logger::ReportSuppressed() {
+    const int64_t now_sec = coarse_sec();
+    if (now_sec == LastSuppressedReportSec) {
         return;
     }
-
-    for (const auto& entry : LogsToProcess) {
-        if (entry.Level >= CurrentLogLevel) {
-            if (Callback) {
-                Callback(entry.Level, entry.Message);
-            } else {
-                switch (entry.Level) {
-                    case LogLevel::DEBUG:
-                        std::cout << "[DEBUG] " << entry.Message << std::endl;
-                        break;
-                    case LogLevel::INFO:
-                        std::cout << "[INFO] " << entry.Message << std::endl;
-                        break;
-                    case LogLevel::WARN:
-                        std::cerr << "[WARN] " << entry.Message << std::endl;
-                        break;
-                    case LogLevel::ERROR:
-                        std::cerr << "[ERROR] " << entry.Message << std::endl;
-                        break;
-                }
-            }
+    LastSuppressedReportSec = now_sec;
+
+    // Report call sites whose flood has stopped.  Active sites report the
+    // count with their next allowed message
+    LogCallSite* site = LogCallSite::SuppressingSites.load(std::memory_order_acquire);
+    for (; site; site = site->Next) {
+        if (!site->IsQuiet(now_sec)) {
+            continue;
         }
+        const uint32_t suppressed = site->TakeSuppressed();
+        if (suppressed > 0) {
+            Write(static_cast<LogLevel>(site->Level),
+                std::string(file_basename(site->File)) + ":" + std::to_string(site->Line) +
+                ": Suppressed " + std::to_string(suppressed) + " similar messages");
+        }
+    }
+}
+
+void Logger::Write(LogLevel level, const std::string& message) {
+    if (level < CurrentLogLevel) {
+        return;
+    }
+
+    if (Callback) {
+        Callback(level, message);
+        return;
     }
 
-    LogsToProcess.clear();
+    switch (level) {
+        case LogLevel::DEBUG:
+            std::cout << "[DEBUG] " << message << std::endl;
+            break;
+        case LogLevel::INFO:
+            std::cout << "[INFO] " << message << std::endl;
+            break;
+        case LogLevel::WARN:
+            std::cerr << "[WARN] " << message << std::endl;
+            break;
+        case LogLevel::ERROR:
+            std::cerr << "[ERROR] " << message << std::endl;
+            break;
+    }
 }
 
 static void debug_log(const char* line, void* /*argp*/) {
@@ -136,7 +400,7 @@ void JoinThread(std::shared_ptr<std::thread> th)
 int64_t GetNsec()
 {
     struct timespec tp;
-    clock_gettime(CLOCK_REALTIME, &tp);
+    clock_gettime(CLOCK_MONOTONIC, &tp);
     return static_cast<int64_t>(tp.tv_sec) * 1000000000LL + tp.tv_nsec;
 }
 
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdio>
+
+
+//------------------------------------------------------------------------------
+// Test Checks
+
+// Unit tests are plain executables run by ctest, so they need no framework.
+// Each one counts failed checks and returns TEST_EXIT_CODE() from main()
+
+static int g_test_failures = 0;
+
+#define TEST_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++g_test_failures; \
+        } \
+    } while (0)
+
+#define TEST_EXIT_CODE() (g_test_failures == 0 ? 0 : 1)
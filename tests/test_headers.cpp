@@ -0,0 +1,97 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_quiche.hpp>
+
+#include <string>
+
+
+//------------------------------------------------------------------------------
+// Helpers
+
+static std::string header_name(const HeaderBlock& block, size_t index)
+{
+    const quiche_h3_header& header = block.data()[index];
+    return std::string(reinterpret_cast<const char*>(header.name), header.name_len);
+}
+
+static std::string header_value(const HeaderBlock& block, size_t index)
+{
+    const quiche_h3_header& header = block.data()[index];
+    return std::string(reinterpret_cast<const char*>(header.value), header.value_len);
+}
+
+
+//------------------------------------------------------------------------------
+// Tests
+
+static void test_set_and_truncate()
+{
+    HeaderTemplate header_template;
+    const int method = header_template.Add(":method");
+    header_template.Add("user-agent", "test-agent");
+    const int length = header_template.Add("content-length");
+
+    HeaderBlock block(header_template);
+    TEST_CHECK(block.size() == 3);
+    block.Set(method, "POST", 4);
+    block.SetInt(length, 123456789);
+    TEST_CHECK(header_value(block, method) == "POST");
+    TEST_CHECK(header_value(block, 1) == "test-agent");
+    TEST_CHECK(header_value(block, length) == "123456789");
+
+    // The template keeps its own values
+    HeaderBlock other(header_template);
+    TEST_CHECK(header_value(other, method).empty());
+
+    block.Truncate(length);
+    TEST_CHECK(block.size() == 2);
+    block.Truncate(10);
+    TEST_CHECK(block.size() == 2);
+}
+
+static void test_append_until_full()
+{
+    HeaderTemplate header_template;
+    for (int i = 0; i < MAX_TEMPLATE_HEADERS - 2; ++i) {
+        header_template.Add("x-template");
+    }
+
+    HeaderBlock block(header_template);
+    TEST_CHECK(block.Append("priority", "u=1", 3));
+    TEST_CHECK(block.Append("x-extra", "abc", 3));
+    TEST_CHECK(block.size() == MAX_TEMPLATE_HEADERS);
+    TEST_CHECK(header_name(block, MAX_TEMPLATE_HEADERS - 2) == "priority");
+    TEST_CHECK(header_value(block, MAX_TEMPLATE_HEADERS - 1) == "abc");
+
+    // A full block refuses the header rather than sending without it
+    TEST_CHECK(!block.Append("x-dropped", "1", 1));
+    TEST_CHECK(block.size() == MAX_TEMPLATE_HEADERS);
+}
+
+static void test_template_limit()
+{
+    HeaderTemplate header_template;
+    for (int i = 0; i < MAX_TEMPLATE_HEADERS; ++i) {
+        header_template.Add("x-template");
+    }
+
+    bool threw = false;
+    try {
+        header_template.Add("x-too-many");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    TEST_CHECK(threw);
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_set_and_truncate();
+    test_append_until_full();
+    test_template_limit();
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,117 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_quiche.hpp>
+
+#include <set>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Helpers
+
+static void post(QuicheMailbox& mailbox, uint64_t connection_id,
+    QuicheMailbox::EventType type = QuicheMailbox::EventType::Data)
+{
+    QuicheMailbox::Event event;
+    event.Type = type;
+    event.ConnectionAssignedId = connection_id;
+    mailbox.Post(event);
+}
+
+// Takes the events of one shard, or none if every shard is empty
+static std::vector<uint64_t> poll_shard(QuicheMailbox& mailbox)
+{
+    std::vector<uint64_t> ids;
+    mailbox.Poll([&](const QuicheMailbox::Event& event) {
+        ids.push_back(event.ConnectionAssignedId);
+    }, 0);
+    return ids;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests
+
+static void test_single_shard_order()
+{
+    QuicheMailbox mailbox;
+    for (uint64_t id = 1; id <= 5; ++id) {
+        post(mailbox, id);
+    }
+    TEST_CHECK(poll_shard(mailbox) == std::vector<uint64_t>({ 1, 2, 3, 4, 5 }));
+    TEST_CHECK(poll_shard(mailbox).empty());
+}
+
+static void test_shards_balance_live_connections()
+{
+    QuicheMailbox mailbox;
+    mailbox.SetShardCount(2);
+
+    // Connections 2 and 4 close, leaving only odd ids alive.
+    // Assigning by id % 2 would put every survivor on the same shard
+    for (uint64_t id = 1; id <= 4; ++id) {
+        post(mailbox, id, QuicheMailbox::EventType::Connect);
+    }
+    post(mailbox, 2, QuicheMailbox::EventType::Timeout);
+    post(mailbox, 4, QuicheMailbox::EventType::Timeout);
+    post(mailbox, 5, QuicheMailbox::EventType::Connect);
+    post(mailbox, 7, QuicheMailbox::EventType::Connect);
+    while (!poll_shard(mailbox).empty()) {
+    }
+
+    for (uint64_t id : { 1, 3, 5, 7 }) {
+        post(mailbox, id);
+    }
+    const std::vector<uint64_t> first = poll_shard(mailbox);
+    const std::vector<uint64_t> second = poll_shard(mailbox);
+    TEST_CHECK(first.size() == 2);
+    TEST_CHECK(second.size() == 2);
+    TEST_CHECK(poll_shard(mailbox).empty());
+
+    std::set<uint64_t> all(first.begin(), first.end());
+    all.insert(second.begin(), second.end());
+    TEST_CHECK(all == std::set<uint64_t>({ 1, 3, 5, 7 }));
+}
+
+static void test_connection_stays_on_its_shard()
+{
+    QuicheMailbox mailbox;
+    mailbox.SetShardCount(4);
+
+    for (int round = 0; round < 3; ++round) {
+        for (uint64_t id = 1; id <= 8; ++id) {
+            post(mailbox, id);
+        }
+    }
+
+    // Each shard holds whole connections, in the order they were posted
+    size_t total = 0;
+    std::set<uint64_t> seen;
+    for (;;) {
+        const std::vector<uint64_t> ids = poll_shard(mailbox);
+        if (ids.empty()) {
+            break;
+        }
+        total += ids.size();
+
+        std::set<uint64_t> shard_ids(ids.begin(), ids.end());
+        TEST_CHECK(shard_ids.size() == 2);
+        TEST_CHECK(ids.size() == 6);
+        for (uint64_t id : shard_ids) {
+            TEST_CHECK(seen.insert(id).second);
+        }
+    }
+    TEST_CHECK(total == 24);
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_single_shard_order();
+    test_shards_balance_live_connections();
+    test_connection_stays_on_its_shard();
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,225 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_msgpack.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Helpers
+
+static bool parse(const std::vector<uint8_t>& data, std::vector<MsgpackToken>& tokens)
+{
+    return MsgpackParse(data.data(), data.size(), tokens);
+}
+
+static bool parse_one(const std::vector<uint8_t>& data, MsgpackToken& token)
+{
+    std::vector<MsgpackToken> tokens;
+    if (!parse(data, tokens) || tokens.size() != 1) {
+        return false;
+    }
+    token = tokens[0];
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Round Trips
+
+static void test_scalars()
+{
+    const int64_t ints[] = {
+        0, 1, 127, -1, -32, -33, -128, -129, -32768, -32769,
+        std::numeric_limits<int32_t>::min(), std::numeric_limits<int64_t>::min(),
+    };
+    for (int64_t value : ints) {
+        std::vector<uint8_t> data;
+        MsgpackWriter(data).WriteInt(value);
+
+        MsgpackToken token;
+        TEST_CHECK(parse_one(data, token));
+        if (token.Kind == MsgpackToken::Type::UInt) {
+            TEST_CHECK(value >= 0 && token.UInt == static_cast<uint64_t>(value));
+        } else {
+            TEST_CHECK(token.Kind == MsgpackToken::Type::Int && token.Int == value);
+        }
+    }
+
+    const uint64_t uints[] = {
+        0, 127, 128, 255, 256, 65535, 65536, 0xffffffffull, std::numeric_limits<uint64_t>::max(),
+    };
+    for (uint64_t value : uints) {
+        std::vector<uint8_t> data;
+        MsgpackWriter(data).WriteUInt(value);
+
+        MsgpackToken token;
+        TEST_CHECK(parse_one(data, token));
+        TEST_CHECK(token.Kind == MsgpackToken::Type::UInt && token.UInt == value);
+    }
+
+    std::vector<uint8_t> data;
+    MsgpackWriter writer(data);
+    writer.WriteArrayHeader(4);
+    writer.WriteNil();
+    writer.WriteBool(true);
+    writer.WriteBool(false);
+    writer.WriteFloat(-2.5);
+
+    std::vector<MsgpackToken> tokens;
+    TEST_CHECK(parse(data, tokens));
+    TEST_CHECK(tokens.size() == 5);
+    if (tokens.size() == 5) {
+        TEST_CHECK(tokens[0].Kind == MsgpackToken::Type::Array && tokens[0].Length == 4);
+        TEST_CHECK(tokens[1].Kind == MsgpackToken::Type::Nil);
+        TEST_CHECK(tokens[2].Kind == MsgpackToken::Type::Bool && tokens[2].Bool);
+        TEST_CHECK(tokens[3].Kind == MsgpackToken::Type::Bool && !tokens[3].Bool);
+        TEST_CHECK(tokens[4].Kind == MsgpackToken::Type::Float && tokens[4].Float == -2.5);
+    }
+}
+
+static void test_strings_and_binary()
+{
+    // Lengths at each encoding boundary
+    const size_t lengths[] = { 0, 31, 32, 255, 256, 65535, 65536 };
+    for (size_t length : lengths) {
+        const std::string text(length, 'x');
+        const std::vector<uint8_t> bytes(length, 0xab);
+
+        std::vector<uint8_t> data;
+        MsgpackWriter writer(data);
+        writer.WriteMapHeader(1);
+        writer.WriteStr(text.data(), text.size());
+        writer.WriteBin(bytes.data(), bytes.size());
+
+        std::vector<MsgpackToken> tokens;
+        TEST_CHECK(parse(data, tokens));
+        TEST_CHECK(tokens.size() == 3);
+        if (tokens.size() != 3) {
+            continue;
+        }
+        TEST_CHECK(tokens[0].Kind == MsgpackToken::Type::Map && tokens[0].Length == 1);
+        TEST_CHECK(tokens[1].Kind == MsgpackToken::Type::Str && tokens[1].Length == length);
+        TEST_CHECK(length == 0 || std::memcmp(tokens[1].Data, text.data(), length) == 0);
+        TEST_CHECK(tokens[2].Kind == MsgpackToken::Type::Bin && tokens[2].Length == length);
+        TEST_CHECK(length == 0 || std::memcmp(tokens[2].Data, bytes.data(), length) == 0);
+    }
+
+    // Bytes go out as the bin family, not str
+    std::vector<uint8_t> data;
+    MsgpackWriter(data).WriteBin("ab", 2);
+    TEST_CHECK(data.size() == 4 && data[0] == 0xc4 && data[1] == 2);
+
+    // A header written alone is followed by the payload sent separately
+    std::vector<uint8_t> header;
+    MsgpackWriter(header).WriteBinHeader(70000);
+    TEST_CHECK(header.size() == 5 && header[0] == 0xc6);
+    header.resize(header.size() + 70000, 0x11);
+    MsgpackToken token;
+    TEST_CHECK(parse_one(header, token));
+    TEST_CHECK(token.Kind == MsgpackToken::Type::Bin && token.Length == 70000);
+}
+
+static void test_containers()
+{
+    const size_t counts[] = { 0, 15, 16, 65535, 65536 };
+    for (size_t count : counts) {
+        std::vector<uint8_t> data;
+        MsgpackWriter writer(data);
+        writer.WriteArrayHeader(count);
+        for (size_t i = 0; i < count; ++i) {
+            writer.WriteUInt(i & 0x7f);
+        }
+
+        std::vector<MsgpackToken> tokens;
+        TEST_CHECK(parse(data, tokens));
+        TEST_CHECK(tokens.size() == count + 1);
+        TEST_CHECK(tokens[0].Kind == MsgpackToken::Type::Array && tokens[0].Length == count);
+    }
+
+    // Nesting within the depth limit
+    std::vector<uint8_t> data;
+    MsgpackWriter writer(data);
+    for (int i = 0; i < 100; ++i) {
+        writer.WriteArrayHeader(1);
+    }
+    writer.WriteNil();
+    std::vector<MsgpackToken> tokens;
+    TEST_CHECK(parse(data, tokens));
+    TEST_CHECK(tokens.size() == 101);
+}
+
+
+//------------------------------------------------------------------------------
+// Malformed Input
+
+static void test_malformed()
+{
+    std::vector<uint8_t> valid;
+    MsgpackWriter writer(valid);
+    writer.WriteMapHeader(2);
+    writer.WriteStr("key", 3);
+    writer.WriteArrayHeader(3);
+    writer.WriteInt(-1000);
+    writer.WriteFloat(1.5);
+    writer.WriteBin("\x01\x02\x03", 3);
+    writer.WriteStr("other", 5);
+    writer.WriteUInt(1ull << 40);
+
+    std::vector<MsgpackToken> tokens;
+    TEST_CHECK(parse(valid, tokens));
+
+    // Every truncation is rejected
+    for (size_t length = 0; length < valid.size(); ++length) {
+        TEST_CHECK(!MsgpackParse(valid.data(), length, tokens));
+    }
+
+    // Trailing data is rejected
+    std::vector<uint8_t> trailing = valid;
+    trailing.push_back(0xc0);
+    TEST_CHECK(!parse(trailing, tokens));
+
+    // Reserved tag and extension types
+    const uint8_t unsupported[] = { 0xc1, 0xc7, 0xd4, 0xd8 };
+    for (uint8_t tag : unsupported) {
+        std::vector<uint8_t> data = { tag, 0x00, 0x00, 0x00, 0x00, 0x00 };
+        TEST_CHECK(!parse(data, tokens));
+    }
+
+    // Lengths and counts past the end of the data
+    const std::vector<std::vector<uint8_t>> bogus = {
+        { 0xdb, 0xff, 0xff, 0xff, 0xff, 'a' },   // str32
+        { 0xc6, 0x7f, 0xff, 0xff, 0xff, 0x00 },  // bin32
+        { 0xdd, 0xff, 0xff, 0xff, 0xff, 0xc0 },  // array32
+        { 0xdf, 0x7f, 0xff, 0xff, 0xff, 0xc0 },  // map32
+        { 0x82, 0xc0, 0xc0, 0xc0 },              // fixmap missing a value
+    };
+    for (const auto& data : bogus) {
+        TEST_CHECK(!parse(data, tokens));
+    }
+
+    // Nesting past MSGPACK_MAX_DEPTH
+    std::vector<uint8_t> deep(MSGPACK_MAX_DEPTH * 2, 0x91);
+    deep.push_back(0xc0);
+    TEST_CHECK(!parse(deep, tokens));
+
+    // Empty input
+    TEST_CHECK(!MsgpackParse(nullptr, 0, tokens));
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_scalars();
+    test_strings_and_binary();
+    test_containers();
+    test_malformed();
+    return TEST_EXIT_CODE();
+}
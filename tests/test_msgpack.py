@@ -0,0 +1,63 @@
+# Run with: pytest tests/test_msgpack.py (requires the built quicsend module)
+import pytest
+
+from quicsend import Body, ToBody, FromBody, CONTENT_TYPE_MSGPACK
+from quicsend.quicsend_wrapper import lib_py
+
+def received(body: Body) -> Body:
+    # Join the parts as the receiver would see them: one contiguous buffer
+    data = body.Data
+    if isinstance(data, tuple):
+        data = b"".join(bytes(memoryview(part)) for part in data)
+    out = Body()
+    out.ContentType = body.ContentType
+    out.datab_ = memoryview(bytes(data))
+    out.Data = out.datab_
+    out.Length = len(out.datab_)
+    return out
+
+def roundtrip(value):
+    body = ToBody(value)
+    assert body.ContentType == CONTENT_TYPE_MSGPACK
+    return FromBody(received(body))
+
+@pytest.mark.parametrize("value", [
+    0, 127, 128, -32, -33, -2**63, 2**64 - 1, 1.5, True, False,
+    [], list(range(16)), {"a": 1, "b": [1, 2, {"c": None}]},
+])
+def test_roundtrip(value):
+    assert roundtrip(value) == value
+
+# ToBody() sends a bare str as text/plain, so strings are checked inside a
+# container and directly against the codec
+@pytest.mark.parametrize("length", [0, 31, 32, 255, 256, 65535, 65536])
+def test_string_roundtrip(length):
+    value = "x" * length
+    assert roundtrip([value]) == [value]
+    assert lib_py.quicsend_msgpack_unpack(memoryview(lib_py.quicsend_msgpack_pack(value))) == value
+
+def test_bytes_decode_as_memoryview():
+    value = roundtrip({"blob": b"\x00\x01\x02"})
+    assert isinstance(value["blob"], memoryview)
+    assert value["blob"].tobytes() == b"\x00\x01\x02"
+
+def test_large_bin_is_sent_as_parts():
+    blob = bytes(range(256)) * 1024
+    body = ToBody({"blob": blob, "n": 7})
+    assert isinstance(body.Data, tuple)
+    assert body.Length == sum(memoryview(part).nbytes for part in body.Data)
+    value = FromBody(received(body))
+    assert value["blob"].tobytes() == blob
+    assert value["n"] == 7
+
+@pytest.mark.parametrize("data", [
+    b"\xc1",                          # Reserved tag
+    b"\xd4\x00\x00",                  # Extension type
+    b"\x92\x01",                      # Truncated array
+    b"\xdb\xff\xff\xff\xff",          # String longer than the data
+    b"\xc0\xc0",                      # Trailing data
+    b"\x91" * 1000 + b"\xc0",         # Nested too deeply
+])
+def test_malformed_input(data):
+    with pytest.raises(ValueError):
+        lib_py.quicsend_msgpack_unpack(memoryview(data))
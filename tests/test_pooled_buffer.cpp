@@ -0,0 +1,139 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_alloc.hpp>
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Helpers
+
+static std::vector<uint8_t> pattern(size_t bytes, uint8_t seed)
+{
+    std::vector<uint8_t> data(bytes);
+    for (size_t i = 0; i < bytes; ++i) {
+        data[i] = static_cast<uint8_t>(seed + i * 31);
+    }
+    return data;
+}
+
+static bool contents_equal(const PooledBuffer& buffer, const std::vector<uint8_t>& expected)
+{
+    return buffer.size() == expected.size() &&
+        (expected.empty() || std::memcmp(buffer.data(), expected.data(), expected.size()) == 0);
+}
+
+
+//------------------------------------------------------------------------------
+// Tests
+
+static void test_append_grows()
+{
+    PooledBuffer buffer;
+    TEST_CHECK(buffer.empty() && buffer.capacity() == 0 && buffer.data() == nullptr);
+
+    // Crosses from heap storage into the pool, then into larger size classes
+    std::vector<uint8_t> expected;
+    const size_t steps[] = { 1, 100, 1000, 60000, 10000, 200000, 1 << 20 };
+    uint8_t seed = 0;
+    for (size_t bytes : steps) {
+        const std::vector<uint8_t> part = pattern(bytes, seed++);
+        buffer.append(part.data(), part.size());
+        expected.insert(expected.end(), part.begin(), part.end());
+        TEST_CHECK(contents_equal(buffer, expected));
+        TEST_CHECK(buffer.capacity() >= buffer.size());
+    }
+
+    buffer.append(nullptr, 0);
+    TEST_CHECK(contents_equal(buffer, expected));
+}
+
+static void test_reserve_and_clear()
+{
+    PooledBuffer buffer;
+    buffer.reserve(100);
+    TEST_CHECK(buffer.capacity() >= 100 && buffer.empty());
+
+    // Pooled storage is rounded up to a power-of-two size class
+    buffer.reserve(BODY_POOL_MIN_BYTES + 1);
+    TEST_CHECK(buffer.capacity() == BODY_POOL_MIN_BYTES * 2);
+
+    const std::vector<uint8_t> part = pattern(5000, 7);
+    buffer.append(part.data(), part.size());
+    const uint8_t* data = buffer.data();
+
+    // Shrinking requests and clear() keep the storage
+    buffer.reserve(10);
+    TEST_CHECK(buffer.data() == data);
+    buffer.clear();
+    TEST_CHECK(buffer.empty() && buffer.data() == data && buffer.capacity() == BODY_POOL_MIN_BYTES * 2);
+
+    buffer.Release();
+    TEST_CHECK(buffer.data() == nullptr && buffer.capacity() == 0 && buffer.empty());
+}
+
+static void test_move()
+{
+    const std::vector<uint8_t> part = pattern(BODY_POOL_MIN_BYTES * 3, 3);
+
+    PooledBuffer source;
+    source.append(part.data(), part.size());
+
+    PooledBuffer moved(std::move(source));
+    TEST_CHECK(contents_equal(moved, part));
+    TEST_CHECK(source.data() == nullptr && source.empty());
+
+    PooledBuffer assigned;
+    assigned.append("abc", 3);
+    assigned = std::move(moved);
+    TEST_CHECK(contents_equal(assigned, part));
+    TEST_CHECK(moved.data() == nullptr && moved.empty());
+}
+
+static void test_pool_recycles()
+{
+    PooledBuffer::SetPoolLimit(BODY_POOL_DEFAULT_CACHED_BYTES);
+
+    // Use a size class no other test touches
+    const size_t bytes = BODY_POOL_MIN_BYTES * 64;
+    {
+        PooledBuffer buffer;
+        buffer.reserve(bytes);
+    }
+    const BodyPoolStats before = PooledBuffer::GetPoolStats();
+    TEST_CHECK(before.CachedBytes >= bytes);
+    {
+        PooledBuffer buffer;
+        buffer.reserve(bytes);
+        TEST_CHECK(buffer.capacity() == bytes);
+    }
+    const BodyPoolStats after = PooledBuffer::GetPoolStats();
+    TEST_CHECK(after.Hits == before.Hits + 1);
+    TEST_CHECK(after.Misses == before.Misses);
+
+    // Past the ceiling, released regions go back to the OS
+    PooledBuffer::SetPoolLimit(0);
+    {
+        PooledBuffer buffer;
+        buffer.reserve(BODY_POOL_MIN_BYTES * 128);
+    }
+    const BodyPoolStats limited = PooledBuffer::GetPoolStats();
+    TEST_CHECK(limited.CachedLimit == 0);
+    TEST_CHECK(limited.CachedBytes == after.CachedBytes);
+    PooledBuffer::SetPoolLimit(BODY_POOL_DEFAULT_CACHED_BYTES);
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_append_grows();
+    test_reserve_and_clear();
+    test_move();
+    test_pool_recycles();
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,104 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_quiche.hpp>
+
+#include <string>
+
+
+//------------------------------------------------------------------------------
+// Helpers
+
+static bool parses_to(const char* text, uint8_t urgency, bool incremental)
+{
+    const StreamPriority priority = ParsePriorityHeader(text);
+    return priority.Urgency == urgency && priority.Incremental == incremental;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests
+
+static void test_parse()
+{
+    TEST_CHECK(parses_to("", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("u=0", 0, false));
+    TEST_CHECK(parses_to("u=7", 7, false));
+    TEST_CHECK(parses_to("i", STREAM_DEFAULT_URGENCY, true));
+    TEST_CHECK(parses_to("u=1, i", 1, true));
+    TEST_CHECK(parses_to("i, u=5", 5, true));
+    TEST_CHECK(parses_to("  u=2 ,\ti  ", 2, true));
+    TEST_CHECK(parses_to("u=2,i=?1", 2, true));
+    TEST_CHECK(parses_to("u=2, i=?0", 2, false));
+
+    // Parameters on members are ignored
+    TEST_CHECK(parses_to("u=4;foo=bar, i;x", 4, true));
+
+    // The last member wins
+    TEST_CHECK(parses_to("u=1, u=6", 6, false));
+    TEST_CHECK(parses_to("i, i=?0", STREAM_DEFAULT_URGENCY, false));
+
+    // Unknown keys are skipped
+    TEST_CHECK(parses_to("x=1, u=0, foo", 0, false));
+}
+
+static void test_parse_invalid()
+{
+    // Invalid values leave the default in place
+    TEST_CHECK(parses_to("u=8", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("u=-1", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("u=", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("u=1x", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("u=99999999999999999999", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("i=1", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to("U=1", STREAM_DEFAULT_URGENCY, false));
+    TEST_CHECK(parses_to(",,,", STREAM_DEFAULT_URGENCY, false));
+
+    // An invalid member does not reset earlier ones
+    TEST_CHECK(parses_to("u=1, u=9", 1, false));
+}
+
+static void test_format_roundtrip()
+{
+    for (int urgency = 0; urgency <= STREAM_MAX_URGENCY; ++urgency) {
+        for (int incremental = 0; incremental < 2; ++incremental) {
+            StreamPriority priority;
+            priority.Urgency = static_cast<uint8_t>(urgency);
+            priority.Incremental = incremental != 0;
+
+            char text[PRIORITY_HEADER_MAX];
+            const size_t length = FormatPriorityHeader(priority, text);
+            TEST_CHECK(length > 0 && length <= PRIORITY_HEADER_MAX);
+
+            const StreamPriority parsed = ParsePriorityHeader(std::string_view(text, length));
+            TEST_CHECK(parsed.Urgency == priority.Urgency);
+            TEST_CHECK(parsed.Incremental == priority.Incremental);
+        }
+    }
+
+    StreamPriority priority;
+    priority.Urgency = 1;
+    priority.Incremental = true;
+    char text[PRIORITY_HEADER_MAX];
+    TEST_CHECK(std::string(text, FormatPriorityHeader(priority, text)) == "u=1, i");
+
+    // Out of range urgency is clamped when formatted
+    priority.Urgency = 200;
+    priority.Incremental = false;
+    TEST_CHECK(std::string(text, FormatPriorityHeader(priority, text)) == "u=7");
+
+    TEST_CHECK(StreamPriority().IsDefault());
+    TEST_CHECK(ParsePriorityHeader("u=3").IsDefault());
+    TEST_CHECK(!ParsePriorityHeader("u=3, i").IsDefault());
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_parse();
+    test_parse_invalid();
+    test_format_roundtrip();
+    return TEST_EXIT_CODE();
+}
@@ -0,0 +1,117 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_alloc.hpp>
+
+#include <thread>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Tests
+
+static void test_outstanding_and_high_water()
+{
+    SendAllocator allocator;
+    const SendAllocatorStats start = SendAllocator::GetStats();
+
+    std::vector<SendBufferPtr> buffers;
+    for (int i = 0; i < 1000; ++i) {
+        buffers.push_back(allocator.Allocate());
+    }
+    SendAllocatorStats stats = SendAllocator::GetStats();
+    TEST_CHECK(stats.Outstanding == start.Outstanding + 1000);
+    TEST_CHECK(stats.HighWater >= start.Outstanding + 1000);
+
+    // The peak is the most buffers held at once, not the buffers carved
+    buffers.clear();
+    const uint64_t peak = SendAllocator::GetStats().HighWater;
+    for (int i = 0; i < 10; ++i) {
+        SendBufferPtr buffer = allocator.Allocate();
+    }
+    stats = SendAllocator::GetStats();
+    TEST_CHECK(stats.Outstanding == start.Outstanding);
+    TEST_CHECK(stats.HighWater == peak);
+    TEST_CHECK(stats.Pooled >= 1000);
+}
+
+static void test_cross_thread_release()
+{
+    SendAllocator allocator;
+    const uint64_t start = SendAllocator::GetStats().Outstanding;
+
+    std::vector<SendBufferPtr> buffers;
+    for (int i = 0; i < 500; ++i) {
+        buffers.push_back(allocator.Allocate());
+    }
+
+    // Released on another thread, as asio send completions do
+    std::thread releaser([&buffers]() {
+        buffers.clear();
+    });
+    releaser.join();
+
+    TEST_CHECK(SendAllocator::GetStats().Outstanding == start);
+}
+
+// Allocates and releases from a thread_local destructor, which may run after
+// the allocator's own thread cache is gone
+struct ExitAllocator {
+    ~ExitAllocator() {
+        SendAllocator allocator;
+        for (int i = 0; i < 100; ++i) {
+            SendBufferPtr buffer = allocator.Allocate();
+            buffer->Length = i;
+        }
+    }
+};
+
+static void test_allocate_during_thread_exit()
+{
+    const uint64_t start = SendAllocator::GetStats().Outstanding;
+
+    std::thread worker([]() {
+        static thread_local ExitAllocator exit_allocator;
+        (void)exit_allocator;
+
+        // Construct the thread cache after exit_allocator, so it is destroyed first
+        SendAllocator allocator;
+        SendBufferPtr buffer = allocator.Allocate();
+    });
+    worker.join();
+
+    TEST_CHECK(SendAllocator::GetStats().Outstanding == start);
+}
+
+static void test_overflow_past_limit()
+{
+    SendAllocator allocator;
+    const SendAllocatorStats start = SendAllocator::GetStats();
+
+    // Everything past the buffers already carved comes from the heap
+    SendAllocator::SetLimit(start.Pooled);
+    std::vector<SendBufferPtr> buffers;
+    for (uint64_t i = 0; i < start.Pooled + 10; ++i) {
+        buffers.push_back(allocator.Allocate());
+    }
+    const SendAllocatorStats stats = SendAllocator::GetStats();
+    TEST_CHECK(stats.Pooled == start.Pooled);
+    TEST_CHECK(stats.Overflows >= start.Overflows + 10);
+    TEST_CHECK(stats.Outstanding == start.Outstanding + start.Pooled + 10);
+
+    buffers.clear();
+    TEST_CHECK(SendAllocator::GetStats().Outstanding == start.Outstanding);
+    SendAllocator::SetLimit(SEND_BUFFER_DEFAULT_LIMIT);
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_outstanding_and_high_water();
+    test_cross_thread_release();
+    test_allocate_during_thread_exit();
+    test_overflow_past_limit();
+    return TEST_EXIT_CODE();
+}
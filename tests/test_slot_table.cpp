@@ -0,0 +1,131 @@
+#include "quicsend_test.hpp"
+
+#include <quicsend_quiche.hpp>
+
+#include <memory>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+// Helpers
+
+// Client-initiated bidirectional request stream ids: 0, 4, 8, ...
+static uint64_t request_id(uint64_t index)
+{
+    return index * 4;
+}
+
+static size_t count_live(StreamSlotTable<std::unique_ptr<int>>& table)
+{
+    size_t count = 0;
+    table.ForEach([&](std::unique_ptr<int>& stream) {
+        TEST_CHECK(stream != nullptr);
+        count++;
+    });
+    return count;
+}
+
+
+//------------------------------------------------------------------------------
+// Tests
+
+static void test_insert_find_erase()
+{
+    StreamSlotTable<std::unique_ptr<int>> table;
+    TEST_CHECK(table.Find(0) == nullptr);
+    TEST_CHECK(!table.Erase(0));
+
+    for (int i = 0; i < 8; ++i) {
+        table.Insert(request_id(i), std::make_unique<int>(i));
+    }
+    TEST_CHECK(table.Count() == 8);
+    for (int i = 0; i < 8; ++i) {
+        auto* stream = table.Find(request_id(i));
+        TEST_CHECK(stream != nullptr && **stream == i);
+    }
+
+    // Ids on an occupied slot but not in the table are not found
+    TEST_CHECK(table.Find(request_id(8)) == nullptr);
+    TEST_CHECK(table.Find(request_id(0) + STREAM_TABLE_INITIAL_SLOTS * 4) == nullptr);
+
+    std::unique_ptr<int> removed;
+    TEST_CHECK(table.Erase(request_id(3), &removed));
+    TEST_CHECK(removed != nullptr && *removed == 3);
+    TEST_CHECK(table.Find(request_id(3)) == nullptr);
+    TEST_CHECK(!table.Erase(request_id(3)));
+    TEST_CHECK(table.Count() == 7);
+    TEST_CHECK(count_live(table) == 7);
+}
+
+static void test_duplicate_insert_replaces()
+{
+    StreamSlotTable<std::unique_ptr<int>> table;
+    table.Insert(request_id(5), std::make_unique<int>(1));
+    int& value = *table.Insert(request_id(5), std::make_unique<int>(2));
+    TEST_CHECK(value == 2);
+    TEST_CHECK(table.Count() == 1);
+    TEST_CHECK(count_live(table) == 1);
+
+    auto* stream = table.Find(request_id(5));
+    TEST_CHECK(stream != nullptr && **stream == 2);
+}
+
+static void test_grow_keeps_live_streams()
+{
+    StreamSlotTable<std::unique_ptr<int>> table;
+
+    // More live streams than the initial ring holds
+    const int live = STREAM_TABLE_INITIAL_SLOTS * 5 + 3;
+    for (int i = 0; i < live; ++i) {
+        table.Insert(request_id(i), std::make_unique<int>(i));
+    }
+    TEST_CHECK(table.Count() == static_cast<size_t>(live));
+    TEST_CHECK(count_live(table) == static_cast<size_t>(live));
+    for (int i = 0; i < live; ++i) {
+        auto* stream = table.Find(request_id(i));
+        TEST_CHECK(stream != nullptr && **stream == i);
+    }
+
+    // A long-lived stream stays reachable as later ids wrap the ring
+    StreamSlotTable<std::unique_ptr<int>> sliding;
+    sliding.Insert(request_id(0), std::make_unique<int>(-1));
+    for (int i = 1; i < 1000; ++i) {
+        sliding.Insert(request_id(i), std::make_unique<int>(i));
+        if (i >= 4) {
+            TEST_CHECK(sliding.Erase(request_id(i - 3)));
+        }
+    }
+    auto* first = sliding.Find(request_id(0));
+    TEST_CHECK(first != nullptr && **first == -1);
+    TEST_CHECK(sliding.Count() == 4);
+}
+
+static void test_dense_reuse_without_growth()
+{
+    // Ids retired before the ring wraps reuse slots in place
+    StreamSlotTable<int> table;
+    for (int i = 0; i < 10000; ++i) {
+        table.Insert(request_id(i), i);
+        if (i >= 4) {
+            TEST_CHECK(table.Erase(request_id(i - 4)));
+        }
+    }
+    TEST_CHECK(table.Count() == 4);
+    for (int i = 9996; i < 10000; ++i) {
+        int* value = table.Find(request_id(i));
+        TEST_CHECK(value != nullptr && *value == i);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    test_insert_find_erase();
+    test_duplicate_insert_replaces();
+    test_grow_keeps_live_streams();
+    test_dense_reuse_without_growth();
+    return TEST_EXIT_CODE();
+}
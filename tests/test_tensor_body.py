@@ -0,0 +1,74 @@
+# Run with: pytest tests/test_tensor_body.py (requires the built quicsend module)
+import pytest
+
+np = pytest.importorskip("numpy")
+
+from quicsend import Body, ToBody, FromBody, CONTENT_TYPE_TENSOR
+
+def received(body: Body, content_type: bytes = None) -> Body:
+    # The receiver sees the body as one writable memoryview
+    out = Body()
+    out.ContentType = content_type if content_type is not None else body.ContentType
+    out.datab_ = memoryview(bytearray(memoryview(body.Data))) if body.Length > 0 else None
+    out.Data = out.datab_
+    out.Length = body.Length
+    return out
+
+def roundtrip(array):
+    body = ToBody(array)
+    assert body.ContentType.startswith(CONTENT_TYPE_TENSOR)
+    return FromBody(received(body))
+
+@pytest.mark.parametrize("array", [
+    np.arange(24, dtype=np.float32).reshape(2, 3, 4),
+    np.asfortranarray(np.arange(24, dtype=np.int16).reshape(4, 6)),
+    np.arange(10, dtype=np.float64)[::2],
+    np.arange(12, dtype=np.uint8).reshape(3, 4)[:, 1:3],
+    np.ones((1, 5, 1), dtype=np.complex64),
+    np.array(3.5, dtype=np.float64),
+    np.zeros((0,), dtype=np.float32),
+    np.zeros((3, 0, 2), dtype=np.int64),
+    np.array([True, False, True]),
+    np.arange(6, dtype=">i4").reshape(2, 3),
+])
+def test_roundtrip(array):
+    result = roundtrip(array)
+    assert result.dtype == array.dtype
+    assert result.shape == array.shape
+    assert np.array_equal(result, array)
+
+def test_dlpack_format():
+    array = np.arange(8, dtype=np.float32)
+    capsule = FromBody(received(ToBody(array)), tensor_format="dlpack")
+    assert np.array_equal(np.from_dlpack(type("Holder", (), {
+        "__dlpack__": lambda self, **kwargs: capsule,
+        "__dlpack_device__": lambda self: (1, 0),
+    })()), array)
+
+def tensor_type(dtype: str, shape: str, strides: str = None) -> bytes:
+    content_type = f"{CONTENT_TYPE_TENSOR.decode()}; dtype={dtype}; shape={shape}"
+    if strides is not None:
+        content_type += f"; strides={strides}"
+    return content_type.encode()
+
+@pytest.mark.parametrize("content_type", [
+    tensor_type("<f4", "5"),                  # Shape larger than the body
+    tensor_type("<f4", "3"),                  # Shape smaller than the body
+    tensor_type("<f4", "-4"),                 # Negative dimension
+    tensor_type("<f4", "2,x"),                # Unparsable dimension
+    tensor_type("<f4", "2,2", "4,4"),         # Overlapping strides
+    tensor_type("<f4", "2,2", "16,4"),        # Strides past the buffer
+    tensor_type("|O", "2"),                   # Object pointers
+    tensor_type("|V16", "1"),                 # Void records
+    tensor_type("not-a-dtype", "4"),          # Unknown dtype
+    CONTENT_TYPE_TENSOR + b"; shape=4",       # Missing dtype
+])
+def test_rejects_invalid_metadata(content_type):
+    body = ToBody(np.arange(4, dtype=np.float32))
+    with pytest.raises(ValueError):
+        FromBody(received(body, content_type))
+
+def test_rejects_empty_body_with_elements():
+    body = ToBody(np.zeros((0,), dtype=np.float32))
+    with pytest.raises(ValueError):
+        FromBody(received(body, tensor_type("<f4", "2")))